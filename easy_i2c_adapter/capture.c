@@ -0,0 +1,131 @@
+/****************************************
+ * capture.c
+ * logic capture with a PIO state machine and DMA
+ * the program is built for each capture: a wait for each step of the trigger condition, then a
+ * single "in pins, count" that wraps onto itself, so a sample is taken every PIO clock, and the
+ * clock divider sets the rate. Autopush hands each full word to the RX FIFO, and DMA stores it
+ * **************************************/
+
+#include "capture.h"
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+#define CAPTURE_PIO pio0
+
+uint32_t capture_buf[CAPTURE_BUF_WORDS];
+
+static uint16_t program[3];
+static pio_program_t capture_program = {.instructions = program, .length = 1, .origin = -1};
+static int sm = -1;
+static int chan = -1;
+static int prog_offset = -1; // -1 while no program is loaded
+static uint8_t trig_len;     // instructions before the sampling loop
+static uint8_t per_word;     // samples in each word
+static uint32_t words;       // words to store
+static uint32_t stored;      // words stored, once the capture has ended
+static uint8_t state = CAPTURE_IDLE;
+
+// stops the state machine and the DMA, and frees the program's instruction memory
+static void
+capture_release(void)
+{
+    if (prog_offset < 0) {
+        return;
+    }
+    pio_sm_set_enabled(CAPTURE_PIO, sm, false);
+    dma_channel_abort(chan);
+    pio_remove_program(CAPTURE_PIO, &capture_program, prog_offset);
+    prog_offset = -1;
+}
+
+uint32_t
+capture_start(uint8_t base, uint8_t count, uint32_t rate, uint32_t samples, uint8_t trig_pin,
+              uint8_t trig_type)
+{
+    pio_sm_config c;
+    dma_channel_config dc;
+    uint32_t sys = clock_get_hz(clk_sys);
+    uint32_t div; // in 1/256ths
+    if ((count == 0) || (base + count > CAPTURE_PINS_MAX) || (rate < CAPTURE_RATE_MIN) ||
+        (rate > CAPTURE_RATE_MAX) || (samples == 0) || (trig_type > CAPTURE_TRIG_FALLING) ||
+        ((trig_type != CAPTURE_TRIG_NONE) && (trig_pin >= CAPTURE_PINS_MAX))) {
+        return 0;
+    }
+    div = (uint32_t) ((((uint64_t) sys << 8) + rate / 2) / rate);
+    if ((div < 0x100) || (div > 0xFFFFFF) ||
+        ((samples + (32 / count) - 1) / (32 / count) > CAPTURE_BUF_WORDS)) {
+        return 0;
+    }
+    if (sm < 0) {
+        sm = pio_claim_unused_sm(CAPTURE_PIO, true);
+        chan = dma_claim_unused_channel(true);
+    }
+    capture_release();
+    per_word = 32 / count;
+    words = (samples + per_word - 1) / per_word;
+
+    // an edge is a wait for the opposite level, then a wait for the level
+    trig_len = 0;
+    if (trig_type == CAPTURE_TRIG_RISING) {
+        program[trig_len++] = pio_encode_wait_gpio(false, trig_pin);
+    } else if (trig_type == CAPTURE_TRIG_FALLING) {
+        program[trig_len++] = pio_encode_wait_gpio(true, trig_pin);
+    }
+    if ((trig_type == CAPTURE_TRIG_HIGH) || (trig_type == CAPTURE_TRIG_RISING)) {
+        program[trig_len++] = pio_encode_wait_gpio(true, trig_pin);
+    } else if ((trig_type == CAPTURE_TRIG_LOW) || (trig_type == CAPTURE_TRIG_FALLING)) {
+        program[trig_len++] = pio_encode_wait_gpio(false, trig_pin);
+    }
+    program[trig_len] = pio_encode_in(pio_pins, count);
+    capture_program.length = trig_len + 1;
+    prog_offset = pio_add_program(CAPTURE_PIO, &capture_program);
+
+    c = pio_get_default_sm_config();
+    sm_config_set_in_pins(&c, base);
+    sm_config_set_wrap(&c, prog_offset + trig_len, prog_offset + trig_len);
+    sm_config_set_clkdiv_int_frac(&c, div >> 8, div & 0xFF);
+    sm_config_set_in_shift(&c, true, true, per_word * count);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    pio_sm_init(CAPTURE_PIO, sm, prog_offset, &c);
+
+    dc = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&dc, DMA_SIZE_32);
+    channel_config_set_read_increment(&dc, false);
+    channel_config_set_write_increment(&dc, true);
+    channel_config_set_dreq(&dc, pio_get_dreq(CAPTURE_PIO, sm, false));
+    dma_channel_configure(chan, &dc, capture_buf, &CAPTURE_PIO->rxf[sm], words, true);
+    pio_sm_set_enabled(CAPTURE_PIO, sm, true);
+    state = CAPTURE_ARMED;
+    return (uint32_t) (((uint64_t) sys << 8) / div);
+}
+
+int
+capture_poll(uint32_t *samples, uint32_t *nwords)
+{
+    uint32_t n = stored;
+    if ((state == CAPTURE_ARMED) || (state == CAPTURE_RUNNING)) {
+        n = words - dma_channel_hw_addr(chan)->transfer_count;
+        if (n == words) {
+            capture_release();
+            stored = n;
+            state = CAPTURE_DONE;
+        } else if ((n > 0) || (pio_sm_get_pc(CAPTURE_PIO, sm) == prog_offset + trig_len)) {
+            state = CAPTURE_RUNNING;
+        }
+    }
+    *samples = n * per_word;
+    *nwords = n;
+    return state;
+}
+
+void
+capture_stop(void)
+{
+    if ((state == CAPTURE_ARMED) || (state == CAPTURE_RUNNING)) {
+        stored = words - dma_channel_hw_addr(chan)->transfer_count;
+        capture_release();
+        state = CAPTURE_DONE;
+    }
+}
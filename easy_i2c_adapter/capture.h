@@ -0,0 +1,44 @@
+#ifndef _CAPTURE_HEADER_FILE_
+#define _CAPTURE_HEADER_FILE_
+
+/***********************************
+ * capture.h
+ * logic capture: a PIO state machine samples a range of GPIOs at a fixed rate,
+ * and DMA stores the samples in capture_buf, without the CPU
+ * *********************************/
+
+#include <stdint.h>
+
+#define CAPTURE_BUF_WORDS 16384 // 64 KB of samples
+#define CAPTURE_PINS_MAX 30 // base + count may not go beyond the last GPIO
+#define CAPTURE_RATE_MIN 2000 // slowest rate the PIO clock divider reaches
+#define CAPTURE_RATE_MAX 62500000 // half the system clock, so DMA keeps up with every pin count
+
+// trigger types: the capture starts once the trigger pin meets the condition
+#define CAPTURE_TRIG_NONE 0 // at once
+#define CAPTURE_TRIG_HIGH 1
+#define CAPTURE_TRIG_LOW 2
+#define CAPTURE_TRIG_RISING 3 // a low to high edge
+#define CAPTURE_TRIG_FALLING 4 // a high to low edge, e.g. SDA for an I2C start
+
+// capture_poll states
+#define CAPTURE_IDLE 0 // no capture since boot
+#define CAPTURE_ARMED 1 // waiting for the trigger
+#define CAPTURE_RUNNING 2
+#define CAPTURE_DONE 3 // complete, or stopped early by capture_stop
+
+// sample packing: each 32-bit word (little-endian) holds 32 / count samples, without splitting any
+// across words. The samples occupy the top bits of the word, oldest first: sample k of the word
+// starts at bit 32 - (32 / count) * count + k * count, and holds GPIO base + i at bit i from there
+extern uint32_t capture_buf[CAPTURE_BUF_WORDS];
+
+// starts a capture of count GPIOs from base, samples samples at rate Hz (rounded up to fill the last
+// word), after the trigger condition on trig_pin. Any capture in progress is stopped first.
+// returns the sample rate achieved, or 0 if an argument is invalid
+uint32_t capture_start(uint8_t base, uint8_t count, uint32_t rate, uint32_t samples, uint8_t trig_pin,
+                       uint8_t trig_type);
+// returns the CAPTURE_ state, and sets *samples and *words to the numbers stored so far
+int capture_poll(uint32_t *samples, uint32_t *words);
+void capture_stop(void); // ends the capture early, keeping the samples stored so far
+
+#endif // _CAPTURE_HEADER_FILE_
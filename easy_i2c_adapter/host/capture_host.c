@@ -0,0 +1,134 @@
+/****************************************
+ * capture_host.c
+ * capture.h for the host simulation build, in place of capture.c: a repeating timer stands in for
+ * the state machine, checking the trigger and storing the samples due since its previous tick, all
+ * with the levels it reads then. The simulated bus has no waveform, so SDA and SCL read as idle
+ * **************************************/
+
+#include "capture.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#define CAPTURE_TICK_US 100
+
+uint32_t capture_buf[CAPTURE_BUF_WORDS];
+
+static repeating_timer_t capture_timer;
+static uint8_t timer_running = 0;
+static uint8_t cap_base;
+static uint8_t cap_count;
+static uint8_t per_word;
+static uint8_t cap_trig_pin;
+static uint8_t cap_trig_type;
+static uint8_t cap_trig_level; // the trigger pin's level at the previous tick, for the edge triggers
+static uint32_t cap_rate;
+static uint32_t total;     // samples to store, a whole number of words
+static uint32_t stored;    // samples stored
+static uint64_t start_us;  // time of the trigger
+static uint8_t state = CAPTURE_IDLE;
+
+static void
+store_sample(uint32_t levels)
+{
+    uint32_t w = stored / per_word;
+    uint32_t k = stored % per_word;
+    uint32_t mask = (cap_count == 32) ? 0xFFFFFFFF : ((1UL << cap_count) - 1);
+    if (k == 0) {
+        capture_buf[w] = 0;
+    }
+    capture_buf[w] |= ((levels >> cap_base) & mask) << (32 - per_word * cap_count + k * cap_count);
+    stored++;
+}
+
+static bool
+capture_tick(repeating_timer_t *rt)
+{
+    uint32_t levels = gpio_get_all();
+    uint64_t now = time_us_64();
+    uint64_t due;
+    uint8_t level = (levels >> cap_trig_pin) & 1;
+    if (state == CAPTURE_ARMED) {
+        if (((cap_trig_type == CAPTURE_TRIG_HIGH) && level) ||
+            ((cap_trig_type == CAPTURE_TRIG_LOW) && !level) ||
+            ((cap_trig_type == CAPTURE_TRIG_RISING) && !cap_trig_level && level) ||
+            ((cap_trig_type == CAPTURE_TRIG_FALLING) && cap_trig_level && !level)) {
+            state = CAPTURE_RUNNING;
+            start_us = now;
+        }
+        cap_trig_level = level;
+    }
+    if (state != CAPTURE_RUNNING) {
+        return true;
+    }
+    due = ((now - start_us) * cap_rate) / 1000000 + 1;
+    while ((stored < due) && (stored < total)) {
+        store_sample(levels);
+    }
+    if (stored == total) {
+        state = CAPTURE_DONE;
+    }
+    return true;
+}
+
+static void
+capture_release(void)
+{
+    if (timer_running) {
+        cancel_repeating_timer(&capture_timer);
+        timer_running = 0;
+    }
+}
+
+uint32_t
+capture_start(uint8_t base, uint8_t count, uint32_t rate, uint32_t samples, uint8_t trig_pin,
+              uint8_t trig_type)
+{
+    if ((count == 0) || (base + count > CAPTURE_PINS_MAX) || (rate < CAPTURE_RATE_MIN) ||
+        (rate > CAPTURE_RATE_MAX) || (samples == 0) || (trig_type > CAPTURE_TRIG_FALLING) ||
+        ((trig_type != CAPTURE_TRIG_NONE) && (trig_pin >= CAPTURE_PINS_MAX)) ||
+        ((samples + (32 / count) - 1) / (32 / count) > CAPTURE_BUF_WORDS)) {
+        return 0;
+    }
+    capture_release();
+    cap_base = base;
+    cap_count = count;
+    per_word = 32 / count;
+    total = ((samples + per_word - 1) / per_word) * per_word;
+    stored = 0;
+    cap_rate = rate;
+    cap_trig_type = trig_type;
+    cap_trig_pin = (trig_type == CAPTURE_TRIG_NONE) ? 0 : trig_pin;
+    cap_trig_level = (gpio_get_all() >> cap_trig_pin) & 1;
+    start_us = time_us_64();
+    state = (trig_type == CAPTURE_TRIG_NONE) ? CAPTURE_RUNNING : CAPTURE_ARMED;
+    timer_running = add_repeating_timer_us(-CAPTURE_TICK_US, capture_tick, NULL, &capture_timer);
+    return rate;
+}
+
+int
+capture_poll(uint32_t *samples, uint32_t *words)
+{
+    int s;
+    uint32_t flags = save_and_disable_interrupts();
+    // whole words only, as the DMA would store them
+    *words = (per_word > 0) ? stored / per_word : 0;
+    *samples = *words * per_word;
+    s = state;
+    restore_interrupts(flags);
+    if (s == CAPTURE_DONE) {
+        capture_release();
+    }
+    return s;
+}
+
+void
+capture_stop(void)
+{
+    uint32_t flags = save_and_disable_interrupts();
+    if ((state == CAPTURE_ARMED) || (state == CAPTURE_RUNNING)) {
+        stored = (stored / per_word) * per_word;
+        state = CAPTURE_DONE;
+    }
+    restore_interrupts(flags);
+    capture_release();
+}
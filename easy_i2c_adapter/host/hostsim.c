@@ -0,0 +1,196 @@
+/****************************************
+ * hostsim.c
+ * host simulation build: runs the firmware (main.c, built with main renamed to firmware_main)
+ * as a Linux program. Its stdio is a pseudo-terminal that EasyAdapter opens like the Pico's
+ * COM port, and its I2C buses hold virtual devices (simdev.c) with a bus timing model (simbus.c)
+ * **************************************/
+
+#include "pico_shim.h"
+#include "simbus.h"
+#include "simdev.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define BOARD_ADDR0_PIN 2 // must match main.c
+#define BOARD_ADDR1_PIN 3
+#define BOARD_ADDR2_PIN 4
+#define DEFAULT_WRITE_CYCLE_US 5000
+
+static int cur_bus; // the bus of the devices being added
+
+int firmware_main(void);
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -l, --link PATH        also make PATH a symlink to the pseudo-terminal\n"
+            "  -b, --board N          board address 0 to 7, as set by the ADDR pins (default 0)\n"
+            "  -e, --eeprom ADDR[,SIZE[,ADDRBYTES[,PAGE[,TWR_US]]]]\n"
+            "                         add an EEPROM, by default 256 bytes with 8-byte pages\n"
+            "  -s, --sensor ADDR      add a register-file sensor\n"
+            "  -x, --stuck ADDR       add a device that holds SCL low once addressed\n"
+            "  -c, --stretch ADDR,US  clock stretching per byte for a device added before\n"
+            "  -B, --bus SDA,SCL      add a bus on these pins, for the devices that follow (set it up\n"
+            "                         with buscfg). The devices before the first -B are on GPIO 14 and 15\n"
+            "  -t, --timing SCALE     bus timing, 1 for real time (default), 0 for instant transfers\n"
+            "  -p, --pin GPIO=LEVEL   drive an input pin externally to 0 or 1\n"
+            "with no devices given, there is a sensor at 0x48, a 24C02 EEPROM at 0x50\n"
+            "and a 24C256 EEPROM (16-bit addresses, 64-byte pages) at 0x54\n",
+            prog);
+}
+
+static void
+on_signal(int sig)
+{
+    shim_stdio_close();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int
+add_eeprom(const char *spec)
+{
+    unsigned int addr, size = 256, addr_bytes = 0, page = 0, twr = DEFAULT_WRITE_CYCLE_US;
+    int n = sscanf(spec, "%i,%i,%i,%i,%i", &addr, &size, &addr_bytes, &page, &twr);
+    if (n < 1) {
+        return 0;
+    }
+    if (n < 3) {
+        addr_bytes = (size > 256) ? 2 : 1;
+    }
+    if (n < 4) {
+        page = (size > 2048) ? 64 : 8;
+    }
+    return simdev_add_eeprom(cur_bus, addr, size, addr_bytes, page, twr) != NULL;
+}
+
+static int
+set_stretch(const char *spec)
+{
+    unsigned int addr, us;
+    sim_dev_t *d;
+    if ((sscanf(spec, "%i,%i", &addr, &us) != 2) || ((d = simdev_find(cur_bus, addr)) == NULL)) {
+        return 0;
+    }
+    d->stretch_us = us;
+    return 1;
+}
+
+static void
+print_devices(const char *path, int board)
+{
+    sim_dev_t *d;
+    int i;
+    fprintf(stderr, "easy_adapter_%d on %s\n", board, path);
+    for (i = 0; i < simdev_count(); i++) {
+        d = simdev_get(i);
+        fprintf(stderr, "  0x%02X %s", d->addr, d->kind);
+        if (simbus_count() > 1) {
+            fprintf(stderr, " on GPIO %d,%d", simbus_sda(d->bus), simbus_scl(d->bus));
+        }
+        if (strcmp(d->kind, "eeprom") == 0) {
+            fprintf(stderr, " %lu bytes, %d address byte(s), page %d, write cycle %lu us",
+                    (unsigned long) d->size, d->addr_bytes, d->page, (unsigned long) d->write_cycle_us);
+        }
+        if ((d->stretch_us > 0) && (d->stretch_us != SIM_STRETCH_FOREVER)) {
+            fprintf(stderr, ", stretches %lu us per byte", (unsigned long) d->stretch_us);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        {"link", required_argument, NULL, 'l'},
+        {"board", required_argument, NULL, 'b'},
+        {"eeprom", required_argument, NULL, 'e'},
+        {"sensor", required_argument, NULL, 's'},
+        {"stuck", required_argument, NULL, 'x'},
+        {"stretch", required_argument, NULL, 'c'},
+        {"bus", required_argument, NULL, 'B'},
+        {"timing", required_argument, NULL, 't'},
+        {"pin", required_argument, NULL, 'p'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *link = NULL;
+    const char *path;
+    int board = 0;
+    int ok = 1;
+    int c, gpio, level, sda, scl;
+    unsigned int addr;
+    cur_bus = simbus_add(SHIM_SDA_PIN, SHIM_SCL_PIN);
+    while ((c = getopt_long(argc, argv, "l:b:e:s:x:c:B:t:p:h", opts, NULL)) != -1) {
+        switch (c) {
+            case 'l':
+                link = optarg;
+                break;
+            case 'b':
+                board = atoi(optarg);
+                ok = (board >= 0) && (board <= 7);
+                break;
+            case 'e':
+                ok = add_eeprom(optarg);
+                break;
+            case 's':
+                ok = (sscanf(optarg, "%i", &addr) == 1) && (simdev_add_sensor(cur_bus, addr) != NULL);
+                break;
+            case 'x':
+                ok = (sscanf(optarg, "%i", &addr) == 1) && (simdev_add_stuck(cur_bus, addr) != NULL);
+                break;
+            case 'c':
+                ok = set_stretch(optarg);
+                break;
+            case 'B':
+                ok = (sscanf(optarg, "%d,%d", &sda, &scl) == 2) && (sda >= 0) && (sda < NUM_BANK0_GPIOS) &&
+                     (scl >= 0) && (scl < NUM_BANK0_GPIOS) && ((cur_bus = simbus_add(sda, scl)) >= 0);
+                break;
+            case 't':
+                simbus_timing.time_scale = atof(optarg);
+                ok = (simbus_timing.time_scale >= 0);
+                break;
+            case 'p':
+                ok = (sscanf(optarg, "%d=%d", &gpio, &level) == 2) && (gpio >= 0) &&
+                     (gpio < NUM_BANK0_GPIOS) && ((level == 0) || (level == 1));
+                if (ok) {
+                    shim_gpio_drive(gpio, level);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return (c == 'h') ? 0 : 1;
+        }
+        if (!ok) {
+            fprintf(stderr, "invalid option -%c %s\n", c, optarg);
+            return 1;
+        }
+    }
+    if (simdev_count() == 0) {
+        simdev_add_sensor(0, 0x48);
+        simdev_add_eeprom(0, 0x50, 256, 1, 8, DEFAULT_WRITE_CYCLE_US);
+        simdev_add_eeprom(0, 0x54, 32768, 2, 64, DEFAULT_WRITE_CYCLE_US);
+    }
+    // the ADDR pins are pulled up, and grounded by a jumper for a 0 bit. Board 0 has no jumpers
+    shim_gpio_drive(BOARD_ADDR0_PIN, ((7 - board) >> 0) & 1);
+    shim_gpio_drive(BOARD_ADDR1_PIN, ((7 - board) >> 1) & 1);
+    shim_gpio_drive(BOARD_ADDR2_PIN, ((7 - board) >> 2) & 1);
+
+    path = shim_stdio_open(link);
+    if (path == NULL) {
+        perror("cannot open the pseudo-terminal");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    print_devices(path, board);
+    return firmware_main();
+}
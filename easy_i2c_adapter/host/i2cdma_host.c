@@ -0,0 +1,86 @@
+/****************************************
+ * i2cdma_host.c
+ * i2cdma.h for the host simulation build, in place of i2cdma.c: the transfer is carried out on the
+ * simulated bus when it starts, and i2c_dma_poll reports it busy until the time the timing model
+ * gives for it has passed, or its deadline
+ * **************************************/
+
+#include "i2cdma.h"
+#include "simbus.h"
+#include "pico_shim.h"
+
+// the outcome of the transfer of each controller (i2c_inst_t index) is kept here
+static int dma_result[2];
+static uint64_t dma_done_at[2];
+
+void
+i2c_dma_init(i2c_dma_t *d, i2c_inst_t *i2c)
+{
+    d->i2c = i2c;
+    d->tx_chan = 2 * i2c->index;
+    d->rx_chan = 2 * i2c->index + 1;
+    d->len = 0;
+}
+
+static int
+i2c_dma_start(i2c_dma_t *d, uint8_t addr, uint8_t *buf, size_t len, bool reading, bool nostop,
+              uint32_t timeout_us)
+{
+    uint64_t duration;
+    uint64_t now = time_us_64();
+    uint8_t i = d->i2c->index;
+    if ((len == 0) || (len > I2C_DMA_MAX_LEN)) {
+        return PICO_ERROR_GENERIC;
+    }
+    d->len = len;
+    d->reading = reading;
+    d->nostop = nostop;
+    d->deadline = make_timeout_time_us(timeout_us);
+    dma_result[i] = simbus_transfer(shim_i2c_bus(d->i2c), addr, reading, buf, len, nostop, &duration);
+    dma_done_at[i] = (duration == SIMBUS_FOREVER) ? SIMBUS_FOREVER : now + duration;
+    return 0;
+}
+
+int
+i2c_dma_start_write(i2c_dma_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return i2c_dma_start(d, addr, (uint8_t *) src, len, false, nostop, timeout_us);
+}
+
+int
+i2c_dma_start_read(i2c_dma_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return i2c_dma_start(d, addr, dst, len, true, nostop, timeout_us);
+}
+
+int
+i2c_dma_poll(i2c_dma_t *d)
+{
+    uint64_t now = time_us_64();
+    uint8_t i = d->i2c->index;
+    if ((dma_done_at[i] > d->deadline) && (now >= d->deadline)) {
+        d->i2c->restart_on_next = false;
+        return PICO_ERROR_TIMEOUT;
+    }
+    if (now < dma_done_at[i]) {
+        return I2C_DMA_BUSY;
+    }
+    d->i2c->restart_on_next = (dma_result[i] >= 0) && d->nostop;
+    return dma_result[i];
+}
+
+int
+i2c_dma_wait(i2c_dma_t *d)
+{
+    int res;
+    uint64_t wake, now;
+    uint8_t i = d->i2c->index;
+    while ((res = i2c_dma_poll(d)) == I2C_DMA_BUSY) {
+        wake = (dma_done_at[i] < d->deadline) ? dma_done_at[i] : d->deadline;
+        now = time_us_64();
+        if (wake > now) {
+            busy_wait_us_32((uint32_t) (wake - now));
+        }
+    }
+    return res;
+}
@@ -0,0 +1,11 @@
+#ifndef _HARDWARE_GPIO_SHIM_HEADER_FILE_
+#define _HARDWARE_GPIO_SHIM_HEADER_FILE_
+
+/***********************************
+ * hardware/gpio.h (host simulation build)
+ * the GPIO functions are declared with the rest of the shim in pico/stdlib.h
+ * *********************************/
+
+#include "pico/stdlib.h"
+
+#endif // _HARDWARE_GPIO_SHIM_HEADER_FILE_
@@ -0,0 +1,32 @@
+#ifndef _HARDWARE_I2C_SHIM_HEADER_FILE_
+#define _HARDWARE_I2C_SHIM_HEADER_FILE_
+
+/***********************************
+ * hardware/i2c.h (host simulation build)
+ * I2C controller functions, transferring to the virtual devices on the simulated bus
+ * *********************************/
+
+#include "pico/stdlib.h"
+
+typedef struct i2c_inst {
+    uint8_t index;
+    uint32_t baudrate;
+    bool restart_on_next;
+} i2c_inst_t;
+
+extern i2c_inst_t i2c0_inst;
+extern i2c_inst_t i2c1_inst;
+#define i2c0 (&i2c0_inst)
+#define i2c1 (&i2c1_inst)
+
+unsigned int i2c_init(i2c_inst_t *i2c, unsigned int baudrate); // returns the speed achieved
+void i2c_deinit(i2c_inst_t *i2c);
+unsigned int i2c_set_baudrate(i2c_inst_t *i2c, unsigned int baudrate);
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop,
+                         unsigned int timeout_us);
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop,
+                        unsigned int timeout_us);
+
+#endif // _HARDWARE_I2C_SHIM_HEADER_FILE_
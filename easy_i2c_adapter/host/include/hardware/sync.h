@@ -0,0 +1,16 @@
+#ifndef _HARDWARE_SYNC_SHIM_HEADER_FILE_
+#define _HARDWARE_SYNC_SHIM_HEADER_FILE_
+
+/***********************************
+ * hardware/sync.h (host simulation build)
+ * "interrupts" are the timer threads, held off with a lock
+ * *********************************/
+
+#include <stdint.h>
+
+void __wfe(void); // waits for an event from __sev, or a short while
+void __sev(void);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+#endif // _HARDWARE_SYNC_SHIM_HEADER_FILE_
@@ -0,0 +1,11 @@
+#ifndef _PICO_MULTICORE_SHIM_HEADER_FILE_
+#define _PICO_MULTICORE_SHIM_HEADER_FILE_
+
+/***********************************
+ * pico/multicore.h (host simulation build)
+ * core1 is a thread
+ * *********************************/
+
+void multicore_launch_core1(void (*entry)(void));
+
+#endif // _PICO_MULTICORE_SHIM_HEADER_FILE_
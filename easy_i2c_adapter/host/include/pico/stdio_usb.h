@@ -0,0 +1,17 @@
+#ifndef _PICO_STDIO_USB_SHIM_HEADER_FILE_
+#define _PICO_STDIO_USB_SHIM_HEADER_FILE_
+
+/***********************************
+ * pico/stdio_usb.h (host simulation build)
+ * the USB stdio driver, whose output goes to the pseudo-terminal like the rest of stdio
+ * *********************************/
+
+#include "pico/stdlib.h"
+
+typedef struct stdio_driver {
+    void (*out_chars)(const char *buf, int len);
+} stdio_driver_t;
+
+extern stdio_driver_t stdio_usb;
+
+#endif // _PICO_STDIO_USB_SHIM_HEADER_FILE_
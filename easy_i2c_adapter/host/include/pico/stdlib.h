@@ -0,0 +1,83 @@
+#ifndef _PICO_STDLIB_SHIM_HEADER_FILE_
+#define _PICO_STDLIB_SHIM_HEADER_FILE_
+
+/***********************************
+ * pico/stdlib.h (host simulation build)
+ * the subset of the Pico SDK used by the firmware, implemented on Linux in pico_shim.c
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+#define PICO_ERROR_GENERIC -2
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+#define GPIO_FUNC_I2C 3
+#define GPIO_FUNC_SIO 5
+#define GPIO_FUNC_PIO1 7
+#define GPIO_OVERRIDE_NORMAL 0
+#define GPIO_OVERRIDE_INVERT 1
+#define NUM_BANK0_GPIOS 30
+
+typedef uint64_t absolute_time_t; // usec since the simulation started
+
+// stdio, connected to the pseudo-terminal
+void stdio_init_all(void);
+int getchar_timeout_us(uint32_t timeout_us);
+int putchar_raw(int c);
+void stdio_flush(void);
+
+// time
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+absolute_time_t get_absolute_time(void);
+absolute_time_t make_timeout_time_us(uint64_t us);
+absolute_time_t make_timeout_time_ms(uint32_t ms);
+bool time_reached(absolute_time_t t);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us_32(uint32_t us);
+void tight_loop_contents(void);
+
+// repeating timers, each run from its own thread
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+    void *host; // simulation state
+};
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data,
+                            repeating_timer_t *out);
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data,
+                            repeating_timer_t *out);
+bool cancel_repeating_timer(repeating_timer_t *timer);
+
+// GPIO. The SDA and SCL pins of each simulated I2C bus (14 and 15 for bus 0) are wired to it, so
+// bit-banged transfers reach the virtual devices; the other pins read back their output or pull level
+void gpio_init(unsigned int gpio);
+void gpio_init_mask(uint32_t mask);
+void gpio_set_function(unsigned int gpio, int fn);
+int gpio_get_function(unsigned int gpio);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_set_dir_masked(uint32_t mask, uint32_t value);
+bool gpio_get_dir(unsigned int gpio);
+void gpio_put(unsigned int gpio, bool value);
+void gpio_put_masked(uint32_t mask, uint32_t value);
+bool gpio_get(unsigned int gpio);
+uint32_t gpio_get_all(void);
+bool gpio_get_out_level(unsigned int gpio);
+void gpio_set_pulls(unsigned int gpio, bool up, bool down);
+void gpio_pull_up(unsigned int gpio);
+void gpio_pull_down(unsigned int gpio);
+void gpio_disable_pulls(unsigned int gpio);
+void gpio_set_oeover(unsigned int gpio, unsigned int value);
+
+#endif // _PICO_STDLIB_SHIM_HEADER_FILE_
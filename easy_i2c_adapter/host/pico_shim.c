@@ -0,0 +1,765 @@
+/****************************************
+ * pico_shim.c
+ * the Pico SDK calls used by the firmware, implemented on Linux for the host simulation build:
+ * stdio on a pseudo-terminal, time, GPIO (with SDA/SCL wired to the simulated buses), repeating
+ * timers and core1 as threads, and the I2C controller on top of simbus.c
+ * **************************************/
+
+#define _GNU_SOURCE
+#include "pico_shim.h"
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/stdio_usb.h"
+#include "hardware/i2c.h"
+#include "hardware/sync.h"
+#include "simbus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define SHIM_CLK_SYS_HZ 125000000 // the I2C speed achieved is worked out from this, as in the SDK
+
+i2c_inst_t i2c0_inst = {0, 0, false};
+i2c_inst_t i2c1_inst = {1, 0, false};
+
+/************* time ***************/
+
+static uint64_t time_origin_ns = 0;
+
+static uint64_t
+mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t
+time_us_64(void)
+{
+    if (time_origin_ns == 0) {
+        time_origin_ns = mono_ns();
+    }
+    return (mono_ns() - time_origin_ns) / 1000;
+}
+
+uint32_t
+time_us_32(void)
+{
+    return (uint32_t) time_us_64();
+}
+
+absolute_time_t
+get_absolute_time(void)
+{
+    return time_us_64();
+}
+
+absolute_time_t
+make_timeout_time_us(uint64_t us)
+{
+    return time_us_64() + us;
+}
+
+absolute_time_t
+make_timeout_time_ms(uint32_t ms)
+{
+    return time_us_64() + (uint64_t) ms * 1000;
+}
+
+bool
+time_reached(absolute_time_t t)
+{
+    return time_us_64() >= t;
+}
+
+int64_t
+absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+    return (int64_t) (to - from);
+}
+
+absolute_time_t
+delayed_by_us(absolute_time_t t, uint64_t us)
+{
+    return t + us;
+}
+
+// sleeps until the absolute time t (in time_us_64 terms)
+static void
+sleep_until_us(uint64_t t)
+{
+    struct timespec ts;
+    uint64_t ns;
+    time_us_64(); // sets the origin
+    ns = time_origin_ns + t * 1000;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void
+sleep_us(uint64_t us)
+{
+    stdio_flush(); // as the USB stdio would send the output meanwhile
+    sleep_until_us(time_us_64() + us);
+}
+
+void
+sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t) ms * 1000);
+}
+
+void
+busy_wait_us_32(uint32_t us)
+{
+    sleep_until_us(time_us_64() + us);
+}
+
+void
+tight_loop_contents(void)
+{
+    sched_yield();
+}
+
+/************* stdio ***************/
+
+static int pty_fd = -1;
+static int pty_slave_fd = -1; // kept open, so the pty stays up while no client has it open
+static char pty_link[256] = "";
+static uint8_t rx_buf[4096];
+static size_t rx_len = 0;
+static size_t rx_pos = 0;
+// the output of printf and putchar, and of the raw writes, in the order it was made
+static char tx_out[16384];
+static size_t tx_out_len = 0;
+
+// sends the output to the pty. If the reader stalls, the output is dropped rather
+// than blocking the firmware, as the Pico's USB stdio does
+static void
+tx_out_drain(void)
+{
+    size_t done = 0;
+    ssize_t n;
+    struct pollfd pfd = {pty_fd, POLLOUT, 0};
+    while (done < tx_out_len) {
+        n = write(pty_fd, tx_out + done, tx_out_len - done);
+        if (n > 0) {
+            done += n;
+        } else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            break;
+        } else if (poll(&pfd, 1, SHIM_TX_STALL_MS) <= 0) {
+            break;
+        }
+    }
+    tx_out_len = 0;
+}
+
+// queues output for the pty. crlf sends each '\n' as CR LF, as the SDK's stdio does for printf
+// and putchar (but not for putchar_raw or the driver's out_chars)
+static void
+tx_out_put(const char *buf, size_t size, bool crlf)
+{
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (tx_out_len >= sizeof(tx_out) - 1) {
+            tx_out_drain();
+        }
+        if (crlf && (buf[i] == '\n')) {
+            tx_out[tx_out_len++] = '\r';
+        }
+        tx_out[tx_out_len++] = buf[i];
+    }
+}
+
+// writes for the firmware's stdout. stdout is unbuffered, so its output and the raw writes
+// reach tx_out in order
+static ssize_t
+pty_cookie_write(void *cookie, const char *buf, size_t size)
+{
+    (void) cookie;
+    tx_out_put(buf, size, true);
+    return (ssize_t) size;
+}
+
+const char *
+shim_stdio_open(const char *link)
+{
+    static cookie_io_functions_t io = {NULL, pty_cookie_write, NULL, NULL};
+    struct termios t;
+    const char *path;
+    FILE *f;
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((pty_fd < 0) || (grantpt(pty_fd) != 0) || (unlockpt(pty_fd) != 0)) {
+        return NULL;
+    }
+    path = ptsname(pty_fd);
+    pty_slave_fd = open(path, O_RDWR | O_NOCTTY);
+    if (pty_slave_fd < 0) {
+        return NULL;
+    }
+    tcgetattr(pty_slave_fd, &t);
+    cfmakeraw(&t);
+    tcsetattr(pty_slave_fd, TCSANOW, &t);
+    fcntl(pty_fd, F_SETFL, fcntl(pty_fd, F_GETFL) | O_NONBLOCK);
+    f = fopencookie(NULL, "w", io);
+    if (f == NULL) {
+        return NULL;
+    }
+    setvbuf(f, NULL, _IONBF, 0);
+    stdout = f;
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(path, link) != 0) {
+            return NULL;
+        }
+        snprintf(pty_link, sizeof(pty_link), "%s", link);
+    }
+    return path;
+}
+
+void
+shim_stdio_close(void)
+{
+    if (pty_link[0] != 0) {
+        unlink(pty_link);
+        pty_link[0] = 0;
+    }
+}
+
+void
+stdio_init_all(void)
+{
+    // the pty is opened by hostsim.c before the firmware starts
+}
+
+void
+stdio_flush(void)
+{
+    tx_out_drain();
+}
+
+int
+getchar_timeout_us(uint32_t timeout_us)
+{
+    struct pollfd pfd = {pty_fd, POLLIN, 0};
+    struct timespec ts;
+    ssize_t n;
+    if (rx_pos < rx_len) {
+        return rx_buf[rx_pos++];
+    }
+    tx_out_drain(); // waiting for input, so any output should go now
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    if (ppoll(&pfd, 1, &ts, NULL) <= 0) {
+        if (timeout_us == 0) {
+            sched_yield(); // the main loop polls without a timeout, let the other threads run
+        }
+        return PICO_ERROR_TIMEOUT;
+    }
+    n = read(pty_fd, rx_buf, sizeof(rx_buf));
+    if (n <= 0) {
+        return PICO_ERROR_TIMEOUT;
+    }
+    rx_len = n;
+    rx_pos = 1;
+    return rx_buf[0];
+}
+
+int
+putchar_raw(int c)
+{
+    char ch = (char) c;
+    tx_out_put(&ch, 1, false);
+    return c;
+}
+
+static void
+usb_out_chars(const char *buf, int len)
+{
+    tx_out_put(buf, len, false);
+}
+
+stdio_driver_t stdio_usb = {usb_out_chars};
+
+/************* GPIO ***************/
+
+static uint8_t pin_func[NUM_BANK0_GPIOS];
+static bool pin_out[NUM_BANK0_GPIOS]; // direction
+static bool pin_level[NUM_BANK0_GPIOS]; // output latch
+static bool pin_pull_up[NUM_BANK0_GPIOS];
+static bool pin_pull_down[NUM_BANK0_GPIOS];
+static int8_t pin_drive[NUM_BANK0_GPIOS]; // external level, -1 if none (set up in shim_gpio_drive)
+static bool pin_drive_set = false;
+
+// bit-banged I2C on the SDA/SCL pins of each bus, decoded far enough to acknowledge an address byte
+static bool bb_scl[SIMBUS_MAX] = {true, true, true, true};
+static bool bb_sda[SIMBUS_MAX] = {true, true, true, true};
+static bool bb_active[SIMBUS_MAX];
+static uint8_t bb_bits[SIMBUS_MAX];
+static uint8_t bb_byte[SIMBUS_MAX];
+static bool bb_ack[SIMBUS_MAX]; // the addressed device is pulling SDA low for the ACK
+
+static void
+pin_drive_init(void)
+{
+    if (!pin_drive_set) {
+        memset(pin_drive, -1, sizeof(pin_drive));
+        pin_drive_set = true;
+    }
+}
+
+void
+shim_gpio_drive(unsigned int gpio, int level)
+{
+    pin_drive_init();
+    if (gpio < NUM_BANK0_GPIOS) {
+        pin_drive[gpio] = (int8_t) level;
+    }
+}
+
+// the level the firmware drives or pulls the pin to, ignoring the bus
+static bool
+pin_own_level(unsigned int gpio)
+{
+    pin_drive_init();
+    if (pin_out[gpio]) {
+        return pin_level[gpio];
+    }
+    if (pin_drive[gpio] >= 0) {
+        return pin_drive[gpio];
+    }
+    return pin_pull_up[gpio]; // a floating input reads 0
+}
+
+// a pin of a simulated bus, while the firmware drives it itself (not the I2C controller or PIO)
+static bool
+bus_pin(unsigned int gpio)
+{
+    return (simbus_find(gpio) >= 0) && (pin_func[gpio] == GPIO_FUNC_SIO);
+}
+
+// follows the open-drain SDA and SCL lines of bus b after the firmware changes either pin
+static void
+bb_update(int b)
+{
+    bool scl = pin_own_level(simbus_scl(b));
+    bool sda = pin_own_level(simbus_sda(b)) && !bb_ack[b];
+    if (scl && bb_scl[b] && (sda != bb_sda[b])) {
+        // SDA changing while SCL is high: start (falling) or stop (rising)
+        bb_active[b] = !sda;
+        bb_bits[b] = 0;
+        bb_byte[b] = 0;
+        bb_ack[b] = false;
+    } else if (scl && !bb_scl[b] && bb_active[b] && (bb_bits[b] < 8)) {
+        bb_byte[b] = (bb_byte[b] << 1) | sda;
+        bb_bits[b]++;
+    } else if (!scl && bb_scl[b] && bb_active[b]) {
+        if (bb_bits[b] == 8) {
+            bb_ack[b] = simbus_probe(b, bb_byte[b] >> 1);
+            bb_bits[b] = 9;
+        } else if (bb_bits[b] == 9) {
+            bb_ack[b] = false; // only the address byte is decoded
+            bb_active[b] = false;
+        }
+    }
+    bb_scl[b] = scl;
+    bb_sda[b] = pin_own_level(simbus_sda(b)) && !bb_ack[b];
+}
+
+static void
+pin_changed(unsigned int gpio)
+{
+    if (bus_pin(gpio)) {
+        bb_update(simbus_find(gpio));
+    }
+}
+
+void
+gpio_init(unsigned int gpio)
+{
+    pin_func[gpio] = GPIO_FUNC_SIO;
+    pin_out[gpio] = false;
+    pin_level[gpio] = false;
+    pin_changed(gpio);
+}
+
+void
+gpio_init_mask(uint32_t mask)
+{
+    unsigned int i;
+    for (i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (mask & (1UL << i)) {
+            gpio_init(i);
+        }
+    }
+}
+
+void
+gpio_set_function(unsigned int gpio, int fn)
+{
+    pin_func[gpio] = (uint8_t) fn;
+    pin_changed(gpio);
+}
+
+int
+gpio_get_function(unsigned int gpio)
+{
+    return pin_func[gpio];
+}
+
+void
+gpio_set_dir(unsigned int gpio, bool out)
+{
+    pin_out[gpio] = out;
+    pin_changed(gpio);
+}
+
+void
+gpio_set_dir_masked(uint32_t mask, uint32_t value)
+{
+    unsigned int i;
+    for (i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (mask & (1UL << i)) {
+            gpio_set_dir(i, (value >> i) & 1);
+        }
+    }
+}
+
+bool
+gpio_get_dir(unsigned int gpio)
+{
+    return pin_out[gpio];
+}
+
+void
+gpio_put(unsigned int gpio, bool value)
+{
+    pin_level[gpio] = value;
+    pin_changed(gpio);
+}
+
+void
+gpio_put_masked(uint32_t mask, uint32_t value)
+{
+    unsigned int i;
+    for (i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (mask & (1UL << i)) {
+            gpio_put(i, (value >> i) & 1);
+        }
+    }
+}
+
+bool
+gpio_get(unsigned int gpio)
+{
+    int b = simbus_find(gpio);
+    if ((b >= 0) && (simbus_sda(b) == gpio)) {
+        return pin_own_level(gpio) && !bb_ack[b];
+    }
+    return pin_own_level(gpio);
+}
+
+uint32_t
+gpio_get_all(void)
+{
+    uint32_t all = 0;
+    unsigned int i;
+    for (i = 0; i < NUM_BANK0_GPIOS; i++) {
+        all |= (uint32_t) gpio_get(i) << i;
+    }
+    return all;
+}
+
+bool
+gpio_get_out_level(unsigned int gpio)
+{
+    return pin_level[gpio];
+}
+
+void
+gpio_set_pulls(unsigned int gpio, bool up, bool down)
+{
+    pin_pull_up[gpio] = up;
+    pin_pull_down[gpio] = down;
+    pin_changed(gpio);
+}
+
+void
+gpio_pull_up(unsigned int gpio)
+{
+    gpio_set_pulls(gpio, true, false);
+}
+
+void
+gpio_pull_down(unsigned int gpio)
+{
+    gpio_set_pulls(gpio, false, true);
+}
+
+void
+gpio_disable_pulls(unsigned int gpio)
+{
+    gpio_set_pulls(gpio, false, false);
+}
+
+// only the PIO buses invert their output enables, and they are simulated without the pins
+void
+gpio_set_oeover(unsigned int gpio, unsigned int value)
+{
+    (void) gpio;
+    (void) value;
+}
+
+/************* interrupts, timers and core1 ***************/
+
+static pthread_mutex_t irq_lock;
+static pthread_once_t irq_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static bool event_flag = false;
+
+static void
+irq_lock_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&irq_lock, &attr);
+}
+
+uint32_t
+save_and_disable_interrupts(void)
+{
+    pthread_once(&irq_once, irq_lock_init);
+    pthread_mutex_lock(&irq_lock);
+    return 0;
+}
+
+void
+restore_interrupts(uint32_t status)
+{
+    (void) status;
+    pthread_mutex_unlock(&irq_lock);
+}
+
+void
+__wfe(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 1000000; // a real WFE can also wake up for no reason
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&event_lock);
+    if (!event_flag) {
+        pthread_cond_timedwait(&event_cond, &event_lock, &ts);
+    }
+    event_flag = false;
+    pthread_mutex_unlock(&event_lock);
+}
+
+void
+__sev(void)
+{
+    pthread_mutex_lock(&event_lock);
+    event_flag = true;
+    pthread_cond_broadcast(&event_cond);
+    pthread_mutex_unlock(&event_lock);
+}
+
+static void *
+core1_thread(void *arg)
+{
+    ((void (*)(void)) arg)();
+    return NULL;
+}
+
+void
+multicore_launch_core1(void (*entry)(void))
+{
+    pthread_t th;
+    pthread_create(&th, NULL, core1_thread, (void *) entry);
+    pthread_detach(th);
+}
+
+// a repeating timer runs its callback from its own thread, holding the "interrupt" lock
+typedef struct {
+    repeating_timer_t *rt;
+    uint64_t period_us;
+    bool from_start; // negative delay: the period is measured from one callback start to the next
+    volatile bool cancelled;
+} shim_timer_t;
+
+static void *
+timer_thread(void *arg)
+{
+    shim_timer_t *st = arg;
+    uint64_t next = time_us_64() + st->period_us;
+    bool keep = true;
+    while (keep) {
+        sleep_until_us(next);
+        save_and_disable_interrupts();
+        if (st->cancelled) {
+            restore_interrupts(0);
+            break;
+        }
+        keep = st->rt->callback(st->rt);
+        restore_interrupts(0);
+        if (st->from_start) {
+            next += st->period_us;
+            if (next < time_us_64()) {
+                next = time_us_64(); // too far behind, do not try to catch up
+            }
+        } else {
+            next = time_us_64() + st->period_us;
+        }
+    }
+    free(st);
+    return NULL;
+}
+
+bool
+add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data,
+                       repeating_timer_t *out)
+{
+    shim_timer_t *st;
+    pthread_t th;
+    if (delay_us == 0) {
+        return false;
+    }
+    st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        return false;
+    }
+    st->rt = out;
+    st->period_us = (delay_us < 0) ? -delay_us : delay_us;
+    st->from_start = (delay_us < 0);
+    out->delay_us = delay_us;
+    out->callback = callback;
+    out->user_data = user_data;
+    out->host = st;
+    if (pthread_create(&th, NULL, timer_thread, st) != 0) {
+        free(st);
+        return false;
+    }
+    pthread_detach(th);
+    return true;
+}
+
+bool
+add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data,
+                       repeating_timer_t *out)
+{
+    return add_repeating_timer_us((int64_t) delay_ms * 1000, callback, user_data, out);
+}
+
+bool
+cancel_repeating_timer(repeating_timer_t *timer)
+{
+    shim_timer_t *st = timer->host;
+    if (st == NULL) {
+        return false;
+    }
+    // the thread frees st once it sees the flag, and never calls the callback again
+    save_and_disable_interrupts();
+    st->cancelled = true;
+    timer->host = NULL;
+    restore_interrupts(0);
+    return true;
+}
+
+/************* I2C ***************/
+
+unsigned int
+i2c_init(i2c_inst_t *i2c, unsigned int baudrate)
+{
+    return i2c_set_baudrate(i2c, baudrate);
+}
+
+void
+i2c_deinit(i2c_inst_t *i2c)
+{
+    (void) i2c;
+}
+
+unsigned int
+i2c_set_baudrate(i2c_inst_t *i2c, unsigned int baudrate)
+{
+    uint32_t period = (SHIM_CLK_SYS_HZ + baudrate / 2) / baudrate;
+    i2c->baudrate = SHIM_CLK_SYS_HZ / period;
+    i2c->restart_on_next = false;
+    simbus_timing.baud = i2c->baudrate;
+    return i2c->baudrate;
+}
+
+int
+shim_i2c_bus(i2c_inst_t *i2c)
+{
+    unsigned int p;
+    for (p = 2 * i2c->index; p < NUM_BANK0_GPIOS; p += 4) {
+        if (pin_func[p] == GPIO_FUNC_I2C) {
+            return simbus_find(p);
+        }
+    }
+    return -1;
+}
+
+// a transfer that takes as long as the timing model says, or times out (timeout_us 0 for none)
+static int
+i2c_transfer(i2c_inst_t *i2c, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop,
+             unsigned int timeout_us)
+{
+    uint64_t start = time_us_64();
+    uint64_t duration;
+    int ret = simbus_transfer(shim_i2c_bus(i2c), addr, read, buf, len, nostop, &duration);
+    if ((timeout_us > 0) && (duration > timeout_us)) {
+        sleep_until_us(start + timeout_us);
+        i2c->restart_on_next = false;
+        return PICO_ERROR_TIMEOUT;
+    }
+    while (duration == SIMBUS_FOREVER) {
+        sleep_ms(1000); // a blocking transfer hangs, as it would on the Pico
+    }
+    sleep_until_us(start + duration);
+    i2c->restart_on_next = (ret >= 0) && nostop;
+    return ret;
+}
+
+int
+i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop)
+{
+    return i2c_transfer(i2c, addr, (uint8_t *) src, len, false, nostop, 0);
+}
+
+int
+i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop)
+{
+    return i2c_transfer(i2c, addr, dst, len, true, nostop, 0);
+}
+
+int
+i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop,
+                     unsigned int timeout_us)
+{
+    return i2c_transfer(i2c, addr, (uint8_t *) src, len, false, nostop, timeout_us);
+}
+
+int
+i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop,
+                    unsigned int timeout_us)
+{
+    return i2c_transfer(i2c, addr, dst, len, true, nostop, timeout_us);
+}
@@ -0,0 +1,26 @@
+#ifndef _PICO_SHIM_HEADER_FILE_
+#define _PICO_SHIM_HEADER_FILE_
+
+/***********************************
+ * pico_shim.h
+ * set-up of the Pico SDK shim, for hostsim.c
+ * *********************************/
+
+#include <stdbool.h>
+#include "hardware/i2c.h"
+
+#define SHIM_SDA_PIN 14 // bus 0, must match I2C_SDA_PIN and I2C_SCL_PIN in main.c
+#define SHIM_SCL_PIN 15
+#define SHIM_TX_STALL_MS 100 // output is dropped if the pty reader stalls this long, like USB CDC
+
+// opens the pseudo-terminal used for stdio, and if link is not NULL a symlink to it.
+// returns the pty path, or NULL on failure
+const char *shim_stdio_open(const char *link);
+void shim_stdio_close(void); // removes the symlink
+// an external level on a pin (0 or 1), read while the pin is an input; -1 for none
+void shim_gpio_drive(unsigned int gpio, int level);
+// the simulated bus an I2C controller is connected to: the one with its SDA pin (GPIO 0, 4, 8 ...
+// for I2C0, 2, 6, 10 ... for I2C1) set to the I2C function. -1 if none
+int shim_i2c_bus(i2c_inst_t *i2c);
+
+#endif // _PICO_SHIM_HEADER_FILE_
@@ -0,0 +1,113 @@
+/****************************************
+ * pioi2c_host.c
+ * pioi2c.h for the host simulation build, in place of pioi2c.c: like i2cdma_host.c, the transfer is
+ * carried out on the simulated bus with the SDA pin when it starts, and reported busy until the
+ * timing model's duration has passed, or its deadline
+ * **************************************/
+
+#include "pioi2c.h"
+#include "simbus.h"
+#include <string.h>
+
+#define PIO_I2C_SMS 4
+#define SHIM_CLK_SYS_HZ 125000000 // as in pico_shim.c
+
+static uint8_t sms_claimed = 0;
+static int sm_result[PIO_I2C_SMS];
+static uint64_t sm_done_at[PIO_I2C_SMS];
+
+bool
+pio_i2c_init(pio_i2c_t *d, uint8_t sda, uint32_t baud)
+{
+    if (!d->claimed) {
+        if (sms_claimed >= PIO_I2C_SMS) {
+            return false;
+        }
+        d->sm = sms_claimed++;
+        d->tx_chan = 4 + 2 * d->sm;
+        d->rx_chan = 5 + 2 * d->sm;
+        d->claimed = true;
+    }
+    d->sda = sda;
+    d->len = 0;
+    d->restart_on_next = false;
+    pio_i2c_set_baudrate(d, baud);
+    return true;
+}
+
+void
+pio_i2c_deinit(pio_i2c_t *d)
+{
+    d->len = 0;
+}
+
+// the bus speed is shared, simbus_timing follows the I2C controllers
+uint32_t
+pio_i2c_set_baudrate(pio_i2c_t *d, uint32_t baud)
+{
+    uint64_t div = ((uint64_t) SHIM_CLK_SYS_HZ * 256 + 16 * baud) / (32 * (uint64_t) baud);
+    return (uint32_t) (((uint64_t) SHIM_CLK_SYS_HZ * 256) / (32 * div));
+}
+
+void
+pio_i2c_reset(pio_i2c_t *d)
+{
+    gpio_pull_up(d->sda);
+    gpio_pull_up(d->sda + 1);
+    gpio_set_function(d->sda, GPIO_FUNC_PIO1);
+    gpio_set_function(d->sda + 1, GPIO_FUNC_PIO1);
+    d->restart_on_next = false;
+    d->len = 0;
+}
+
+static int
+pio_i2c_start(pio_i2c_t *d, uint8_t addr, uint8_t *buf, size_t len, bool reading, bool nostop,
+              uint32_t timeout_us)
+{
+    uint64_t duration;
+    uint64_t now = time_us_64();
+    if ((len == 0) || (len > I2C_DMA_MAX_LEN) || !d->claimed) {
+        return PICO_ERROR_GENERIC;
+    }
+    d->len = len;
+    d->reading = reading;
+    d->restart_on_next = nostop;
+    d->deadline = make_timeout_time_us(timeout_us);
+    sm_result[d->sm] = simbus_transfer(simbus_find(d->sda), addr, reading, buf, len, nostop, &duration);
+    sm_done_at[d->sm] = (duration == SIMBUS_FOREVER) ? SIMBUS_FOREVER : now + duration;
+    return 0;
+}
+
+int
+pio_i2c_start_write(pio_i2c_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return pio_i2c_start(d, addr, (uint8_t *) src, len, false, nostop, timeout_us);
+}
+
+int
+pio_i2c_start_read(pio_i2c_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return pio_i2c_start(d, addr, dst, len, true, nostop, timeout_us);
+}
+
+int
+pio_i2c_poll(pio_i2c_t *d)
+{
+    uint64_t now = time_us_64();
+    if (d->len == 0) {
+        return PICO_ERROR_GENERIC;
+    }
+    if ((sm_done_at[d->sm] > d->deadline) && (now >= d->deadline)) {
+        d->restart_on_next = false;
+        d->len = 0;
+        return PICO_ERROR_TIMEOUT;
+    }
+    if (now < sm_done_at[d->sm]) {
+        return I2C_DMA_BUSY;
+    }
+    if (sm_result[d->sm] < 0) {
+        d->restart_on_next = false;
+    }
+    d->len = 0;
+    return sm_result[d->sm];
+}
@@ -0,0 +1,143 @@
+/****************************************
+ * simbus.c
+ * the simulated I2C buses
+ * **************************************/
+
+#include "simbus.h"
+#include "simdev.h"
+#include "pico/stdlib.h"
+#include <pthread.h>
+
+simbus_timing_t simbus_timing = {1.0, 100000};
+
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t bus_sda[SIMBUS_MAX];
+static uint8_t bus_scl[SIMBUS_MAX];
+static int bus_count = 0;
+static sim_dev_t *held[SIMBUS_MAX]; // device addressed by a transfer that ended without a stop
+
+int
+simbus_add(uint8_t sda, uint8_t scl)
+{
+    if ((bus_count >= SIMBUS_MAX) || (sda == scl) || (simbus_find(sda) >= 0) || (simbus_find(scl) >= 0)) {
+        return -1;
+    }
+    bus_sda[bus_count] = sda;
+    bus_scl[bus_count] = scl;
+    return bus_count++;
+}
+
+int
+simbus_find(unsigned int gpio)
+{
+    int b;
+    for (b = 0; b < bus_count; b++) {
+        if ((bus_sda[b] == gpio) || (bus_scl[b] == gpio)) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+int
+simbus_count(void)
+{
+    return bus_count;
+}
+
+uint8_t
+simbus_sda(int bus)
+{
+    return bus_sda[bus];
+}
+
+uint8_t
+simbus_scl(int bus)
+{
+    return bus_scl[bus];
+}
+
+// ends the previous transfer on the bus with a stop, unless it was followed by a repeated start
+static void
+bus_release(int bus, uint64_t now_us)
+{
+    if ((held[bus] != NULL) && (held[bus]->stop != NULL)) {
+        held[bus]->stop(held[bus], now_us);
+    }
+    held[bus] = NULL;
+}
+
+static uint64_t
+bus_duration_us(size_t bytes, const sim_dev_t *d)
+{
+    double us;
+    if ((d != NULL) && (d->stretch_us == SIM_STRETCH_FOREVER)) {
+        return SIMBUS_FOREVER;
+    }
+    us = (9.0 * bytes + 2.0) * 1e6 / simbus_timing.baud;
+    if (d != NULL) {
+        us += (double) d->stretch_us * bytes;
+    }
+    return (uint64_t) (us * simbus_timing.time_scale);
+}
+
+int
+simbus_transfer(int bus, uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop, uint64_t *duration_us)
+{
+    uint64_t now = time_us_64();
+    sim_dev_t *d;
+    size_t i;
+    int ret = (int) len;
+    if ((bus < 0) || (bus >= bus_count)) {
+        *duration_us = bus_duration_us(1, NULL);
+        return PICO_ERROR_GENERIC;
+    }
+    pthread_mutex_lock(&bus_lock);
+    d = simdev_find(bus, addr);
+    if ((held[bus] != NULL) && (held[bus] != d)) {
+        bus_release(bus, now); // a repeated start to another device ends the held transfer for the first
+    }
+    held[bus] = NULL;
+    if ((d == NULL) || !d->start(d, read, now)) {
+        *duration_us = bus_duration_us(1, NULL);
+        pthread_mutex_unlock(&bus_lock);
+        return PICO_ERROR_GENERIC;
+    }
+    for (i = 0; i < len; i++) {
+        if (read) {
+            buf[i] = d->read(d, now);
+        } else if (!d->write(d, buf[i])) {
+            ret = PICO_ERROR_GENERIC;
+            i++;
+            break;
+        }
+    }
+    *duration_us = bus_duration_us(i + 1, d);
+    held[bus] = d;
+    if (!nostop || (ret < 0)) {
+        bus_release(bus, (*duration_us == SIMBUS_FOREVER) ? now : now + *duration_us);
+    }
+    pthread_mutex_unlock(&bus_lock);
+    return ret;
+}
+
+bool
+simbus_probe(int bus, uint8_t addr)
+{
+    uint64_t now = time_us_64();
+    sim_dev_t *d;
+    bool ack;
+    if ((bus < 0) || (bus >= bus_count)) {
+        return false;
+    }
+    pthread_mutex_lock(&bus_lock);
+    bus_release(bus, now);
+    d = simdev_find(bus, addr);
+    ack = (d != NULL) && d->start(d, true, now);
+    if (ack) {
+        held[bus] = d;
+        bus_release(bus, now);
+    }
+    pthread_mutex_unlock(&bus_lock);
+    return ack;
+}
@@ -0,0 +1,42 @@
+#ifndef _SIMBUS_HEADER_FILE_
+#define _SIMBUS_HEADER_FILE_
+
+/***********************************
+ * simbus.h
+ * the simulated I2C buses: each is a pair of pins, and routes transfers to the virtual devices
+ * (simdev.h) on it, and works out how long each would take on a real bus
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SIMBUS_FOREVER UINT64_MAX // duration of a transfer that a device never lets finish
+#define SIMBUS_MAX 4
+
+// timing model: 9 clocks per byte (8 bits and the ACK) plus the address byte, one clock each for
+// the start and the stop, and each device's clock stretching per byte; scaled by time_scale
+// (1.0 for real time, 0 for transfers that complete at once)
+typedef struct {
+    double time_scale;
+    uint32_t baud;
+} simbus_timing_t;
+
+extern simbus_timing_t simbus_timing;
+
+// adds a bus on the given pins, returns its number, or -1 if there is no room or a pin is taken
+int simbus_add(uint8_t sda, uint8_t scl);
+int simbus_find(unsigned int gpio); // the bus with SDA or SCL on the pin, or -1
+int simbus_count(void);
+uint8_t simbus_sda(int bus);
+uint8_t simbus_scl(int bus);
+
+// performs a transfer on the bus: the address byte, then len data bytes written from or read into buf.
+// nostop leaves the bus held for a repeated start. Returns len, or PICO_ERROR_GENERIC if the address
+// or a data byte was not acknowledged, or bus is -1 (pins with no bus). *duration_us is how long the
+// transfer takes on the bus
+int simbus_transfer(int bus, uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop, uint64_t *duration_us);
+// the address byte alone then a stop, as a bit-banged probe does. Returns true if acknowledged
+bool simbus_probe(int bus, uint8_t addr);
+
+#endif // _SIMBUS_HEADER_FILE_
@@ -0,0 +1,224 @@
+/****************************************
+ * simdev.c
+ * virtual I2C devices for the host simulation build:
+ * - EEPROM: 1 or 2 address bytes, sequential reads, page writes that wrap within the page,
+ *   and a write cycle during which the device does not acknowledge its address (for ACK polling)
+ * - sensor: 256 registers with an auto-incrementing pointer. Registers 0x00-0x01 hold a 16-bit
+ *   reading (big-endian) that changes over time, taken when a read starts; register 0x0F is an ID
+ * - stuck: acknowledges its address, then holds SCL low, to exercise timeouts and bus recovery
+ * **************************************/
+
+#include "simdev.h"
+#include <stdlib.h>
+#include <string.h>
+
+static sim_dev_t devices[SIM_MAX_DEVICES];
+static int num_devices = 0;
+
+sim_dev_t *
+simdev_find(uint8_t bus, uint8_t addr)
+{
+    int i;
+    for (i = 0; i < num_devices; i++) {
+        if ((devices[i].bus == bus) && (devices[i].addr == addr)) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+int
+simdev_count(void)
+{
+    return num_devices;
+}
+
+sim_dev_t *
+simdev_get(int i)
+{
+    return ((i >= 0) && (i < num_devices)) ? &devices[i] : NULL;
+}
+
+static sim_dev_t *
+simdev_alloc(uint8_t bus, uint8_t addr, const char *kind, uint32_t size)
+{
+    sim_dev_t *d;
+    if ((addr > 0x7F) || (num_devices >= SIM_MAX_DEVICES) || (simdev_find(bus, addr) != NULL)) {
+        return NULL;
+    }
+    d = &devices[num_devices];
+    memset(d, 0, sizeof(*d));
+    if (size > 0) {
+        d->mem = calloc(size, 1);
+        if (d->mem == NULL) {
+            return NULL;
+        }
+    }
+    d->bus = bus;
+    d->addr = addr;
+    d->kind = kind;
+    d->size = size;
+    d->addr_bytes = 1;
+    num_devices++;
+    return d;
+}
+
+// the address pointer moves on after each byte, within the page for an EEPROM write
+static void
+mem_advance(sim_dev_t *d, bool writing)
+{
+    if (writing && (d->page > 0)) {
+        d->ptr = d->page_base + ((d->ptr - d->page_base + 1) % d->page);
+    } else {
+        d->ptr = (d->ptr + 1) % d->size;
+    }
+}
+
+static bool
+mem_start(sim_dev_t *d, bool read, uint64_t now_us)
+{
+    if (now_us < d->busy_until) {
+        return false;
+    }
+    if (!read) {
+        d->addr_rx = 0;
+    }
+    return true;
+}
+
+// the first addr_bytes bytes of a write set the address pointer (MSB first), the rest are data
+static bool
+mem_write(sim_dev_t *d, uint8_t val)
+{
+    if (d->addr_rx < d->addr_bytes) {
+        d->ptr = (d->addr_rx == 0) ? val : ((d->ptr << 8) | val);
+        d->addr_rx++;
+        if (d->addr_rx == d->addr_bytes) {
+            d->ptr %= d->size;
+            d->page_base = (d->page > 0) ? (d->ptr - (d->ptr % d->page)) : 0;
+        }
+        return true;
+    }
+    d->mem[d->ptr] = val;
+    d->written = true;
+    mem_advance(d, true);
+    return true;
+}
+
+static uint8_t
+mem_read(sim_dev_t *d, uint64_t now_us)
+{
+    uint8_t val = d->mem[d->ptr];
+    (void) now_us;
+    mem_advance(d, false);
+    return val;
+}
+
+static void
+mem_stop(sim_dev_t *d, uint64_t now_us)
+{
+    if (d->written) {
+        d->busy_until = now_us + d->write_cycle_us;
+        d->written = false;
+    }
+}
+
+sim_dev_t *
+simdev_add_eeprom(uint8_t bus, uint8_t addr, uint32_t size, uint8_t addr_bytes, uint16_t page, uint32_t write_cycle_us)
+{
+    sim_dev_t *d;
+    if ((size == 0) || (addr_bytes < 1) || (addr_bytes > 2) || (size > (1UL << (8 * addr_bytes))) ||
+        (page > size)) {
+        return NULL;
+    }
+    d = simdev_alloc(bus, addr, "eeprom", size);
+    if (d == NULL) {
+        return NULL;
+    }
+    memset(d->mem, 0xFF, size); // erased
+    d->start = mem_start;
+    d->write = mem_write;
+    d->read = mem_read;
+    d->stop = mem_stop;
+    d->addr_bytes = addr_bytes;
+    d->page = page;
+    d->write_cycle_us = write_cycle_us;
+    return d;
+}
+
+static bool
+sensor_start(sim_dev_t *d, bool read, uint64_t now_us)
+{
+    uint16_t reading;
+    if (read) {
+        // a slow ramp, with the low bits changing every millisecond
+        reading = (uint16_t) (now_us / 1000);
+        d->mem[0] = (uint8_t) (reading >> 8);
+        d->mem[1] = (uint8_t) reading;
+    }
+    return mem_start(d, read, now_us);
+}
+
+static bool
+sensor_write(sim_dev_t *d, uint8_t val)
+{
+    if ((d->addr_rx == d->addr_bytes) && (d->ptr == SIM_SENSOR_ID_REG)) {
+        mem_advance(d, false); // read-only
+        return true;
+    }
+    return mem_write(d, val);
+}
+
+sim_dev_t *
+simdev_add_sensor(uint8_t bus, uint8_t addr)
+{
+    sim_dev_t *d = simdev_alloc(bus, addr, "sensor", 256);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->mem[SIM_SENSOR_ID_REG] = SIM_SENSOR_ID;
+    d->start = sensor_start;
+    d->write = sensor_write;
+    d->read = mem_read;
+    d->stop = NULL; // registers take effect at once
+    return d;
+}
+
+static bool
+stuck_start(sim_dev_t *d, bool read, uint64_t now_us)
+{
+    (void) d;
+    (void) read;
+    (void) now_us;
+    return true;
+}
+
+static bool
+stuck_write(sim_dev_t *d, uint8_t val)
+{
+    (void) d;
+    (void) val;
+    return true;
+}
+
+static uint8_t
+stuck_read(sim_dev_t *d, uint64_t now_us)
+{
+    (void) d;
+    (void) now_us;
+    return 0xFF;
+}
+
+sim_dev_t *
+simdev_add_stuck(uint8_t bus, uint8_t addr)
+{
+    sim_dev_t *d = simdev_alloc(bus, addr, "stuck", 0);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->start = stuck_start;
+    d->write = stuck_write;
+    d->read = stuck_read;
+    d->stretch_us = SIM_STRETCH_FOREVER;
+    return d;
+}
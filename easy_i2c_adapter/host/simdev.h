@@ -0,0 +1,52 @@
+#ifndef _SIMDEV_HEADER_FILE_
+#define _SIMDEV_HEADER_FILE_
+
+/***********************************
+ * simdev.h
+ * virtual I2C devices for the host simulation build
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SIM_MAX_DEVICES 16
+#define SIM_STRETCH_FOREVER UINT32_MAX // stretch_us of a device that holds SCL low once addressed
+#define SIM_SENSOR_ID 0x5A // read-only WHO_AM_I value of the sensor, at register SIM_SENSOR_ID_REG
+#define SIM_SENSOR_ID_REG 0x0F
+
+// a device on the simulated bus. The bus calls start() when the device is addressed (after a start
+// or repeated start), then write() or read() for each data byte, and stop() at the stop condition
+typedef struct sim_dev sim_dev_t;
+struct sim_dev {
+    uint8_t bus; // simbus.h bus number
+    uint8_t addr;
+    const char *kind;
+    bool (*start)(sim_dev_t *d, bool read, uint64_t now_us); // false to NACK the address
+    bool (*write)(sim_dev_t *d, uint8_t val); // false to NACK the byte
+    uint8_t (*read)(sim_dev_t *d, uint64_t now_us);
+    void (*stop)(sim_dev_t *d, uint64_t now_us);
+    uint32_t stretch_us; // clock stretching per byte
+    // memory (EEPROM cells or sensor registers) and its address pointer
+    uint8_t *mem;
+    uint32_t size;
+    uint32_t ptr;
+    uint8_t addr_bytes; // register address size
+    uint8_t addr_rx; // address bytes received so far in the current write
+    uint16_t page; // EEPROM page size, 0 if not paged; a write wraps around within its page
+    uint32_t page_base;
+    uint32_t write_cycle_us; // EEPROM internal write time, the device ignores its address meanwhile
+    uint64_t busy_until;
+    bool written; // data bytes written since the start, programmed at the stop
+};
+
+// each returns NULL if the address is invalid or already taken on the bus, or there is no room
+sim_dev_t *simdev_add_eeprom(uint8_t bus, uint8_t addr, uint32_t size, uint8_t addr_bytes, uint16_t page,
+                             uint32_t write_cycle_us);
+sim_dev_t *simdev_add_sensor(uint8_t bus, uint8_t addr);
+sim_dev_t *simdev_add_stuck(uint8_t bus, uint8_t addr);
+sim_dev_t *simdev_find(uint8_t bus, uint8_t addr); // NULL if no device on the bus has the address
+int simdev_count(void);
+sim_dev_t *simdev_get(int i);
+
+#endif // _SIMDEV_HEADER_FILE_
@@ -0,0 +1,400 @@
+/****************************************
+ * txnqueue_test.c
+ * unit tests for the transaction queue and engine (txnqueue.c), run on the host by ctest.
+ * The engine drives stub buses, whose transfers take a set number of checks to finish,
+ * against a clock that the checks advance
+ * **************************************/
+
+#include "txnqueue.h"
+#include <stdio.h>
+#include <string.h>
+
+#define STUB_BUSES 2
+#define STUB_LOG_MAX 256
+#define STUB_CHECK_US 100 // the clock advances this much for each check of a transfer
+#define ERROR_TIMEOUT -1 // PICO_ERROR_TIMEOUT
+#define ERROR_GENERIC -2 // PICO_ERROR_GENERIC, also a NAK
+
+typedef struct {
+    uint8_t bus;
+    uint8_t addr;
+    uint8_t len;
+    bool read;
+    bool nostop;
+} stub_start_t;
+
+typedef struct {
+    uint8_t index;
+    int checks; // checks a transfer takes before it finishes
+    int start_result; // returned by start, 0 for a transfer that starts
+    int poll_naks; // 1-byte reads NAKed before one is acknowledged, -1 for all of them
+    int remaining; // checks left for the transfer in progress
+    int result;
+    bool active;
+} stub_bus_t;
+
+static uint32_t now_us = 0;
+static stub_start_t start_log[STUB_LOG_MAX];
+static int start_count = 0;
+static stub_bus_t stubs[STUB_BUSES];
+static txn_bus_t buses[STUB_BUSES];
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+uint32_t
+txn_time_us(void)
+{
+    return now_us;
+}
+
+static int
+stub_start(void *ctx, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop)
+{
+    stub_bus_t *s = ctx;
+    size_t i;
+    if (start_count < STUB_LOG_MAX) {
+        start_log[start_count].bus = s->index;
+        start_log[start_count].addr = addr;
+        start_log[start_count].len = (uint8_t) len;
+        start_log[start_count].read = read;
+        start_log[start_count].nostop = nostop;
+    }
+    start_count++;
+    if (s->start_result != 0) {
+        return s->start_result;
+    }
+    s->active = true;
+    s->remaining = s->checks;
+    s->result = (int) len;
+    if (read && (len == 1) && (s->poll_naks != 0)) {
+        s->result = ERROR_GENERIC;
+        if (s->poll_naks > 0) {
+            s->poll_naks--;
+        }
+    } else if (read) {
+        for (i = 0; i < len; i++) {
+            buf[i] = (uint8_t) (addr + i); // data the tests can recognise
+        }
+    }
+    return 0;
+}
+
+static int
+stub_check(void *ctx)
+{
+    stub_bus_t *s = ctx;
+    if (!s->active) {
+        return ERROR_GENERIC;
+    }
+    now_us += STUB_CHECK_US;
+    if (s->remaining > 0) {
+        s->remaining--;
+        return TXN_BUSY;
+    }
+    s->active = false;
+    return s->result;
+}
+
+// fresh queue, engine and stub buses, whose transfers each take checks checks
+static void
+setup(txn_queue_t *q, txn_engine_t *e, int checks)
+{
+    uint8_t b;
+    now_us = 0;
+    start_count = 0;
+    memset(stubs, 0, sizeof(stubs));
+    for (b = 0; b < STUB_BUSES; b++) {
+        stubs[b].index = b;
+        stubs[b].checks = checks;
+        buses[b].start = stub_start;
+        buses[b].check = stub_check;
+        buses[b].ctx = &stubs[b];
+    }
+    txn_queue_init(q);
+    txn_engine_init(e, buses, STUB_BUSES);
+}
+
+// queues a transaction, returns its slot
+static txn_t *
+submit(txn_queue_t *q, uint8_t op, uint8_t bus, uint8_t addr, uint16_t len)
+{
+    txn_t *t = txn_alloc(q);
+    if (t == NULL) {
+        return NULL;
+    }
+    memset(t, 0, sizeof(*t));
+    t->op = op;
+    t->bus = bus;
+    t->addr = addr;
+    t->len = len;
+    t->reg_len = 1;
+    txn_submit(q);
+    return t;
+}
+
+// runs the engine until it has nothing left to do, returns the number of steps taken
+static int
+run_engine(txn_engine_t *e, txn_queue_t *q)
+{
+    int steps = 0;
+    while (txn_engine_step(e, q) && (steps < 100000)) {
+        steps++;
+    }
+    return steps;
+}
+
+static void
+test_empty_and_full(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    int i;
+    setup(&q, &e, 0);
+    CHECK(txn_pending(&q) == 0);
+    CHECK(txn_completed(&q) == NULL);
+    CHECK(txn_engine_step(&e, &q) == 0);
+    for (i = 0; i < TXN_QUEUE_DEPTH; i++) {
+        CHECK(submit(&q, TXN_OP_WRITE, 0, 0x10 + i, 1) == &q.slots[i]);
+    }
+    CHECK(txn_pending(&q) == TXN_QUEUE_DEPTH);
+    CHECK(txn_alloc(&q) == NULL);
+    // the queue stays full until the producer releases a slot, even once they are all done
+    run_engine(&e, &q);
+    CHECK(txn_alloc(&q) == NULL);
+    CHECK(txn_completed(&q) == &q.slots[0]);
+    txn_release(&q);
+    CHECK(txn_alloc(&q) == &q.slots[0]);
+    CHECK(txn_pending(&q) == TXN_QUEUE_DEPTH - 1);
+    for (i = 1; i < TXN_QUEUE_DEPTH; i++) {
+        CHECK(txn_completed(&q) == &q.slots[i]);
+        txn_release(&q);
+    }
+    CHECK(txn_pending(&q) == 0);
+    CHECK(txn_completed(&q) == NULL);
+}
+
+static void
+test_fifo_order(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *t;
+    int i;
+    setup(&q, &e, 3);
+    for (i = 0; i < 5; i++) {
+        submit(&q, (i & 1) ? TXN_OP_READ : TXN_OP_WRITE, 0, 0x20 + i, 2);
+    }
+    run_engine(&e, &q);
+    CHECK(start_count == 5);
+    for (i = 0; i < 5; i++) {
+        CHECK(start_log[i].addr == 0x20 + i);
+        CHECK(start_log[i].read == (i & 1));
+        t = txn_completed(&q);
+        CHECK((t != NULL) && (t->addr == 0x20 + i) && (t->result == 2));
+        if ((t != NULL) && (i & 1)) {
+            CHECK((t->data[0] == 0x20 + i) && (t->data[1] == 0x21 + i));
+        }
+        txn_release(&q);
+    }
+    CHECK(txn_completed(&q) == NULL);
+}
+
+// more transactions than slots, submitted and released as the queue allows: each slot is reused
+// several times, and exec_tail and the executed bits follow the indices round the ring
+static void
+test_wraparound(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *t;
+    int submitted = 0;
+    int released = 0;
+    int total = TXN_QUEUE_DEPTH * 4 + 3;
+    int steps = 0;
+    setup(&q, &e, 1);
+    while ((released < total) && (steps++ < 100000)) {
+        while ((submitted < total) && (txn_alloc(&q) != NULL)) {
+            t = submit(&q, TXN_OP_READ, submitted & 1, (uint8_t) submitted, 1);
+            CHECK(t == &q.slots[submitted & (TXN_QUEUE_DEPTH - 1)]);
+            submitted++;
+        }
+        txn_engine_step(&e, &q);
+        while ((t = txn_completed(&q)) != NULL) {
+            CHECK(t->addr == (uint8_t) released);
+            CHECK((t->result == 1) && (t->data[0] == (uint8_t) released));
+            txn_release(&q);
+            released++;
+        }
+    }
+    CHECK(start_count == total);
+    CHECK(e.exec_tail == (uint32_t) total);
+    CHECK(e.executed == 0);
+    CHECK(txn_pending(&q) == 0);
+}
+
+// a slow transfer on bus 0 and quick ones on bus 1 run at the same time. The quick ones finish
+// first, but are only handed back after the slow one, in submission order
+static void
+test_bus_overlap(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *slow, *next, *quick1, *quick2;
+    int steps;
+    setup(&q, &e, 1);
+    stubs[0].checks = 20;
+    slow = submit(&q, TXN_OP_READ, 0, 0x50, 4);
+    next = submit(&q, TXN_OP_READ, 0, 0x51, 4);
+    quick1 = submit(&q, TXN_OP_WRITE, 1, 0x60, 1);
+    quick2 = submit(&q, TXN_OP_WRITE, 1, 0x61, 1);
+    txn_engine_step(&e, &q);
+    // both buses start their oldest transaction at once, the second one on bus 0 waits
+    CHECK(start_count == 2);
+    CHECK((start_log[0].addr == 0x50) && (start_log[1].addr == 0x60));
+    CHECK((e.run[0].t == slow) && (e.run[1].t == quick1));
+    for (steps = 0; (steps < 10) && !quick2->done; steps++) {
+        txn_engine_step(&e, &q);
+    }
+    CHECK(quick1->done && quick2->done);
+    CHECK(!slow->done && !next->done);
+    CHECK(e.run[0].t == slow);
+    // done out of order: the executed bits hold them until the slot before them is done
+    CHECK(e.executed == ((1u << 2) | (1u << 3)));
+    CHECK(e.exec_tail == 0);
+    CHECK(txn_completed(&q) == NULL);
+    run_engine(&e, &q);
+    CHECK(slow->done && next->done);
+    CHECK(start_count == 4);
+    CHECK(start_log[3].addr == 0x51);
+    CHECK(e.exec_tail == 4);
+    CHECK(e.executed == 0);
+    CHECK(txn_completed(&q) == slow);
+    txn_release(&q);
+    CHECK(txn_completed(&q) == next);
+    txn_release(&q);
+    CHECK(txn_completed(&q) == quick1);
+    txn_release(&q);
+    CHECK(txn_completed(&q) == quick2);
+    txn_release(&q);
+    // the same transfers all on one bus take as long as the slow ones and the quick ones together
+    setup(&q, &e, 1);
+    stubs[0].checks = 20;
+    submit(&q, TXN_OP_READ, 0, 0x50, 4);
+    submit(&q, TXN_OP_WRITE, 1, 0x60, 1);
+    steps = run_engine(&e, &q);
+    setup(&q, &e, 1);
+    stubs[0].checks = 20;
+    submit(&q, TXN_OP_READ, 0, 0x50, 4);
+    submit(&q, TXN_OP_WRITE, 0, 0x60, 1);
+    CHECK(run_engine(&e, &q) > steps);
+}
+
+static void
+test_readmem_and_nop(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *t, *nop;
+    setup(&q, &e, 2);
+    t = submit(&q, TXN_OP_READMEM, 0, 0x54, 3);
+    t->reg = 0x1234;
+    t->reg_len = 2;
+    nop = submit(&q, TXN_OP_NOP, 0, 0, 0);
+    run_engine(&e, &q);
+    // the register address is written without a stop, then read with a repeated start
+    CHECK(start_count == 2);
+    CHECK(!start_log[0].read && start_log[0].nostop && (start_log[0].len == 2));
+    CHECK(start_log[1].read && !start_log[1].nostop && (start_log[1].len == 3));
+    CHECK((t->result == 3) && (t->data[0] == 0x54));
+    // the NOP has no transfer, but is only done in its turn on the bus
+    CHECK(nop->done && (nop->result == 0));
+}
+
+static void
+test_errors(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *bad_bus, *bad_start, *after;
+    setup(&q, &e, 1);
+    stubs[1].start_result = ERROR_GENERIC;
+    bad_bus = submit(&q, TXN_OP_WRITE, TXN_BUS_MAX, 0x10, 1);
+    bad_start = submit(&q, TXN_OP_WRITE, 1, 0x11, 1);
+    after = submit(&q, TXN_OP_WRITE, 1, 0x12, 1);
+    run_engine(&e, &q);
+    CHECK(bad_bus->done && (bad_bus->result == ERROR_GENERIC));
+    CHECK(bad_start->done && (bad_start->result == ERROR_GENERIC));
+    // a transfer that fails to start leaves the bus free for the next one
+    CHECK(after->done && (after->result == ERROR_GENERIC));
+    CHECK(start_count == 2);
+    CHECK(e.run[1].t == NULL);
+}
+
+// a write with poll set ends once the device acknowledges its address again, with the result of
+// the write, or fails once TXN_POLL_TIMEOUT_US has passed without an acknowledge
+static void
+test_ack_poll(void)
+{
+    txn_queue_t q;
+    txn_engine_t e;
+    txn_t *t;
+    int polls;
+    setup(&q, &e, 1);
+    stubs[0].poll_naks = 3;
+    t = submit(&q, TXN_OP_WRITEMEM, 0, 0x50, 9);
+    t->poll = 1;
+    run_engine(&e, &q);
+    CHECK(t->done && (t->result == 9));
+    CHECK(start_count == 5); // the write, 3 NAKed polls and the acknowledged one
+    CHECK(start_log[1].read && (start_log[1].len == 1) && !start_log[1].nostop);
+
+    setup(&q, &e, 1);
+    stubs[0].poll_naks = -1;
+    t = submit(&q, TXN_OP_WRITEMEM, 0, 0x50, 9);
+    t->poll = 1;
+    run_engine(&e, &q);
+    polls = start_count - 1;
+    CHECK(t->done && (t->result == ERROR_GENERIC));
+    // every poll takes 2 checks, and the first NAK once the timeout has passed ends the polling
+    CHECK(polls == TXN_POLL_TIMEOUT_US / (2 * STUB_CHECK_US));
+    CHECK(now_us >= TXN_POLL_TIMEOUT_US);
+
+    // a bus timeout while polling is not retried
+    setup(&q, &e, 1);
+    stubs[0].poll_naks = -1;
+    t = submit(&q, TXN_OP_WRITE, 0, 0x50, 2);
+    t->poll = 1;
+    txn_engine_step(&e, &q);
+    txn_engine_step(&e, &q);
+    txn_engine_step(&e, &q); // the write has finished, the first poll is in progress
+    CHECK(e.run[0].phase == 2); // TXN_PHASE_POLL
+    stubs[0].result = ERROR_TIMEOUT;
+    run_engine(&e, &q);
+    CHECK(t->done && (t->result == ERROR_TIMEOUT));
+    CHECK(start_count == 2);
+}
+
+int
+main(void)
+{
+    test_empty_and_full();
+    test_fifo_order();
+    test_wraparound();
+    test_bus_overlap();
+    test_readmem_and_nop();
+    test_errors();
+    test_ack_poll();
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all txnqueue tests passed\n");
+    return 0;
+}
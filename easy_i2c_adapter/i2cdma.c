@@ -0,0 +1,140 @@
+/****************************************
+ * i2cdma.c
+ * non-blocking I2C transfers, with the FIFOs fed by DMA
+ * unlike i2c_write_blocking/i2c_read_blocking, the CPU does not handle each byte,
+ * and every transfer has a deadline, so a device holding the bus cannot hang the adapter
+ * **************************************/
+
+#include "i2cdma.h"
+#include "hardware/dma.h"
+
+void
+i2c_dma_init(i2c_dma_t *d, i2c_inst_t *i2c)
+{
+    d->i2c = i2c;
+    d->tx_chan = dma_claim_unused_channel(true);
+    d->rx_chan = dma_claim_unused_channel(true);
+    d->len = 0;
+}
+
+// builds the IC_DATA_CMD words, sets the target address and starts the TX DMA channel
+// (and the RX channel first, for a read)
+static int
+i2c_dma_start(i2c_dma_t *d, uint8_t addr, const uint8_t *src, uint8_t *dst, size_t len, bool nostop,
+              uint32_t timeout_us)
+{
+    i2c_hw_t *hw = i2c_get_hw(d->i2c);
+    dma_channel_config c;
+    size_t i;
+    if ((len == 0) || (len > I2C_DMA_MAX_LEN)) {
+        return PICO_ERROR_GENERIC;
+    }
+    for (i = 0; i < len; i++) {
+        d->cmd[i] = (dst != NULL) ? I2C_IC_DATA_CMD_CMD_BITS : src[i];
+    }
+    if (d->i2c->restart_on_next) {
+        d->cmd[0] |= I2C_IC_DATA_CMD_RESTART_BITS;
+    }
+    if (!nostop) {
+        d->cmd[len - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+    }
+    d->len = len;
+    d->reading = (dst != NULL);
+    d->nostop = nostop;
+    d->deadline = make_timeout_time_us(timeout_us);
+
+    hw->enable = 0;
+    hw->tar = addr;
+    hw->enable = 1;
+    (void) hw->clr_tx_abrt;
+    (void) hw->clr_stop_det;
+
+    if (d->reading) {
+        c = dma_channel_get_default_config(d->rx_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, i2c_get_dreq(d->i2c, false));
+        dma_channel_configure(d->rx_chan, &c, dst, &hw->data_cmd, len, true);
+    }
+    c = dma_channel_get_default_config(d->tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_get_dreq(d->i2c, true));
+    dma_channel_configure(d->tx_chan, &c, &hw->data_cmd, d->cmd, len, true);
+    return 0;
+}
+
+int
+i2c_dma_start_write(i2c_dma_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return i2c_dma_start(d, addr, src, NULL, len, nostop, timeout_us);
+}
+
+int
+i2c_dma_start_read(i2c_dma_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return i2c_dma_start(d, addr, NULL, dst, len, nostop, timeout_us);
+}
+
+static void
+i2c_dma_stop_channels(i2c_dma_t *d)
+{
+    dma_channel_abort(d->tx_chan);
+    if (d->reading) {
+        dma_channel_abort(d->rx_chan);
+    }
+}
+
+int
+i2c_dma_poll(i2c_dma_t *d)
+{
+    i2c_hw_t *hw = i2c_get_hw(d->i2c);
+    uint32_t stat = hw->raw_intr_stat;
+    if (stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        // no ACK (or arbitration lost). The controller flushes its TX FIFO and sends a STOP,
+        // the DMA must be stopped before the abort is cleared so that nothing more is queued
+        i2c_dma_stop_channels(d);
+        while (!(hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) && !time_reached(d->deadline)) {
+            tight_loop_contents();
+        }
+        (void) hw->clr_stop_det;
+        (void) hw->clr_tx_abrt;
+        d->i2c->restart_on_next = false;
+        return PICO_ERROR_GENERIC;
+    }
+    if (time_reached(d->deadline)) {
+        i2c_dma_stop_channels(d);
+        d->i2c->restart_on_next = false;
+        return PICO_ERROR_TIMEOUT;
+    }
+    if (d->reading) {
+        if (dma_channel_is_busy(d->rx_chan)) {
+            return I2C_DMA_BUSY;
+        }
+    } else {
+        // TX_EMPTY (with TX_EMPTY_CTRL set by i2c_init) means the last byte has left the shifter
+        if (dma_channel_is_busy(d->tx_chan) || !(stat & I2C_IC_RAW_INTR_STAT_TX_EMPTY_BITS)) {
+            return I2C_DMA_BUSY;
+        }
+    }
+    if (!d->nostop) {
+        if (!(stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS)) {
+            return I2C_DMA_BUSY;
+        }
+        (void) hw->clr_stop_det;
+    }
+    d->i2c->restart_on_next = d->nostop;
+    return (int) d->len;
+}
+
+int
+i2c_dma_wait(i2c_dma_t *d)
+{
+    int res;
+    while ((res = i2c_dma_poll(d)) == I2C_DMA_BUSY) {
+        tight_loop_contents();
+    }
+    return res;
+}
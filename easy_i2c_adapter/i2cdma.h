@@ -0,0 +1,40 @@
+#ifndef _I2CDMA_HEADER_FILE_
+#define _I2CDMA_HEADER_FILE_
+
+/***********************************
+ * i2cdma.h
+ * non-blocking I2C transfers, with the FIFOs fed by DMA
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+
+#define I2C_DMA_MAX_LEN 260 // longest transfer, matches TXN_DATA_MAX
+#define I2C_DMA_BUSY 0x7fffffff // i2c_dma_poll result while the transfer is in progress
+
+typedef struct {
+    i2c_inst_t *i2c;
+    int tx_chan;
+    int rx_chan;
+    uint16_t cmd[I2C_DMA_MAX_LEN]; // IC_DATA_CMD words: data or read command, plus RESTART/STOP flags
+    size_t len;
+    bool reading;
+    bool nostop;
+    absolute_time_t deadline;
+} i2c_dma_t;
+
+void i2c_dma_init(i2c_dma_t *d, i2c_inst_t *i2c); // claims the two DMA channels
+// start a transfer, with the same arguments as i2c_write_blocking/i2c_read_blocking plus a deadline.
+// return 0 if started, PICO_ERROR_GENERIC if the length is invalid
+int i2c_dma_start_write(i2c_dma_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us);
+int i2c_dma_start_read(i2c_dma_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us);
+// returns I2C_DMA_BUSY, or the outcome: the number of bytes transferred, PICO_ERROR_GENERIC if the
+// device did not acknowledge, or PICO_ERROR_TIMEOUT if the deadline passed (the caller should then
+// recover the bus and re-initialise the I2C peripheral)
+int i2c_dma_poll(i2c_dma_t *d);
+int i2c_dma_wait(i2c_dma_t *d); // polls until the transfer is finished
+
+#endif // _I2CDMA_HEADER_FILE_
@@ -0,0 +1,156 @@
+/****************************************
+ * m2mframe.c
+ * framed binary M2M protocol
+ * **************************************/
+
+#include "m2mframe.h"
+#include "txbuf.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+
+#define RX_STATE_SOF 0
+#define RX_STATE_TYPE 1
+#define RX_STATE_SEQ 2
+#define RX_STATE_LEN_LO 3
+#define RX_STATE_LEN_HI 4
+#define RX_STATE_PAYLOAD 5
+#define RX_STATE_CRC_LO 6
+#define RX_STATE_CRC_HI 7
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), one byte at a time
+uint16_t
+crc16_update(uint16_t crc, uint8_t c)
+{
+    uint8_t i;
+    crc ^= ((uint16_t) c) << 8;
+    for (i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+void
+frame_rx_reset(frame_rx_t *rx)
+{
+    rx->state = RX_STATE_SOF;
+    rx->len = 0;
+    rx->index = 0;
+}
+
+int
+frame_rx_idle(frame_rx_t *rx)
+{
+    return (rx->state == RX_STATE_SOF);
+}
+
+// returns FRAME_RX_OK when a complete frame is available in rx,
+// FRAME_RX_BAD_CRC if a frame was received but failed the check, FRAME_RX_NONE otherwise
+int
+frame_rx_byte(frame_rx_t *rx, uint8_t c)
+{
+    switch (rx->state) {
+        case RX_STATE_SOF:
+            if (c == FRAME_SOF) {
+                rx->crc = 0xFFFF;
+                rx->state = RX_STATE_TYPE;
+            }
+            break;
+        case RX_STATE_TYPE:
+            rx->type = c;
+            rx->crc = crc16_update(rx->crc, c);
+            rx->state = RX_STATE_SEQ;
+            break;
+        case RX_STATE_SEQ:
+            rx->seq = c;
+            rx->crc = crc16_update(rx->crc, c);
+            rx->state = RX_STATE_LEN_LO;
+            break;
+        case RX_STATE_LEN_LO:
+            rx->len = c;
+            rx->crc = crc16_update(rx->crc, c);
+            rx->state = RX_STATE_LEN_HI;
+            break;
+        case RX_STATE_LEN_HI:
+            rx->len |= ((uint16_t) c) << 8;
+            rx->crc = crc16_update(rx->crc, c);
+            rx->index = 0;
+            if (rx->len > FRAME_MAX_PAYLOAD) {
+                // cannot be a valid frame, hunt for the next start byte
+                frame_rx_reset(rx);
+                return FRAME_RX_BAD_CRC;
+            }
+            rx->state = (rx->len == 0) ? RX_STATE_CRC_LO : RX_STATE_PAYLOAD;
+            break;
+        case RX_STATE_PAYLOAD:
+            rx->payload[rx->index++] = c;
+            rx->crc = crc16_update(rx->crc, c);
+            if (rx->index >= rx->len) {
+                rx->state = RX_STATE_CRC_LO;
+            }
+            break;
+        case RX_STATE_CRC_LO:
+            rx->crc ^= c;
+            rx->state = RX_STATE_CRC_HI;
+            break;
+        case RX_STATE_CRC_HI:
+            rx->crc ^= ((uint16_t) c) << 8;
+            rx->state = RX_STATE_SOF;
+            if (rx->crc != 0) {
+                return FRAME_RX_BAD_CRC;
+            }
+            return FRAME_RX_OK;
+        default:
+            frame_rx_reset(rx);
+            break;
+    }
+    return FRAME_RX_NONE;
+}
+
+// sends a frame whose payload is the byte b0 followed by len bytes of payload
+// the frame is assembled in the TX buffer and sent in one write, with no CR/LF translation
+void
+frame_send2(uint8_t type, uint8_t seq, uint8_t b0, const uint8_t *payload, uint16_t len)
+{
+    uint16_t i;
+    uint16_t crc = 0xFFFF;
+    uint16_t total = len + 1;
+    uint8_t hdr[4] = {type, seq, (uint8_t) (total & 0xff), (uint8_t) (total >> 8)};
+    tx_putc(FRAME_SOF);
+    for (i = 0; i < 4; i++) {
+        crc = crc16_update(crc, hdr[i]);
+    }
+    tx_write(hdr, 4);
+    crc = crc16_update(crc, b0);
+    tx_putc(b0);
+    for (i = 0; i < len; i++) {
+        crc = crc16_update(crc, payload[i]);
+    }
+    tx_write(payload, len);
+    tx_putc(crc & 0xff);
+    tx_putc(crc >> 8);
+    tx_flush();
+}
+
+void
+frame_send(uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len)
+{
+    uint16_t i;
+    uint16_t crc = 0xFFFF;
+    uint8_t hdr[4] = {type, seq, (uint8_t) (len & 0xff), (uint8_t) (len >> 8)};
+    tx_putc(FRAME_SOF);
+    for (i = 0; i < 4; i++) {
+        crc = crc16_update(crc, hdr[i]);
+    }
+    tx_write(hdr, 4);
+    for (i = 0; i < len; i++) {
+        crc = crc16_update(crc, payload[i]);
+    }
+    tx_write(payload, len);
+    tx_putc(crc & 0xff);
+    tx_putc(crc >> 8);
+    tx_flush();
+}
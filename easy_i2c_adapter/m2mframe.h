@@ -0,0 +1,102 @@
+#ifndef _M2MFRAME_HEADER_FILE_
+#define _M2MFRAME_HEADER_FILE_
+
+/***********************************
+ * m2mframe.h
+ * framed binary M2M protocol
+ * *********************************/
+
+#include <stdint.h>
+
+// frame layout (all multi-byte fields little-endian):
+// SOF(1) TYPE(1) SEQ(1) LEN(2) PAYLOAD(LEN) CRC(2)
+// the CRC is CRC-16/CCITT-FALSE over TYPE, SEQ, LEN and PAYLOAD
+#define FRAME_SOF 0xA5
+#define FRAME_HDR_LEN 5
+#define FRAME_CRC_LEN 2
+#define FRAME_MAX_PAYLOAD 256
+#define FRAME_DATA_CHUNK 128 // bulk data bytes carried per DATA frame
+#define FRAME_WINDOW 4 // DATA frames that may be in flight before an ACK is needed
+
+// frame types
+#define FRAME_LINE 0x01 // host->device: an ASCII command line, without the '\r'
+#define FRAME_DATA 0x02 // either direction: bulk data, sequence numbered
+#define FRAME_ACK 0x03 // SEQ is the last DATA frame received in order, PAYLOAD[0] is the credit
+#define FRAME_NAK 0x04 // SEQ is the DATA frame the sender should resend from
+#define FRAME_RESP 0x05 // device->host: PAYLOAD[0] is the M2M response char, followed by any data
+#define FRAME_CMD 0x06 // host->device: PAYLOAD[0] is a BIN_OP_ opcode, then its fixed header and raw data
+#define FRAME_SAMPLE 0x07 // device->host: one stream sample, SEQ is the low byte of the sample index (not ACKed)
+
+// binary command opcodes, carried in FRAME_CMD. Fields after the opcode, LEN is 16-bit little-endian
+// writes carry as much data inline as fits in the frame; if LEN is larger, the adapter
+// replies with an ACK (credit) and the remainder follows as DATA frames.
+// reads reply with a RESP holding the data if it fits, otherwise DATA frames followed by a RESP
+#define BIN_OP_ADDR 0x01 // ADDR                    sets the current I2C address
+#define BIN_OP_WRITE 0x02 // ADDR LEN data          write, with stop
+#define BIN_OP_WRITE_HOLD 0x03 // ADDR LEN data     write, holding the bus for a repeated start
+#define BIN_OP_READ 0x04 // ADDR LEN                read LEN bytes
+#define BIN_OP_READMEM 0x05 // ADDR REG LEN         write REG, repeated start, read LEN bytes
+#define BIN_OP_WRITEMEM 0x06 // ADDR REG LEN data   write REG followed by the data
+#define BIN_OP_TRYADDR 0x07 // ADDR                 RESP '.' if the address ACKs, '~' if not
+#define BIN_OP_IOREAD 0x08 // PORT FLAGS            FLAGS bit 0 enables the pull-up, RESP data is 0 or 1
+#define BIN_OP_IOWRITE 0x09 // PORT LEVEL
+#define BIN_OP_SCAN 0x0A // FIRST LAST             RESP data is a 16-byte presence bitmap
+#define BIN_OP_SPEED 0x0B // HZ(4)                 sets the bus speed, RESP data is the actual speed HZ(4)
+#define BIN_OP_BATCH 0x0C // LEN script           runs a batch script, sent like the data of a write
+#define BIN_OP_DELAY 0x0D // US(4)                 batch scripts only: waits US microseconds
+#define BIN_OP_STREAM 0x0E // PERIOD_US(4) then ADDR REG LEN for each item   starts streaming, PERIOD_US 0 stops
+#define BIN_OP_MEMREAD 0x0F // ADDR REG(2) LEN(4)   readmem with a 16-bit register and length beyond 256 (see memcfg)
+#define BIN_OP_MEMWRITE 0x10 // ADDR REG(2) LEN(4) data   writemem, split at page boundaries (see memcfg)
+#define BIN_OP_MEMCFG 0x11 // REGBYTES PAGE(2)     readmem/writemem register address size (1 or 2), page size (0 if none)
+#define BIN_OP_STATS 0x12 // FLAGS                RESP data is the stats report text; FLAGS bit 0 clears the stats instead
+#define BIN_OP_IOREADMASK 0x13 // MASK(4)          RESP data is the levels of the MASK pins LEVELS(4), read at once
+#define BIN_OP_IOWRITEMASK 0x14 // MASK(4) VALUE(4) drives the MASK pins as outputs at their VALUE levels, at once
+#define BIN_OP_IOCFGMASK 0x15 // MASK(4) OUT(4) UP(4) DOWN(4)   sets the direction (1 = output) and pulls of the MASK pins
+#define BIN_OP_CAPTURE 0x16 // BASE COUNT RATE(4) SAMPLES(4) TRIGPIN TRIGTYPE   starts a logic capture (see capture.h),
+                            // RESP data is the sample rate achieved RATE(4)
+#define BIN_OP_CAPSTATUS 0x17 // FLAGS             RESP data is the capture STATE, then SAMPLES(4) and BYTES(4) stored;
+                              // FLAGS bit 0 stops the capture first
+#define BIN_OP_CAPREAD 0x18 // OFFSET(4) LEN(4)    reads LEN bytes of captured samples from byte OFFSET
+#define BIN_OP_PATTERN 0x19 // LEN script         runs a batch script as a timed pattern, RESP data is LATE_US(4)
+#define BIN_OP_BUS 0x1A // BUS                     selects the bus of the I2C ops that follow, queued like a transfer
+#define BIN_OP_BUSCFG 0x1B // BUS SDA SCL          sets up bus 1 to 3 on the given pins, SDA 0xFF releases it
+
+// a batch script is a sequence of WRITE, WRITE_HOLD, READ, READMEM, WRITEMEM, IOREAD, IOWRITE, IOREADMASK,
+// IOWRITEMASK, DELAY and BUS steps, each encoded as the opcode followed by its fields, exactly as in a FRAME_CMD.
+// The steps run back to back and the response data holds, for each step, its M2M response char
+// ('.', '~' or 'T') followed by any data read (LEN bytes for a read, 1 byte for IOREAD, 4 for IOREADMASK).
+// The batch stops at the first step that fails. A malformed script is rejected with 'X'
+// a pattern is a batch script played to a fixed schedule: each DELAY waits until US microseconds after the
+// end of the previous DELAY's wait was due (the start of the pattern for the first), rather than after the
+// steps before it finish, so their running times do not add up and the edges keep to the schedule. Instead
+// of the per-step results, the response is the most any DELAY was reached after its time had already
+// passed, LATE_US(4), which is 0 if every step fitted in its slot; or the response char of a failed step
+
+// streaming: after the RESP to BIN_OP_STREAM, the adapter reads every item (LEN bytes from register REG of
+// device ADDR) once per period, and sends a FRAME_SAMPLE for each sample: the timestamp of the sample in
+// microseconds since boot (8 bytes), then for each item its M2M response char and LEN bytes of data
+// (zero if the read failed). Any command stops the stream, a BIN_OP_STREAM with PERIOD_US 0 does nothing else
+
+// frame_rx_byte results
+#define FRAME_RX_NONE 0
+#define FRAME_RX_OK 1
+#define FRAME_RX_BAD_CRC 2
+
+typedef struct {
+    uint8_t state;
+    uint8_t type;
+    uint8_t seq;
+    uint16_t len;
+    uint16_t index;
+    uint16_t crc;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+} frame_rx_t;
+
+uint16_t crc16_update(uint16_t crc, uint8_t c);
+void frame_rx_reset(frame_rx_t *rx);
+int frame_rx_byte(frame_rx_t *rx, uint8_t c); // feeds one byte into the frame parser
+int frame_rx_idle(frame_rx_t *rx); // returns 1 if the parser is between frames
+void frame_send(uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len);
+void frame_send2(uint8_t type, uint8_t seq, uint8_t b0, const uint8_t *payload, uint16_t len);
+
+#endif // _M2MFRAME_HEADER_FILE_
@@ -9,13 +9,30 @@
 #include <string.h>
 #include "pico/stdlib.h"
 #include "extrafunc.h"
+#include "m2mframe.h"
+#include "txnqueue.h"
+#include "i2cdma.h"
+#include "pioi2c.h"
+#include "stats.h"
+#include "txbuf.h"
+#include "capture.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
 
 // definitions
-#define I2C_PORT_SELECTED 1
-#define I2C_SDA_PIN 14
+#define I2C_SDA_PIN 14 // bus 0, the I2C1 controller
 #define I2C_SCL_PIN 15
+#define I2C_BUS_COUNT TXN_BUS_MAX // bus 0: I2C1 on the pins above, bus 1: I2C0, buses 2 and 3: PIO (buscfg)
+#define I2C_BUS_FIRST_PIO 2
+#define BUS_NONE 0 // bus_type values
+#define BUS_HW 1   // an I2C controller, fed by DMA (i2cdma.h)
+#define BUS_PIO 2  // a PIO state machine (pioi2c.h)
+#define BUS_PIN_NONE 0xFF // buscfg SDA that releases the bus
+#define I2C_BAUD_DEFAULT (100 * 1000)
+#define I2C_BAUD_MIN 1000
+#define I2C_BAUD_MAX (1000 * 1000) // Fast-mode Plus
 #define BOARD_ADDR0_PIN 2
 #define BOARD_ADDR1_PIN 3
 #define BOARD_ADDR2_PIN 4
@@ -28,57 +45,267 @@
 #define M2M_RESPONSE_CONTINUE_CHAR '&'
 #define M2M_RESPONSE_ERR_CHAR 'X'
 #define M2M_RESPONSE_PROT_ERR_CHAR '~'
+#define M2M_RESPONSE_TIMEOUT_CHAR 'T' // transfer did not complete in time, the bus has been recovered
 #define TOKEN_PROGRESS_NONE 0
 #define TOKEN_PROGRESS_SEND 1
 #define TOKEN_PROGRESS_RECV 2
-#define COL_RED printf("\033[31m")
-#define COL_GREEN printf("\033[32m")
-#define COL_YELLOW printf("\033[33m")
-#define COL_BLUE printf("\033[34m")
-#define COL_MAGENTA printf("\033[35m")
-#define COL_CYAN printf("\033[36m")
-#define COL_RESET printf("\033[0m")
-
-// constants
-const uint8_t EOL_BIN_MAGIC[] = {0xBA, 0xDC, 0x0F, 0xFE, 0xE0, 0x0F, 0xF0, 0x0D}; // BADC0FFEE0DDF00D
+#define TOKEN_PROGRESS_STREAM 3
+#define RX_RING_SIZE 2048 // must be a power of 2
+#define LED_TICK_MS 2 // one main loop pass when idle, before the LED had a timer (1 ms input wait, 1 ms sleep)
+#define SCAN_PROBE_TIMEOUT_US 2000
+#define I2C_TIMEOUT_MARGIN_US 25000 // allowance for clock stretching, added to every transfer deadline
+#define BATCH_RESULT_MAX 1024
+#define BATCH_PLAIN 1 // do_batch values: the steps run back to back, each DELAY from the end of the last step
+#define BATCH_PATTERN 2 // the steps follow a schedule, each DELAY from when the previous one was due to end
+#define STREAM_MAX_ITEMS 8
+#define STREAM_MIN_PERIOD_US 100
+#define MEM_MAX_LEN 65536 // longest readmem/writemem, a whole 512 Kbit EEPROM
+#define MEM_CHUNK_LEN 256 // longer readmem/writemem transfers are split into parts of up to this many bytes
+#define STATS_REPORT_MAX 2048 // longest stats report
+#define CAPTURE_SEND_CHUNK 4096 // captured samples are sent in parts of this many bytes
+#define LED_HOLD_TICKS 220 // 20 passes of the old loop, 22 ms each while held
+#define ESC_RED "\033[31m"
+#define ESC_GREEN "\033[32m"
+#define ESC_YELLOW "\033[33m"
+#define ESC_BLUE "\033[34m"
+#define ESC_MAGENTA "\033[35m"
+#define ESC_CYAN "\033[36m"
+#define ESC_RESET "\033[0m"
+#define COL_RED colour(ESC_RED)
+#define COL_GREEN colour(ESC_GREEN)
+#define COL_YELLOW colour(ESC_YELLOW)
+#define COL_BLUE colour(ESC_BLUE)
+#define COL_MAGENTA colour(ESC_MAGENTA)
+#define COL_CYAN colour(ESC_CYAN)
+#define COL_RESET colour(ESC_RESET)
 
 // global variables
-i2c_inst_t *i2c_port;
 uint8_t board_addr;
 uint8_t uart_buffer[305];
 uint16_t uart_buffer_index = 0;
 uint8_t input_mode = MODE_ASCII;
 uint8_t m2m_resp = 0;
 uint8_t do_echo = 1;
+uint8_t use_colour = 1; // colour escapes in interactive output, turned off with colour:0
 uint8_t i2c_addr = 0x00;
+uint8_t i2c_bus_sel = 0; // bus of the I2C commands, set by the bus command
+uint8_t bus_type[I2C_BUS_COUNT]; // BUS_NONE until the bus is set up
+uint8_t bus_sda[I2C_BUS_COUNT];
+uint8_t bus_scl[I2C_BUS_COUNT];
+i2c_dma_t bus_dma[I2C_BUS_FIRST_PIO]; // transfer state of the controller buses
+pio_i2c_t bus_pio[I2C_BUS_COUNT - I2C_BUS_FIRST_PIO]; // and of the PIO buses
+uint32_t bus_start_us[I2C_BUS_COUNT]; // when the transfer in progress started, for the stats
+uint8_t bus_reading[I2C_BUS_COUNT];
+uint32_t i2c_baud = I2C_BAUD_DEFAULT;   // requested bus speed
+uint32_t i2c_baud_actual = 0;           // bus speed achieved, as returned by i2c_init
+uint32_t bitbang_delay_us = 5;          // half clock period for the bitbang (tryaddr) probe
 int expected_num = 0;
 uint8_t byte_buffer[256];
-uint8_t byte_buffer_index = 0;
+uint16_t byte_buffer_index = 0;
 uint8_t token_progress = TOKEN_PROGRESS_NONE;
 uint8_t do_repeated_start = 0;
-uint8_t led_hold_off = 0;
-uint8_t led_hold_on = 0;
-uint8_t led_counter = 0;
+uint8_t rx_ring[RX_RING_SIZE]; // USB input, drained in bulk by rx_fill
+uint16_t rx_head = 0;
+uint16_t rx_tail = 0;
+repeating_timer_t led_timer;
+volatile uint8_t led_hold_off = 0;
+volatile uint8_t led_hold_on = 0;
+uint16_t led_counter = 0;
 uint8_t led_counter_default = 0;
 int mem_dev_addr = -1;      // writemem/readmem で明示されたデバイスアドレス（-1 = 省略）
-uint8_t mem_reg = 0;        // writemem で指定されたレジスタ
+uint16_t mem_reg = 0;       // writemem で指定されたレジスタ
 uint8_t do_mem_write = 0;   // writemem モードフラグ
+uint8_t mem_reg_len = 1;    // readmem/writemem register address size, 1 or 2 bytes (memcfg)
+uint16_t mem_page_size = 0; // writemem page size, 0 if the device is not paged (memcfg)
+uint32_t mem_offset = 0;    // bytes of the current writemem already handed to core1
+int xfer_result = 0;        // first error in the parts of a split writemem
+uint32_t xfer_offset = 0;   // bytes of a split readmem already sent on
+uint8_t xfer_seq = 0;       // next DATA frame sequence number of a split readmem
+uint8_t xfer_aborted = 0;   // a split readmem has ended early, its remaining parts are dropped
+uint8_t do_batch = 0;       // the bytes being collected are a batch script (BATCH_PLAIN or BATCH_PATTERN)
+absolute_time_t pattern_slot; // when the current pattern DELAY is due to end
+uint32_t pattern_late_us;   // the most a pattern DELAY has been reached after its slot ended
+uint8_t batch_result[BATCH_RESULT_MAX]; // per-step status and read data of a batch
+txn_t direct_txn;           // a transfer run directly on core0, for batch steps and stream samples
+uint8_t stream_item_bus[STREAM_MAX_ITEMS]; // stream items: bus, device, register and length to read
+uint8_t stream_item_addr[STREAM_MAX_ITEMS];
+uint8_t stream_item_reg[STREAM_MAX_ITEMS];
+uint8_t stream_item_len[STREAM_MAX_ITEMS];
+uint8_t stream_items = 0;
+uint32_t stream_period_us = 0;
+uint8_t streaming = 0;
+repeating_timer_t stream_timer;
+volatile uint32_t stream_index = 0; // samples due, counted by the stream timer
+volatile uint64_t stream_stamp = 0; // time of the latest sample
+uint32_t stream_sent = 0;           // index of the last sample sent
+uint8_t stream_record[FRAME_MAX_PAYLOAD];
+frame_rx_t frame_rx;        // binary mode frame parser
+uint8_t rx_data_seq = 0;    // next DATA frame sequence number expected from the host
+uint8_t rx_nak_sent = 0;    // set once a NAK has been sent for rx_data_seq
+char bin_escape[10];        // plain text seen between frames, so "device?" works in binary mode
+uint8_t bin_escape_index = 0;
+txn_queue_t txn_queue;      // I2C transactions handed from core0 to core1
+txn_engine_t txn_engine;    // core1's side of the queue
+uint32_t stats_output_us = 0; // core0 time spent sending transaction responses, see txn_poll
+uint32_t stats_stall_us = 0;  // core0 time spent waiting for core1, see stall_end
+char stats_report[STATS_REPORT_MAX];
 
 /************* functions ***************/
 
-void i2c_setup(void) {
-    if (I2C_PORT_SELECTED == 0) {
-        i2c_port = &i2c0_inst;
-    } else {
-        i2c_port = &i2c1_inst;
+void complete_send(void);
+int store_bytes(const uint8_t *data, uint32_t n);
+void decode_bin_cmd(uint8_t *cmd, uint16_t len);
+int bus_start(void *ctx, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop);
+int bus_check(void *ctx);
+int bus_xfer_start(uint8_t b, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop,
+                   uint32_t timeout_us);
+int bus_xfer_poll(uint8_t b);
+void i2c_bus_recover(uint8_t b);
+
+// the ctx of each bus is its number
+txn_bus_t i2c_buses[I2C_BUS_COUNT] = {
+    {bus_start, bus_check, (void *) 0},
+    {bus_start, bus_check, (void *) 1},
+    {bus_start, bus_check, (void *) 2},
+    {bus_start, bus_check, (void *) 3},
+};
+
+// sends a colour escape sequence, unless colours are off
+void colour(const char *esc) {
+    if (use_colour) {
+        printf("%s", esc);
+    }
+}
+
+// as colour, into the TX buffer
+void tx_colour(const char *esc) {
+    if (use_colour) {
+        tx_puts(esc);
     }
-    i2c_init(i2c_port, 100 * 1000);
+}
+
+// sets the bus speed in Hz, used from now on by every bus and the bitbang probe
+// returns the actual speed achieved by bus 0
+uint32_t i2c_set_speed(uint32_t baud) {
+    uint8_t b;
+    i2c_baud = baud;
+    for (b = 0; b < I2C_BUS_COUNT; b++) {
+        if (bus_type[b] == BUS_HW) {
+            if (b == 0) {
+                i2c_baud_actual = i2c_init(bus_dma[b].i2c, i2c_baud);
+            } else {
+                i2c_init(bus_dma[b].i2c, i2c_baud);
+            }
+        } else if (bus_type[b] == BUS_PIO) {
+            pio_i2c_set_baudrate(&bus_pio[b - I2C_BUS_FIRST_PIO], i2c_baud);
+        }
+    }
+    bitbang_delay_us = 500000 / i2c_baud;
+    if (bitbang_delay_us < 1) {
+        bitbang_delay_us = 1;
+    }
+    return i2c_baud_actual;
+}
+
+void i2c_setup(void) {
+    bus_type[0] = BUS_HW;
+    bus_sda[0] = I2C_SDA_PIN;
+    bus_scl[0] = I2C_SCL_PIN;
+    i2c_dma_init(&bus_dma[0], &i2c1_inst);
+    i2c_dma_init(&bus_dma[1], &i2c0_inst);
+    i2c_set_speed(i2c_baud);
     gpio_set_function(I2C_SDA_PIN, GPIO_FUNC_I2C);
     gpio_set_function(I2C_SCL_PIN, GPIO_FUNC_I2C);
     gpio_pull_up(I2C_SDA_PIN);
     gpio_pull_up(I2C_SCL_PIN);
 }
 
+// puts the pins of bus b back under control of its I2C peripheral, re-initialised at the current speed,
+// or of its state machine
+void i2c_restore_pins(uint8_t b) {
+    if (bus_type[b] == BUS_PIO) {
+        pio_i2c_reset(&bus_pio[b - I2C_BUS_FIRST_PIO]);
+        return;
+    }
+    i2c_init(bus_dma[b].i2c, i2c_baud);
+    gpio_set_function(bus_sda[b], GPIO_FUNC_I2C);
+    gpio_set_function(bus_scl[b], GPIO_FUNC_I2C);
+    gpio_pull_up(bus_sda[b]);
+    gpio_pull_up(bus_scl[b]);
+}
+
+// hands the pins of bus b back to the SIO as inputs, undoing the output enable inversion of a PIO bus
+void bus_pins_gpio(uint8_t b) {
+    gpio_init(bus_sda[b]);
+    gpio_init(bus_scl[b]);
+    gpio_set_oeover(bus_sda[b], GPIO_OVERRIDE_NORMAL);
+    gpio_set_oeover(bus_scl[b], GPIO_OVERRIDE_NORMAL);
+}
+
+// returns the bus using GPIO p, or -1
+int bus_pin_owner(int p) {
+    uint8_t b;
+    for (b = 0; b < I2C_BUS_COUNT; b++) {
+        if ((bus_type[b] != BUS_NONE) && ((bus_sda[b] == p) || (bus_scl[b] == p))) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+int check_ioport_valid(int p);
+
+// sets up bus b (1 to 3) on the given pins, or releases it if sda is BUS_PIN_NONE. Bus 1 is the I2C0
+// controller, which can only use SDA on GPIO 0, 4, 8 ... and SCL on GPIO 1, 5, 9 ...; buses 2 and 3 are
+// PIO state machines, on any free pins with SCL on the GPIO after SDA.
+// returns 0 if the pins are not valid for the bus, or there is no free state machine
+int bus_config(uint8_t b, uint8_t sda, uint8_t scl) {
+    int ok;
+    if ((b == 0) || (b >= I2C_BUS_COUNT)) {
+        return 0;
+    }
+    if (sda != BUS_PIN_NONE) {
+        ok = (sda != scl) &&
+             (check_ioport_valid(sda) || (bus_pin_owner(sda) == b)) &&
+             (check_ioport_valid(scl) || (bus_pin_owner(scl) == b));
+        if (b < I2C_BUS_FIRST_PIO) {
+            ok = ok && ((sda % 4) == 0) && ((scl % 4) == 1);
+        } else {
+            ok = ok && (scl == sda + 1);
+        }
+        if (!ok) {
+            return 0;
+        }
+    }
+    if (bus_type[b] == BUS_HW) {
+        i2c_deinit(bus_dma[b].i2c);
+    } else if (bus_type[b] == BUS_PIO) {
+        pio_i2c_deinit(&bus_pio[b - I2C_BUS_FIRST_PIO]);
+    }
+    if (bus_type[b] != BUS_NONE) {
+        bus_pins_gpio(b);
+        bus_type[b] = BUS_NONE;
+    }
+    if (sda == BUS_PIN_NONE) {
+        if (i2c_bus_sel == b) {
+            i2c_bus_sel = 0;
+        }
+        return 1;
+    }
+    if (b >= I2C_BUS_FIRST_PIO) {
+        if (!pio_i2c_init(&bus_pio[b - I2C_BUS_FIRST_PIO], sda, i2c_baud)) {
+            return 0;
+        }
+        bus_type[b] = BUS_PIO;
+    } else {
+        bus_type[b] = BUS_HW;
+    }
+    bus_sda[b] = sda;
+    bus_scl[b] = scl;
+    i2c_restore_pins(b);
+    return 1;
+}
+
 // returns the following addresses, depending on the state of the ADDR0 and ADDR1 pins:
 // ADDR2  ADDR1  ADDR0    Address
 // 0      0      0       0x07
@@ -121,101 +348,334 @@ int check_ioport_valid(int p) {
     if ((p == BOARD_ADDR0_PIN) ||
     (p == BOARD_ADDR1_PIN) ||
     (p == BOARD_ADDR2_PIN) ||
-    (p == I2C_SDA_PIN) ||
-    (p == I2C_SCL_PIN)){
+    (bus_pin_owner(p) >= 0)){
         port_valid = 0;
     }
     return port_valid;
 }
 
+// checks a mask of GPIOs for the io mask commands: at least one pin, and every pin valid
+int check_iomask_valid(uint32_t mask) {
+    int p;
+    if (mask == 0) {
+        return 0;
+    }
+    for (p = 0; p < 32; p++) {
+        if ((mask & (1UL << p)) && !check_ioport_valid(p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// hands the pins in mask to software control. gpio_init also resets the pin to an input driving
+// low, so it is only used for pins not already under software control: a pin that is an output
+// keeps its level until it is changed, rather than glitching low on every io command
+void io_claim_pins(uint32_t mask) {
+    int p;
+    for (p = 0; p < NUM_BANK0_GPIOS; p++) {
+        if ((mask & (1UL << p)) && (gpio_get_function(p) != GPIO_FUNC_SIO)) {
+            gpio_init(p);
+        }
+    }
+}
+
+// reads a GPIO input, enabling the pull-up if requested. Returns 0 or 1
+uint8_t io_read_port(uint8_t port, uint8_t pullup) {
+    io_claim_pins(1UL << port);
+    gpio_set_dir(port, GPIO_IN);
+    if (pullup) {
+        gpio_pull_up(port);
+    }
+    return gpio_get(port) ? 1 : 0;
+}
+
+// the level is set before the direction, so the pin goes straight to it
+void io_write_port(uint8_t port, uint8_t level) {
+    io_claim_pins(1UL << port);
+    gpio_put(port, level);
+    gpio_set_dir(port, GPIO_OUT);
+}
+
+// reads the levels of the pins in mask, all sampled at the same instant. The pins are not reconfigured,
+// so outputs read back their own level, and inputs keep their pulls (see io_config_mask)
+uint32_t io_read_mask(uint32_t mask) {
+    return gpio_get_all() & mask;
+}
+
+// drives the pins in mask as outputs, at the levels of the matching bits of value, all at once
+void io_write_mask(uint32_t mask, uint32_t value) {
+    io_claim_pins(mask);
+    gpio_put_masked(mask, value);
+    gpio_set_dir_masked(mask, mask);
+}
+
+// sets the direction (bits of out: 1 for an output) and the pull-up and pull-down of the pins in mask.
+// The pulls are set first, so that new inputs don't float
+void io_config_mask(uint32_t mask, uint32_t out, uint32_t up, uint32_t down) {
+    int p;
+    io_claim_pins(mask);
+    for (p = 0; p < NUM_BANK0_GPIOS; p++) {
+        if (mask & (1UL << p)) {
+            gpio_set_pulls(p, (up >> p) & 1, (down >> p) & 1);
+        }
+    }
+    gpio_set_dir_masked(mask, out);
+}
+
+// core0 time that is not spent in the output or stall phases, for timing the parse phase
+uint32_t parse_clock(void) {
+    return time_us_32() - stats_output_us - stats_stall_us;
+}
+
+// moves everything the USB stack has received into rx_ring, without waiting
+void rx_fill(void) {
+    int c;
+    uint32_t n = 0;
+    while (((rx_head - rx_tail) & (RX_RING_SIZE - 1)) != (RX_RING_SIZE - 1)) {
+        c = getchar_timeout_us(0);
+        if (c == PICO_ERROR_TIMEOUT) {
+            break;
+        }
+        rx_ring[rx_head] = (uint8_t) c;
+        rx_head = (rx_head + 1) & (RX_RING_SIZE - 1);
+        n++;
+    }
+    stats_add(STAT_USB_RX_BYTES, n);
+}
+
+// returns the next input character, from rx_ring if it holds any,
+// otherwise waiting up to timeout_us for one. Returns PICO_ERROR_TIMEOUT if none arrives
+int input_getc(uint32_t timeout_us) {
+    int c;
+    if (rx_head == rx_tail) {
+        if (timeout_us == 0) {
+            return PICO_ERROR_TIMEOUT;
+        }
+        return getchar_timeout_us(timeout_us);
+    }
+    c = rx_ring[rx_tail];
+    rx_tail = (rx_tail + 1) & (RX_RING_SIZE - 1);
+    return c;
+}
+
+// reads input until a complete frame (good or bad) arrives, or the timeout expires
+// returns the frame_rx_byte result, or FRAME_RX_NONE on timeout
+int frame_wait(frame_rx_t *rx, uint32_t timeout_us) {
+    int c;
+    int res;
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    while (!time_reached(deadline)) {
+        c = input_getc(1000);
+        if (c == PICO_ERROR_TIMEOUT) {
+            continue;
+        }
+        res = frame_rx_byte(rx, (uint8_t) c);
+        if (res != FRAME_RX_NONE) {
+            return res;
+        }
+    }
+    return FRAME_RX_NONE;
+}
+
+// sends an M2M response character, preceded by any data (e.g. the '1' of an ioread).
+// In binary mode the response is sent as a single RESP frame
+void m2m_respond_data(char c, const uint8_t *data, uint16_t len) {
+    if ((c == M2M_RESPONSE_ERR_CHAR) || (c == M2M_RESPONSE_PROT_ERR_CHAR) || (c == M2M_RESPONSE_TIMEOUT_CHAR)) {
+        stats_inc(STAT_ERRORS);
+    }
+    if (input_mode == MODE_BIN) {
+        frame_send2(FRAME_RESP, 0, (uint8_t) c, data, len);
+        return;
+    }
+    tx_write(data, len);
+    tx_putc(c);
+    tx_flush();
+}
+
+void m2m_respond(char c) {
+    m2m_respond_data(c, NULL, 0);
+}
+
+// adds bytes to the TX buffer as hex, with no separators
+void print_hex_bytes(uint8_t *buf, uint16_t len) {
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        tx_hex(buf[i]);
+    }
+}
+
 // print_buf_hex prints a buffer in hex format, up to 304 bytes
 // 000: 00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F : 0123456789ABCDEF
+void print_buf_hex_at(uint8_t *buf, uint16_t len, uint32_t index);
+
 void
 print_buf_hex(uint8_t *buf, uint16_t len) {
+    print_buf_hex_at(buf, len, 0);
+}
+
+// as print_buf_hex, with the offsets starting at index, for a buffer that is part of a larger read
+// each line is assembled in the TX buffer and sent in one write
+void
+print_buf_hex_at(uint8_t *buf, uint16_t len, uint32_t index) {
     uint16_t i, j;
     uint8_t c;
-    uint8_t index = 0;
 
     for (i = 0; i < len; i += 16) {
-        COL_BLUE;
-        printf("%03d: ", index);
-        COL_CYAN;
+        tx_colour(ESC_BLUE);
+        if (index < 100) {
+            tx_putc('0');
+        }
+        if (index < 10) {
+            tx_putc('0');
+        }
+        tx_dec(index);
+        tx_puts(": ");
+        tx_colour(ESC_CYAN);
         for (j = 0; j < 16; j++) {
             if (i + j < len) {
-                printf("%02X ", buf[i + j]);
+                tx_hex(buf[i + j]);
+                tx_putc(' ');
             } else {
-                printf("   ");
+                tx_puts("   ");
             }
         }
-        COL_BLUE;
-        printf(": ");
-        COL_GREEN;
+        tx_colour(ESC_BLUE);
+        tx_puts(": ");
+        tx_colour(ESC_GREEN);
         for (j = 0; j < 16; j++) {
             if (i + j < len) {
                 c = buf[i + j];
-                if ((c < 32) || (c > 126)) {
-                    printf(".");
-                } else {
-                    printf("%c", c);
-                }
+                tx_putc(((c < 32) || (c > 126)) ? '.' : c);
             } else {
-                printf(" ");
+                tx_putc(' ');
             }
         }
-        printf("\n");
+        tx_newline();
+        tx_flush();
         index += 16;
     }
-    COL_RESET;
+    tx_colour(ESC_RESET);
+    tx_flush();
 }
 
 // print the buffer as hex bytes, 16 per line, each line ending with '&'.
 // remote side should respond with '&' to continue, or 'X' to abort
-void print_buf_m2m_ascii(uint8_t *buf, uint16_t len) {
+// returns 0 if all was sent, otherwise the response that ends the transfer early
+// (len should be a multiple of 16 if more data follows in a later call)
+// each full line is sent in one write; a last partial line is left in the TX buffer for the
+// caller to add the final response to
+char send_hex_lines(uint8_t *buf, uint16_t len) {
     uint16_t i;
+    uint32_t start;
     char ch;
     for (i = 0; i < len; i++) {
-        printf("%02X ", buf[i]);
+        tx_hex(buf[i]);
+        tx_putc(' ');
         if ((i % 16) == 15) {
-            putchar(M2M_RESPONSE_CONTINUE_CHAR);
+            tx_putc(M2M_RESPONSE_CONTINUE_CHAR);
+            tx_flush();
             //wait for a response for up to 1 second
-            ch = getchar_timeout_us(1E6);
+            start = time_us_32();
+            ch = input_getc(1E6);
+            stats_inc(STAT_HOST_WAITS);
+            stats_record(STAT_HIST_HOST_WAIT, time_us_32() - start);
             if (ch == M2M_RESPONSE_ERR_CHAR) { // PC wishes to abort
-                putchar(M2M_RESPONSE_OK_CHAR);
-                return;
+                return M2M_RESPONSE_OK_CHAR;
             }
             if (ch != M2M_RESPONSE_CONTINUE_CHAR) {
                 // unexpected message, or timeout. Abort with error!
-                putchar(M2M_RESPONSE_ERR_CHAR);
-                return;
+                return M2M_RESPONSE_ERR_CHAR;
             }
         }
     }
-    putchar(M2M_RESPONSE_OK_CHAR);
+    return 0;
 }
 
-// print the buffer as raw bytes, 64 per line, each line ending with '&'.
-// remote side should respond with '&' to continue, or 'X' to abort
-void print_buf_m2m_bin(uint8_t *buf, uint16_t len) {
-    uint16_t i;
-    char ch;
-    for (i = 0; i < len; i++) {
-        putchar(buf[i]);
-        if ((i % 64) == 63) {
-            putchar(M2M_RESPONSE_CONTINUE_CHAR);
-            //wait for a response for up to 1 second
-            ch = getchar_timeout_us(1E6);
-            if (ch == M2M_RESPONSE_ERR_CHAR) { // PC wishes to abort
-                putchar(M2M_RESPONSE_OK_CHAR);
-                return;
+void print_buf_m2m_ascii(uint8_t *buf, uint16_t len) {
+    char c = send_hex_lines(buf, len);
+    tx_putc(c ? c : M2M_RESPONSE_OK_CHAR);
+    tx_flush();
+}
+
+// send the buffer as DATA frames, with a sliding window of up to FRAME_WINDOW frames
+// in flight. The host acknowledges frames cumulatively with ACK (which also carries its credit),
+// requests a resend from a given frame with NAK, or aborts with a RESP containing 'X'
+// the frames are numbered from seq0, so a transfer can be sent as several buffers
+// returns 0 once every frame is acknowledged, otherwise the response that ends the transfer early
+char send_data_frames(uint8_t *buf, uint16_t len, uint8_t seq0) {
+    uint16_t nframes = (len + FRAME_DATA_CHUNK - 1) / FRAME_DATA_CHUNK;
+    uint16_t next = 0;  // next frame to transmit
+    uint16_t acked = 0; // number of frames acknowledged by the host
+    uint16_t chunk;
+    uint8_t credit = FRAME_WINDOW;
+    uint8_t delta;
+    uint32_t start;
+    int res;
+    while (acked < nframes) {
+        while ((next < nframes) && ((next - acked) < credit)) {
+            chunk = len - (next * FRAME_DATA_CHUNK);
+            if (chunk > FRAME_DATA_CHUNK) {
+                chunk = FRAME_DATA_CHUNK;
             }
-            if (ch != M2M_RESPONSE_CONTINUE_CHAR) {
-                // unexpected message, or timeout. Abort with error!
-                putchar(M2M_RESPONSE_ERR_CHAR);
-                return;
+            frame_send(FRAME_DATA, (uint8_t) (seq0 + next), &buf[next * FRAME_DATA_CHUNK], chunk);
+            next++;
+        }
+        //wait for a response for up to 1 second
+        start = time_us_32();
+        res = frame_wait(&frame_rx, 1E6);
+        stats_inc(STAT_HOST_WAITS);
+        stats_record(STAT_HIST_HOST_WAIT, time_us_32() - start);
+        if (res == FRAME_RX_NONE) {
+            // timeout. Abort with error!
+            return M2M_RESPONSE_ERR_CHAR;
+        }
+        if (res == FRAME_RX_BAD_CRC) {
+            stats_inc(STAT_CRC_ERRORS);
+            continue; // a later cumulative ACK or NAK supersedes it
+        }
+        if (frame_rx.type == FRAME_ACK) {
+            delta = (uint8_t) (frame_rx.seq + 1 - (uint8_t) (seq0 + acked));
+            if (delta <= (next - acked)) {
+                acked += delta;
+            }
+            if ((frame_rx.len > 0) && (frame_rx.payload[0] > 0)) {
+                credit = frame_rx.payload[0];
             }
+        } else if (frame_rx.type == FRAME_NAK) {
+            delta = (uint8_t) (frame_rx.seq - (uint8_t) (seq0 + acked));
+            if (delta < (next - acked)) {
+                acked += delta;
+                stats_add(STAT_HOST_RESENDS, next - acked);
+                next = acked; // go back and resend from the requested frame
+            }
+        } else if ((frame_rx.type == FRAME_RESP) && (frame_rx.len > 0) &&
+                   (frame_rx.payload[0] == M2M_RESPONSE_ERR_CHAR)) { // PC wishes to abort
+            return M2M_RESPONSE_OK_CHAR;
         }
     }
-    putchar(M2M_RESPONSE_OK_CHAR);
+    return 0;
+}
+
+void print_buf_m2m_bin(uint8_t *buf, uint16_t len) {
+    char c = send_data_frames(buf, len, 0);
+    m2m_respond(c ? c : M2M_RESPONSE_OK_CHAR);
+}
+
+// the M2M response for a failed transfer: 'T' if it timed out, '~' otherwise
+char m2m_error_char(int retval) {
+    return (retval == PICO_ERROR_TIMEOUT) ? M2M_RESPONSE_TIMEOUT_CHAR : M2M_RESPONSE_PROT_ERR_CHAR;
+}
+
+// sends the outcome of a read in M2M mode: the data if the read succeeded, '~' or 'T' otherwise
+void print_read_m2m(int retval, uint8_t *buf, uint16_t len) {
+    if (retval < 0) {
+        m2m_respond(m2m_error_char(retval));
+    } else if (input_mode == MODE_ASCII) {
+        print_buf_m2m_ascii(buf, len);
+    } else {
+        print_buf_m2m_bin(buf, len);
+    }
 }
 
 // used only in bitbang mode!
@@ -230,57 +690,54 @@ void pulldown_gpio(uint8_t pin) {
     gpio_set_dir(pin, GPIO_OUT);
     gpio_put(pin, 0);
 }
-// this function will switch into GPIO mode and bitbang the I2C address to see if the ACK is received
-// then it switches back to I2C mode
+// this function will switch the pins of bus b into GPIO mode and bitbang the I2C address to see if the ACK
+// is received, then it switches back to I2C mode
 // returns 1 if ACK received, 0 otherwise
-int bitbang_i2c_addr(unsigned int val) {
+int bitbang_i2c_addr(uint8_t b, unsigned int val) {
     uint8_t ack;
     uint8_t i;
     uint8_t addr = (uint8_t) val;
-    gpio_init(I2C_SDA_PIN);
-    gpio_init(I2C_SCL_PIN);
-    pullup_gpio(I2C_SDA_PIN);
-    pullup_gpio(I2C_SCL_PIN);
+    uint8_t sda = bus_sda[b];
+    uint8_t scl = bus_scl[b];
+    bus_pins_gpio(b);
+    pullup_gpio(sda);
+    pullup_gpio(scl);
     // perform the I2C start condition
-    pulldown_gpio(I2C_SDA_PIN);
-    sleep_us(5);
-    pulldown_gpio(I2C_SCL_PIN);
-    sleep_us(5);
+    pulldown_gpio(sda);
+    sleep_us(bitbang_delay_us);
+    pulldown_gpio(scl);
+    sleep_us(bitbang_delay_us);
     addr <<= 1; // left-shift the address by 1 bit
     addr |= 1; // we want to do an I2C read
     // send the address
     for (i=0; i<8; i++) {
         if (addr & 0x80) {
-            pullup_gpio(I2C_SDA_PIN);
+            pullup_gpio(sda);
         } else {
-            pulldown_gpio(I2C_SDA_PIN);
+            pulldown_gpio(sda);
         }
-        sleep_us(5);
-        pullup_gpio(I2C_SCL_PIN);
-        sleep_us(5);
-        pulldown_gpio(I2C_SCL_PIN);
-        sleep_us(5);
+        sleep_us(bitbang_delay_us);
+        pullup_gpio(scl);
+        sleep_us(bitbang_delay_us);
+        pulldown_gpio(scl);
+        sleep_us(bitbang_delay_us);
         addr <<= 1;
     }
     // now read the ACK bit
-    pullup_gpio(I2C_SDA_PIN);
-    sleep_us(5);
-    pullup_gpio(I2C_SCL_PIN);
-    sleep_us(5);
-    ack = gpio_get(I2C_SDA_PIN);
-    pulldown_gpio(I2C_SCL_PIN);
-    sleep_us(5);
+    pullup_gpio(sda);
+    sleep_us(bitbang_delay_us);
+    pullup_gpio(scl);
+    sleep_us(bitbang_delay_us);
+    ack = gpio_get(sda);
+    pulldown_gpio(scl);
+    sleep_us(bitbang_delay_us);
     // now release the I2C bus
-    pullup_gpio(I2C_SCL_PIN);
-    sleep_us(5);
-    pullup_gpio(I2C_SDA_PIN);
-    sleep_us(5);
+    pullup_gpio(scl);
+    sleep_us(bitbang_delay_us);
+    pullup_gpio(sda);
+    sleep_us(bitbang_delay_us);
     // convert back to I2C mode
-    i2c_init(i2c_port, 100 * 1000);
-    gpio_set_function(I2C_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(I2C_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C_SDA_PIN);
-    gpio_pull_up(I2C_SCL_PIN);
+    i2c_restore_pins(b);
     if (ack==0) { // held low means the device is present
         return 1;
         } else {
@@ -288,16 +745,86 @@ int bitbang_i2c_addr(unsigned int val) {
     }
 }
 
-// scan_uart_input fill the uart_buffer until a newline is received
-// returns number of bytes if a newline is received, 0 otherwise
-int
-scan_uart_input(void) {
-    int c;
+// frees a bus held by a device that stopped part-way through a byte (SDA stuck low):
+// clocks SCL up to 9 times until the device releases SDA, sends a STOP, then switches back to I2C mode
+void i2c_bus_recover(uint8_t b) {
+    uint8_t i;
+    uint8_t sda = bus_sda[b];
+    uint8_t scl = bus_scl[b];
+    bus_pins_gpio(b);
+    pullup_gpio(sda);
+    pullup_gpio(scl);
+    sleep_us(bitbang_delay_us);
+    for (i = 0; (i < 9) && (gpio_get(sda) == 0); i++) {
+        pulldown_gpio(scl);
+        sleep_us(bitbang_delay_us);
+        pullup_gpio(scl);
+        sleep_us(bitbang_delay_us);
+    }
+    // STOP condition: SDA rises while SCL is high
+    pulldown_gpio(scl);
+    sleep_us(bitbang_delay_us);
+    pulldown_gpio(sda);
+    sleep_us(bitbang_delay_us);
+    pullup_gpio(scl);
+    sleep_us(bitbang_delay_us);
+    pullup_gpio(sda);
+    sleep_us(bitbang_delay_us);
+    i2c_restore_pins(b);
+}
+
+// in binary mode, plain text outside of frames is collected so that a "device?" line still
+// works (for instance, when the PC software restarts). It switches the adapter back to ASCII mode
+int scan_bin_escape(int c) {
     uint16_t num_bytes;
-    c = getchar_timeout_us(1000);
-    if (c == PICO_ERROR_TIMEOUT) {
+    if (c != 13) {
+        if (bin_escape_index < sizeof(bin_escape) - 1) {
+            bin_escape[bin_escape_index++] = (char) c;
+        }
         return 0;
     }
+    bin_escape[bin_escape_index] = 0;
+    bin_escape_index = 0;
+    if (strcmp(bin_escape, "device?") != 0) {
+        return 0;
+    }
+    input_mode = MODE_ASCII;
+    strcpy((char *) uart_buffer, "device? ");
+    num_bytes = strlen((char *) uart_buffer);
+    return num_bytes;
+}
+
+// stores the payload of a DATA frame into byte_buffer as part of a send or writemem
+void scan_data_frame(void) {
+    uint8_t ahead;
+    if (token_progress != TOKEN_PROGRESS_SEND) {
+        return; // not expecting data, ignore
+    }
+    if (frame_rx.seq != rx_data_seq) {
+        ahead = (uint8_t) (frame_rx.seq - rx_data_seq);
+        if ((ahead < 128) && (rx_nak_sent == 0)) {
+            // a frame went missing, ask for everything from the missing one onwards
+            frame_send(FRAME_NAK, rx_data_seq, NULL, 0);
+            rx_nak_sent = 1;
+        }
+        return; // duplicates of earlier frames are dropped
+    }
+    rx_nak_sent = 0;
+    rx_data_seq++;
+    if (store_bytes(frame_rx.payload, frame_rx.len)) {
+        complete_send(); // the RESP sent here also acknowledges the final frame
+    } else {
+        frame_send2(FRAME_ACK, frame_rx.seq, FRAME_WINDOW, NULL, 0);
+    }
+}
+
+// scan_uart_char handles a single input character
+// returns number of bytes if a newline (or binary mode command line) is received, 0 otherwise
+int
+scan_uart_char(int c) {
+    int res;
+    uint16_t num_bytes;
+    uint32_t start;
     // ASCII mode
     if (input_mode == MODE_ASCII) {
         if ((c == 8) || (c==127)) { // backspace pressed
@@ -340,464 +867,2112 @@ scan_uart_input(void) {
         }
         return 0;
     }
-    // binary mode
-    // we keep reading bytes until we find the magic number
-    uart_buffer[uart_buffer_index] = (uint8_t) c;
-    uart_buffer_index++;
-    if (uart_buffer_index < 8) {
+    // binary mode, the input is a stream of frames (see m2mframe.h)
+    res = frame_rx_byte(&frame_rx, (uint8_t) c);
+    if (res == FRAME_RX_NONE) {
+        if (frame_rx_idle(&frame_rx)) {
+            return scan_bin_escape(c);
+        }
+        return 0;
+    }
+    if (res == FRAME_RX_BAD_CRC) {
+        stats_inc(STAT_CRC_ERRORS);
+        // ask the host to resend; a LINE frame is resent as-is, DATA frames from rx_data_seq
+        frame_send(FRAME_NAK, rx_data_seq, NULL, 0);
         return 0;
     }
-    if (memcmp(&uart_buffer[uart_buffer_index-8], EOL_BIN_MAGIC, 8) == 0) {
-        num_bytes = uart_buffer_index - 8;
-        uart_buffer_index = 0;
-        print_buf_hex(uart_buffer, num_bytes);
+    bin_escape_index = 0;
+    if (frame_rx.type == FRAME_LINE) {
+        num_bytes = frame_rx.len;
+        if (num_bytes > 300) {
+            num_bytes = 300;
+        }
+        memcpy(uart_buffer, frame_rx.payload, num_bytes);
+        // add a space to simplify token parsing
+        uart_buffer[num_bytes++] = ' ';
+        uart_buffer[num_bytes] = 0;
         return num_bytes;
     }
+    if (frame_rx.type == FRAME_CMD) {
+        stats_inc(STAT_FRAMES);
+        start = parse_clock();
+        decode_bin_cmd(frame_rx.payload, frame_rx.len);
+        stats_record(STAT_HIST_PARSE, parse_clock() - start);
+    } else if (frame_rx.type == FRAME_DATA) {
+        scan_data_frame();
+    }
     return(0);
 }
 
-/* --- ヘルパー関数 --- */
-/* read from device memory: write reg (no stop) then read len bytes */
-int i2c_read_mem_addr(uint8_t dev_addr, uint8_t reg, uint8_t *buf, int len) {
+// probes every address from first to last with a 1-byte read on bus b,
+// and sets bit (addr % 8) of bitmap[addr / 8] for each address that ACKs.
+// unlike tryaddr, the pins stay in I2C mode, so there is no re-initialisation per address
+// returns the number of devices found
+int i2c_scan(uint8_t b, uint8_t first, uint8_t last, uint8_t *bitmap) {
+    uint16_t addr;
+    uint8_t rxdata;
     int ret;
-    // send register address with repeated-start (i2c_write_blocking(..., true))
-    ret = i2c_write_blocking(i2c_port, dev_addr, &reg, 1, true);
-    if (ret == PICO_ERROR_GENERIC) return PICO_ERROR_GENERIC;
-    ret = i2c_read_blocking(i2c_port, dev_addr, buf, len, false);
+    int found = 0;
+    memset(bitmap, 0, 16);
+    for (addr = first; (addr <= last) && (addr < 0x80); addr++) {
+        ret = bus_xfer_start(b, addr, &rxdata, 1, true, false, SCAN_PROBE_TIMEOUT_US);
+        while (ret == I2C_DMA_BUSY) {
+            ret = bus_xfer_poll(b);
+        }
+        if (ret >= 0) {
+            bitmap[addr / 8] |= (1 << (addr % 8));
+            found++;
+        } else if (ret == PICO_ERROR_TIMEOUT) {
+            i2c_bus_recover(b);
+        }
+    }
+    return found;
+}
+
+// scan_uart_input fill the uart_buffer until a newline is received
+// consumes everything waiting in rx_ring, stopping early when a line (or frame) is complete
+// returns number of bytes if a newline is received, 0 otherwise
+int
+scan_uart_input(void) {
+    int c;
+    int num_bytes;
+    while (1) {
+        c = input_getc(0);
+        if (c == PICO_ERROR_TIMEOUT) {
+            return 0;
+        }
+        num_bytes = scan_uart_char(c);
+        if (num_bytes > 0) {
+            return num_bytes;
+        }
+    }
+}
+
+// sends read data in binary mode: inline in the RESP frame if it fits, otherwise as DATA frames
+void print_read_bin(int retval, uint8_t *buf, uint16_t len) {
+    if (retval < 0) {
+        m2m_respond(m2m_error_char(retval));
+    } else if (len < FRAME_MAX_PAYLOAD) {
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, buf, len);
+    } else {
+        print_buf_m2m_bin(buf, len);
+    }
+}
+
+/* --- I2C transaction pipeline ---
+core0 parses commands and queues bus transactions, core1 executes them (core1_main), and core0
+sends each response once its transaction completes, in the order the commands arrived.
+Each transaction runs on the bus selected when it was queued; transactions on the same bus run in
+order, those on different buses at the same time.
+Anything that is not a queued transaction first waits for the pipeline to empty (pipeline_drain),
+so responses never overtake each other and commands such as speed or tryaddr never touch the
+bus while core1 is using it */
+
+// deadline for a transfer of len bytes: twice the nominal time of 9 clocks per byte,
+// plus the address byte, and the clock stretching allowance
+uint32_t i2c_txn_timeout_us(size_t len) {
+    return (uint32_t) (((uint64_t) (len + 1) * 9 * 2 * 1000000) / i2c_baud) + I2C_TIMEOUT_MARGIN_US;
+}
+
+// counts a finished bus transfer, started at start, in the stats
+void bus_stats(int ret, uint32_t start, int bytes_counter) {
+    stats_record(STAT_HIST_BUS, time_us_32() - start);
+    if (ret >= 0) {
+        stats_add(bytes_counter, ret);
+    } else if (ret == PICO_ERROR_TIMEOUT) {
+        stats_inc(STAT_I2C_TIMEOUTS);
+    } else {
+        stats_inc(STAT_I2C_NAKS);
+    }
+}
+
+// starts a transfer on bus b, through DMA for a controller or on the state machine for a PIO bus.
+// returns I2C_DMA_BUSY if it started, PICO_ERROR_GENERIC if not (the bus is not set up, or the
+// length is invalid)
+int bus_xfer_start(uint8_t b, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop,
+                   uint32_t timeout_us) {
+    int ret = PICO_ERROR_GENERIC;
+    if (bus_type[b] == BUS_HW) {
+        ret = read ? i2c_dma_start_read(&bus_dma[b], addr, buf, len, nostop, timeout_us)
+                   : i2c_dma_start_write(&bus_dma[b], addr, buf, len, nostop, timeout_us);
+    } else if (bus_type[b] == BUS_PIO) {
+        ret = read ? pio_i2c_start_read(&bus_pio[b - I2C_BUS_FIRST_PIO], addr, buf, len, nostop, timeout_us)
+                   : pio_i2c_start_write(&bus_pio[b - I2C_BUS_FIRST_PIO], addr, buf, len, nostop, timeout_us);
+    }
+    return (ret == 0) ? I2C_DMA_BUSY : ret;
+}
+
+// I2C_DMA_BUSY while the transfer on bus b is in progress, then its outcome (see i2c_dma_poll)
+int bus_xfer_poll(uint8_t b) {
+    if (bus_type[b] == BUS_PIO) {
+        return pio_i2c_poll(&bus_pio[b - I2C_BUS_FIRST_PIO]);
+    }
+    return i2c_dma_poll(&bus_dma[b]);
+}
+
+// the end of a transfer: a timeout is followed by the bus recovery sequence, so a stuck device
+// cannot hang the adapter
+int bus_finish(uint8_t b, int ret) {
+    if (ret == PICO_ERROR_TIMEOUT) {
+        i2c_bus_recover(b);
+    }
+    if (bus_reading[b]) {
+        stats_inc(STAT_I2C_READS);
+        bus_stats(ret, bus_start_us[b], STAT_I2C_RX_BYTES);
+    } else {
+        stats_inc(STAT_I2C_WRITES);
+        bus_stats(ret, bus_start_us[b], STAT_I2C_TX_BYTES);
+    }
     return ret;
 }
-/* write to device memory: send reg followed by data in single write */
-int i2c_write_mem_addr(uint8_t dev_addr, uint8_t reg, uint8_t *buf, int len) {
-    if (len > 255) return PICO_ERROR_GENERIC;
-    uint8_t tmp[257];
-    tmp[0] = reg;
-    memcpy(&tmp[1], buf, len);
-    return i2c_write_blocking(i2c_port, dev_addr, tmp, len + 1, false);
+
+// the bus operations of the transaction engine (txn_bus_t), run by core1, and by core0 for batch
+// steps and stream samples while core1 is idle. ctx is the bus number
+int bus_start(void *ctx, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop) {
+    uint8_t b = (uint8_t) (uintptr_t) ctx;
+    int ret;
+    bus_start_us[b] = time_us_32();
+    bus_reading[b] = read;
+    ret = bus_xfer_start(b, addr, buf, len, read, nostop, i2c_txn_timeout_us(len));
+    return (ret == I2C_DMA_BUSY) ? 0 : bus_finish(b, ret);
 }
 
-int decode_token(char *token) {
-    unsigned int val;
-    int ioport, ioval; // used for the iowrite and ioread commands
-    int port_valid;
-    int retval = 0;
-    if (strcmp(token, "device?") == 0) {
-        printf("easy_adapter_%d\n\r", board_addr);
-        led_hold_off = 1;
-        // reset any state and variables
-        token_progress = TOKEN_PROGRESS_NONE;
-        expected_num = 0;
-        byte_buffer_index = 0;
-        do_repeated_start = 0;
-        return TOKEN_RESULT_LINE_COMPLETE;
+int bus_check(void *ctx) {
+    uint8_t b = (uint8_t) (uintptr_t) ctx;
+    int ret = bus_xfer_poll(b);
+    return (ret == I2C_DMA_BUSY) ? TXN_BUSY : bus_finish(b, ret);
+}
+
+uint32_t txn_time_us(void) {
+    return time_us_32();
+}
+
+// runs a transaction on its bus on this core, and waits for it to finish
+void bus_execute(txn_t *t) {
+    txn_run_t r;
+    if (txn_run_begin(&r, &i2c_buses[t->bus], t) != TXN_BUSY) {
+        return;
     }
-    if (strcmp(token, "bin") == 0) {
-        input_mode = MODE_BIN;
-        if(m2m_resp) {
-            putchar(M2M_RESPONSE_OK_CHAR);
-        } else {
-            printf("Switching to binary mode\n");
-        }
-        return TOKEN_RESULT_LINE_COMPLETE;
+    while (txn_run_step(&r, &i2c_buses[t->bus]) == TXN_BUSY) {
+        tight_loop_contents();
     }
-    if (strncmp(token, "bytes:", 6) == 0) {
-        sscanf(token, "bytes:%d", &expected_num);
-        if(m2m_resp) {
-            putchar(M2M_RESPONSE_OK_CHAR);
+}
+
+// core1 keeps a transfer going on every bus that has work, so transactions on different buses overlap
+void core1_main(void) {
+    while (1) {
+        if (!txn_engine_step(&txn_engine, &txn_queue)) {
+            __wfe(); // sleep until core0 submits another transaction (__sev in txn_end)
         } else {
-            COL_BLUE;
-            printf("Expecting %d bytes\n", expected_num);
-            COL_RESET;
+            tight_loop_contents();
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
     }
-    if (strcmp(token, "send+hold") == 0) { // perform send, but hold the bus for a later repeated start
-        if (expected_num == 0) {
-            COL_RED;
-            printf("No bytes expected\n");
-            COL_RESET;
-            return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+// handles one part of a readmem or writemem that was split into several transfers (see mem_read_start
+// and store_bytes). A failed write part is only recorded, complete_send responds once all are done.
+// Read parts are sent on as they complete: as DATA frames numbered on from the previous part,
+// or hex lines, and the last part adds the final response
+void finish_mem_part(txn_t *t) {
+    char c = 0;
+    if (t->op == TXN_OP_WRITEMEM) {
+        if ((t->result < 0) && (xfer_result >= 0)) {
+            xfer_result = t->result;
         }
-        // consider remainder tokens on the line to be bytes for the send operation
-        byte_buffer_index = 0;
-        token_progress = TOKEN_PROGRESS_SEND;
-        do_repeated_start = 1;
-        return TOKEN_RESULT_OK;
+        return;
     }
-    if (strncmp(token, "tryaddr:", 8) == 0) {
-        if (strncmp(token, "tryaddr:0x", 10) == 0) {
-            // get i2c_addr in hex
-            sscanf(token, "tryaddr:0x%02X", &val);
-        } else {
-            // get i2c_addr in decimal
-            sscanf(token, "tryaddr:%d", &val);
-        }
-        retval = bitbang_i2c_addr(val);
-        if(m2m_resp) {
-            if (input_mode == MODE_ASCII) {
-                if (retval == 0) {
-                    putchar(M2M_RESPONSE_PROT_ERR_CHAR);
-                } else {
-                    putchar(M2M_RESPONSE_OK_CHAR);
-                }
-            } else {
-                // binary mode, todo
-            }
+    if (xfer_aborted) {
+        return;
+    }
+    if (t->result < 0) {
+        xfer_aborted = 1;
+        if (m2m_resp) {
+            m2m_respond(m2m_error_char(t->result));
         } else {
-            if (retval == 0) {
-                COL_RED;
-                printf("Protocol error! Does the I2C device exist?\n");
-                COL_RESET;
+            COL_RED;
+            if (t->result == PICO_ERROR_TIMEOUT) {
+                printf("Bus timeout! The bus has been recovered\n");
             } else {
-                COL_BLUE;
-                printf("Device found at address 0x%02X\n", val);
-                COL_RESET;
+                printf("Protocol error reading bytes from mem!\n");
             }
+            COL_RESET;
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
+        return;
     }
-    if (strncmp(token, "iowrite:", 8) == 0) {
-        sscanf(token, "iowrite:%d,%d", &ioport, &ioval);
-        port_valid = check_ioport_valid(ioport);
-        if (port_valid && ((ioval == 0) || (ioval == 1))) {
-            gpio_init(ioport);
-            gpio_set_dir(ioport, GPIO_OUT);
-            gpio_put(ioport, ioval);
-            if(m2m_resp) {
-                putchar(M2M_RESPONSE_OK_CHAR);
-            } else {
-                COL_BLUE;
-                printf("Port %d set to output %d\n", ioport, ioval);
-                COL_RESET;
-            }
-        } else {
-            if(m2m_resp) {
-                putchar(M2M_RESPONSE_ERR_CHAR);
-            } else {
-                COL_RED;
-                printf("Error, invalid IO port or value\n");
-                COL_RESET;
+    if (m2m_resp == 0) {
+        print_buf_hex_at(t->data, t->len, xfer_offset);
+    } else if (input_mode == MODE_BIN) {
+        c = send_data_frames(t->data, t->len, xfer_seq);
+        xfer_seq += (t->len + FRAME_DATA_CHUNK - 1) / FRAME_DATA_CHUNK;
+    } else {
+        c = send_hex_lines(t->data, t->len);
+    }
+    xfer_offset += t->len;
+    if ((c == 0) && (t->tag == TXN_TAG_LAST)) {
+        c = M2M_RESPONSE_OK_CHAR;
+    }
+    if (c != 0) {
+        xfer_aborted = 1;
+        if (m2m_resp) {
+            m2m_respond(c);
+        }
+    }
+    tx_flush();
+}
+
+// sends the response for a completed transaction
+void finish_txn(txn_t *t) {
+    if (t->tag != TXN_TAG_NONE) {
+        finish_mem_part(t);
+        return;
+    }
+    if ((t->result == PICO_ERROR_TIMEOUT) && (m2m_resp == 0)) {
+        COL_RED;
+        printf("Bus timeout! The bus has been recovered\n");
+        COL_RESET;
+        return;
+    }
+    if (t->op == TXN_OP_NOP) {
+        if (m2m_resp) {
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+        }
+        return;
+    }
+    if ((t->op == TXN_OP_WRITE) || (t->op == TXN_OP_WRITEMEM)) {
+        if (t->result < 0) {
+            if (m2m_resp) {
+                m2m_respond(m2m_error_char(t->result));
+            } else {
+                COL_RED;
+                printf("Protocol error sending bytes! Does the I2C device exist?\n");
+                COL_RESET;
+            }
+        } else if (m2m_resp) {
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+        }
+        return;
+    }
+    if (m2m_resp) {
+        if (input_mode == MODE_BIN) {
+            print_read_bin(t->result, t->data, t->len);
+        } else {
+            print_read_m2m(t->result, t->data, t->len);
+        }
+    } else if (t->result < 0) {
+        COL_RED;
+        if (t->op == TXN_OP_READMEM) {
+            printf("Protocol error reading bytes from mem!\n");
+        } else {
+            printf("Protocol error reading bytes! Does the I2C device exist?\n");
+        }
+        COL_RESET;
+    } else {
+        print_buf_hex(t->data, t->len);
+    }
+}
+
+// sends the responses of any transactions that have completed (the output phase)
+void txn_poll(void) {
+    txn_t *t;
+    uint32_t us;
+    while ((t = txn_completed(&txn_queue)) != NULL) {
+        us = time_us_32();
+        finish_txn(t);
+        txn_release(&txn_queue);
+        us = time_us_32() - us;
+        stats_output_us += us;
+        stats_record(STAT_HIST_OUTPUT, us);
+    }
+}
+
+// core0 waits for core1 (the stall phase) start with stall_start and end with stall_end.
+// Responses sent meanwhile count as output, not as stall time
+uint32_t stall_start(void) {
+    return time_us_32() - stats_output_us;
+}
+
+void stall_end(uint32_t start) {
+    uint32_t us = time_us_32() - stats_output_us - start;
+    stats_stall_us += us;
+    stats_record(STAT_HIST_STALL, us);
+}
+
+// waits until every queued transaction has completed and been responded to.
+// USB input keeps being drained into rx_ring meanwhile
+void pipeline_drain(void) {
+    uint32_t start;
+    if (txn_pending(&txn_queue) == 0) {
+        return;
+    }
+    start = stall_start();
+    while (txn_pending(&txn_queue) > 0) {
+        rx_fill();
+        txn_poll();
+    }
+    stall_end(start);
+}
+
+// returns a transaction slot to fill in, waiting for one to become free if the queue is full
+txn_t *txn_begin(uint8_t op, uint8_t addr, uint16_t len) {
+    txn_t *t;
+    uint32_t start;
+    if ((t = txn_alloc(&txn_queue)) == NULL) {
+        start = stall_start();
+        while ((t = txn_alloc(&txn_queue)) == NULL) {
+            rx_fill();
+            txn_poll();
+        }
+        stall_end(start);
+    }
+    t->op = op;
+    t->addr = addr;
+    t->len = len;
+    t->reg = 0;
+    t->reg_len = 1;
+    t->nostop = 0;
+    t->poll = 0;
+    t->tag = TXN_TAG_NONE;
+    t->bus = i2c_bus_sel;
+    return t;
+}
+
+// hands the transaction from txn_begin to core1. In interactive mode there is no pipelining,
+// the result is printed before returning
+void txn_end(void) {
+    txn_submit(&txn_queue);
+    __sev();
+    if (m2m_resp == 0) {
+        pipeline_drain();
+    }
+}
+
+// reads a 32-bit little-endian field of a binary command
+uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// returns the length of the batch step at script[0], or 0 if it is not a valid step.
+// *rlen is set to the number of result bytes the step produces
+uint16_t batch_step_len(uint8_t *script, uint16_t len, uint16_t *rlen) {
+    uint16_t n;
+    *rlen = 1;
+    switch (script[0]) {
+        case BIN_OP_WRITE:
+        case BIN_OP_WRITE_HOLD:
+            if (len < 4) return 0;
+            n = script[2] | (script[3] << 8);
+            if ((n == 0) || (n > TXN_DATA_MAX)) return 0;
+            return 4 + n;
+        case BIN_OP_WRITEMEM:
+            if (len < 5) return 0;
+            n = script[3] | (script[4] << 8);
+            if ((n == 0) || (n >= TXN_DATA_MAX)) return 0;
+            return 5 + n;
+        case BIN_OP_READ:
+            if (len < 4) return 0;
+            n = script[2] | (script[3] << 8);
+            if ((n == 0) || (n > TXN_DATA_MAX)) return 0;
+            *rlen += n;
+            return 4;
+        case BIN_OP_READMEM:
+            if (len < 5) return 0;
+            n = script[3] | (script[4] << 8);
+            if ((n == 0) || (n > TXN_DATA_MAX)) return 0;
+            *rlen += n;
+            return 5;
+        case BIN_OP_IOREAD:
+            if ((len < 3) || !check_ioport_valid(script[1])) return 0;
+            *rlen += 1;
+            return 3;
+        case BIN_OP_IOWRITE:
+            if ((len < 3) || !check_ioport_valid(script[1]) || (script[2] > 1)) return 0;
+            return 3;
+        case BIN_OP_IOREADMASK:
+            if ((len < 5) || !check_iomask_valid(get_le32(&script[1]))) return 0;
+            *rlen += 4;
+            return 5;
+        case BIN_OP_IOWRITEMASK:
+            if ((len < 9) || !check_iomask_valid(get_le32(&script[1]))) return 0;
+            return 9;
+        case BIN_OP_DELAY:
+            if (len < 5) return 0;
+            return 5;
+        case BIN_OP_BUS:
+            if ((len < 2) || (script[1] >= I2C_BUS_COUNT) || (bus_type[script[1]] == BUS_NONE)) return 0;
+            return 2;
+    }
+    return 0;
+}
+
+// runs one batch step, writing its status char and any read data to result
+// returns the number of result bytes, with result[0] != '.' if the step failed
+uint16_t batch_step_run(uint8_t *step, uint8_t *result) {
+    txn_t *t = &direct_txn;
+    uint16_t n = 0;
+    uint32_t us;
+    uint32_t levels;
+    absolute_time_t deadline;
+    t->nostop = 0;
+    t->reg_len = 1;
+    t->poll = 0;
+    t->result = 0;
+    switch (step[0]) {
+        case BIN_OP_WRITE:
+        case BIN_OP_WRITE_HOLD:
+            t->op = TXN_OP_WRITE;
+            t->addr = step[1];
+            t->len = step[2] | (step[3] << 8);
+            t->nostop = (step[0] == BIN_OP_WRITE_HOLD);
+            memcpy(t->data, &step[4], t->len);
+            break;
+        case BIN_OP_WRITEMEM:
+            t->op = TXN_OP_WRITEMEM;
+            t->addr = step[1];
+            t->len = (step[3] | (step[4] << 8)) + 1;
+            t->data[0] = step[2];
+            memcpy(&t->data[1], &step[5], t->len - 1);
+            break;
+        case BIN_OP_READ:
+            t->op = TXN_OP_READ;
+            t->addr = step[1];
+            t->len = n = step[2] | (step[3] << 8);
+            break;
+        case BIN_OP_READMEM:
+            t->op = TXN_OP_READMEM;
+            t->addr = step[1];
+            t->reg = step[2];
+            t->len = n = step[3] | (step[4] << 8);
+            break;
+        case BIN_OP_IOREAD:
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            result[1] = io_read_port(step[1], step[2] & 0x01);
+            return 2;
+        case BIN_OP_IOWRITE:
+            io_write_port(step[1], step[2]);
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            return 1;
+        case BIN_OP_IOREADMASK:
+            levels = io_read_mask(get_le32(&step[1]));
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            memcpy(&result[1], &levels, 4); // little-endian
+            return 5;
+        case BIN_OP_IOWRITEMASK:
+            io_write_mask(get_le32(&step[1]), get_le32(&step[5]));
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            return 1;
+        case BIN_OP_DELAY:
+            us = step[1] | (step[2] << 8) | (step[3] << 16) | ((uint32_t) step[4] << 24);
+            if (do_batch == BATCH_PATTERN) {
+                pattern_slot = delayed_by_us(pattern_slot, us);
+                deadline = pattern_slot;
+                if (absolute_time_diff_us(deadline, get_absolute_time()) > (int64_t) pattern_late_us) {
+                    pattern_late_us = (uint32_t) absolute_time_diff_us(deadline, get_absolute_time());
+                }
+            } else {
+                deadline = make_timeout_time_us(us);
+            }
+            while (!time_reached(deadline)) {
+                rx_fill();
+            }
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            return 1;
+        case BIN_OP_BUS:
+            i2c_bus_sel = step[1];
+            result[0] = M2M_RESPONSE_OK_CHAR;
+            return 1;
+    }
+    t->bus = i2c_bus_sel;
+    bus_execute(t);
+    if (t->result < 0) {
+        result[0] = m2m_error_char(t->result);
+        return 1;
+    }
+    result[0] = M2M_RESPONSE_OK_CHAR;
+    memcpy(&result[1], t->data, n);
+    return 1 + n;
+}
+
+// the response to a pattern: its lateness, or the response char of the step that failed
+void send_pattern_result(char c, uint16_t steps) {
+    if (m2m_resp == 0) {
+        if (c == M2M_RESPONSE_OK_CHAR) {
+            COL_BLUE;
+            printf("Pattern of %d steps done, %lu usec late at most\n", steps, (unsigned long) pattern_late_us);
+        } else {
+            COL_RED;
+            printf("Pattern stopped, a step failed with %c\n", c);
+        }
+        COL_RESET;
+    } else if (c != M2M_RESPONSE_OK_CHAR) {
+        m2m_respond(c);
+    } else if (input_mode == MODE_BIN) {
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) &pattern_late_us, 4); // little-endian
+    } else {
+        print_read_m2m(0, (uint8_t *) &pattern_late_us, 4);
+    }
+}
+
+// runs a batch script (see m2mframe.h) and sends the per-step results as one response, or for a
+// pattern (do_batch is BATCH_PATTERN) the lateness, or the first failure.
+// Steps run on this core with core1 idle, since they mix bus transfers with GPIO and delays
+void run_batch(uint8_t *script, uint16_t len) {
+    uint16_t i, n, rlen;
+    uint16_t total = 0;
+    uint16_t steps = 0;
+    pipeline_drain();
+    // check the whole script first, so that a malformed one has no effect
+    for (i = 0; i < len; i += n) {
+        n = batch_step_len(&script[i], len - i, &rlen);
+        total += rlen;
+        if ((n == 0) || (n > len - i) || (total > sizeof(batch_result))) {
+            if (m2m_resp) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+            } else {
+                COL_RED; printf("Invalid batch step at offset %d\n", i); COL_RESET;
+            }
+            return;
+        }
+        steps++;
+    }
+    total = 0;
+    pattern_slot = get_absolute_time();
+    pattern_late_us = 0;
+    for (i = 0; i < len; i += batch_step_len(&script[i], len - i, &rlen)) {
+        n = batch_step_run(&script[i], &batch_result[total]);
+        if ((m2m_resp == 0) && (do_batch == BATCH_PLAIN)) {
+            COL_BLUE; printf("Step at offset %d: %c\n", i, batch_result[total]); COL_RESET;
+            if (n > 1) {
+                print_buf_hex(&batch_result[total + 1], n - 1);
+            }
+        }
+        total += n;
+        if (batch_result[total - n] != M2M_RESPONSE_OK_CHAR) {
+            break; // later steps usually depend on this one
+        }
+    }
+    if (do_batch == BATCH_PATTERN) {
+        send_pattern_result(batch_result[total - n], steps);
+    } else if (m2m_resp) {
+        if (input_mode == MODE_BIN) {
+            print_read_bin(0, batch_result, total);
+        } else {
+            print_read_m2m(0, batch_result, total);
+        }
+    } else {
+        COL_BLUE; printf("Batch of %d steps done\n", steps); COL_RESET;
+    }
+}
+
+// stream timer: only records when the sample is due, the reads are done by stream_poll
+bool stream_timer_callback(repeating_timer_t *rt) {
+    stream_stamp = time_us_64();
+    stream_index++;
+    return true; // keep repeating
+}
+
+// adds a (device, register, length) item to read for each stream sample
+// returns 0 if there is no room for it
+int stream_add_item(uint8_t addr, uint8_t reg, uint8_t len) {
+    uint16_t record_len = 8;
+    uint8_t i;
+    for (i = 0; i < stream_items; i++) {
+        record_len += 1 + stream_item_len[i];
+    }
+    if ((stream_items >= STREAM_MAX_ITEMS) || (len == 0) || (record_len + 1 + len > sizeof(stream_record))) {
+        return 0;
+    }
+    stream_item_addr[stream_items] = addr;
+    stream_item_bus[stream_items] = i2c_bus_sel;
+    stream_item_reg[stream_items] = reg;
+    stream_item_len[stream_items] = len;
+    stream_items++;
+    return 1;
+}
+
+// starts sampling the stream items every stream_period_us. Returns 0 if the settings are invalid
+int stream_start(void) {
+    if ((stream_items == 0) || (stream_period_us < STREAM_MIN_PERIOD_US)) {
+        return 0;
+    }
+    pipeline_drain();
+    stream_index = 0;
+    stream_sent = 0;
+    streaming = 1;
+    // a negative delay keeps the period between the starts of the callbacks fixed
+    add_repeating_timer_us(-((int64_t) stream_period_us), stream_timer_callback, NULL, &stream_timer);
+    return 1;
+}
+
+void stream_stop(void) {
+    if (streaming) {
+        cancel_repeating_timer(&stream_timer);
+        streaming = 0;
+    }
+}
+
+// reads the stream items and sends a sample record, if a sample is due.
+// If the host or the bus could not keep up, samples are skipped; the index shows the gap
+void stream_poll(void) {
+    uint32_t save;
+    uint32_t index;
+    uint64_t stamp;
+    uint16_t n = 8;
+    uint8_t i;
+    txn_t *t = &direct_txn;
+    if ((streaming == 0) || (stream_sent == stream_index)) {
+        return;
+    }
+    save = save_and_disable_interrupts();
+    index = stream_index;
+    stamp = stream_stamp;
+    restore_interrupts(save);
+    stream_sent = index;
+    memcpy(stream_record, &stamp, 8); // little-endian
+    t->reg_len = 1;
+    t->nostop = 0;
+    t->poll = 0;
+    for (i = 0; i < stream_items; i++) {
+        t->op = TXN_OP_READMEM;
+        t->addr = stream_item_addr[i];
+        t->reg = stream_item_reg[i];
+        t->len = stream_item_len[i];
+        t->bus = stream_item_bus[i];
+        bus_execute(t);
+        if (t->result < 0) {
+            stream_record[n] = m2m_error_char(t->result);
+            memset(&stream_record[n + 1], 0, t->len);
+        } else {
+            stream_record[n] = M2M_RESPONSE_OK_CHAR;
+            memcpy(&stream_record[n + 1], t->data, t->len);
+        }
+        n += 1 + t->len;
+    }
+    if (input_mode == MODE_BIN) {
+        frame_send(FRAME_SAMPLE, (uint8_t) index, stream_record, n);
+        return;
+    }
+    // one line per sample: index, timestamp, then each item as hex, or its error char
+    tx_dec(index);
+    tx_putc(' ');
+    tx_dec(stamp);
+    n = 8;
+    for (i = 0; i < stream_items; i++) {
+        tx_putc(' ');
+        if (stream_record[n] != M2M_RESPONSE_OK_CHAR) {
+            tx_putc(stream_record[n]);
+        } else {
+            print_hex_bytes(&stream_record[n + 1], stream_item_len[i]);
+        }
+        n += 1 + stream_item_len[i];
+    }
+    tx_newline();
+    tx_flush();
+}
+
+// starts collecting the bytes of a writemem, to the device (or -1 for i2c_addr) and register
+void mem_write_begin(int dev_addr, uint16_t reg) {
+    mem_dev_addr = dev_addr;
+    mem_reg = reg;
+    mem_offset = 0;
+    xfer_result = 0;
+    do_mem_write = 1;
+    do_batch = 0;
+    do_repeated_start = 0; // for writemem we do a single write, no repeated start
+}
+
+// length of the writemem segment being collected: up to MEM_CHUNK_LEN bytes, and with a page size
+// set (memcfg) never across a page boundary, as an EEPROM would wrap around within the page
+uint32_t mem_segment_len(void) {
+    uint32_t n = expected_num - mem_offset;
+    uint32_t room;
+    if (n > MEM_CHUNK_LEN) {
+        n = MEM_CHUNK_LEN;
+    }
+    if (mem_page_size > 0) {
+        room = mem_page_size - ((mem_reg + mem_offset) % mem_page_size);
+        if (room < n) {
+            n = room;
+        }
+    }
+    return n;
+}
+
+// queues the writemem segment in byte_buffer as one write, register address (MSB first) then data.
+// With a page size set, core1 then polls until the device has programmed the page.
+// Once a part has failed, the rest of the data is dropped
+void mem_write_flush(uint8_t tag) {
+    int target = (mem_dev_addr == -1) ? i2c_addr : mem_dev_addr;
+    uint32_t reg = mem_reg + mem_offset;
+    txn_t *t;
+    txn_poll();
+    if (m2m_resp == 0) {
+        if (mem_offset == 0) {
+            COL_BLUE; printf("Writemem: dev=0x%02X reg=0x%04X len=%d\n", target, mem_reg, expected_num); COL_RESET;
+        }
+        print_buf_hex_at(byte_buffer, byte_buffer_index, mem_offset);
+    }
+    if (xfer_result >= 0) {
+        t = txn_begin(TXN_OP_WRITEMEM, (uint8_t) target, byte_buffer_index + mem_reg_len);
+        if (mem_reg_len == 2) {
+            t->data[0] = (uint8_t) (reg >> 8);
+        }
+        t->data[mem_reg_len - 1] = (uint8_t) reg;
+        memcpy(&t->data[mem_reg_len], byte_buffer, byte_buffer_index);
+        t->poll = (mem_page_size > 0);
+        if (t->poll) {
+            stats_inc(STAT_ACK_POLLS);
+        }
+        t->tag = tag;
+        txn_end();
+    }
+    mem_offset += byte_buffer_index;
+    byte_buffer_index = 0;
+}
+
+// adds received bytes to byte_buffer. A writemem is handed to core1 a segment at a time while
+// it is still arriving, so it can be longer than byte_buffer
+// returns 1 once all expected_num bytes are in (the last writemem segment is left in byte_buffer)
+int store_bytes(const uint8_t *data, uint32_t n) {
+    uint32_t seg, k;
+    while (n > 0) {
+        seg = do_mem_write ? mem_segment_len() : (uint32_t) expected_num;
+        k = seg - byte_buffer_index;
+        if (k > n) {
+            k = n;
+        }
+        memcpy(&byte_buffer[byte_buffer_index], data, k);
+        byte_buffer_index += k;
+        data += k;
+        n -= k;
+        if (byte_buffer_index < seg) {
+            return 0;
+        }
+        if (!do_mem_write || (mem_offset + byte_buffer_index >= (uint32_t) expected_num)) {
+            return 1; // any extra bytes are dropped
+        }
+        mem_write_flush(TXN_TAG_PART);
+    }
+    return 0;
+}
+
+// performs the I2C write once all the expected bytes are in byte_buffer,
+// for send, send+hold and writemem. Bytes arrive as hex tokens, or as DATA frames in binary mode
+void complete_send(void) {
+    txn_t *t;
+    if (do_batch) {
+        byte_buffer_index = 0;
+        token_progress = TOKEN_PROGRESS_NONE;
+        run_batch(byte_buffer, expected_num);
+        do_batch = 0;
+        expected_num = 0;
+        return;
+    }
+    if (do_mem_write) {
+        token_progress = TOKEN_PROGRESS_NONE;
+        if (mem_offset > 0) {
+            pipeline_drain(); // the earlier segments decide the outcome
+        }
+        if (xfer_result < 0) {
+            byte_buffer_index = 0;
+            if (m2m_resp) {
+                m2m_respond(m2m_error_char(xfer_result));
+            } else {
+                COL_RED;
+                printf("Error writing to mem at offset %lu!\n", (unsigned long) mem_offset);
+                COL_RESET;
+            }
+        } else {
+            mem_write_flush(TXN_TAG_NONE); // the response is sent once the write completes
+        }
+        // reset mem write flags
+        do_mem_write = 0;
+        mem_dev_addr = -1;
+        mem_offset = 0;
+        expected_num = 0;
+        return;
+    } else {
+        if (m2m_resp==0) {
+            COL_BLUE;
+            printf("Sending %d bytes\n", expected_num);
+            COL_RESET;
+            print_buf_hex(byte_buffer, expected_num);
+        }
+        t = txn_begin(TXN_OP_WRITE, i2c_addr, expected_num);
+        t->nostop = do_repeated_start;
+        memcpy(t->data, byte_buffer, expected_num);
+    }
+    byte_buffer_index = 0;
+    expected_num = 0;
+    do_repeated_start = 0;
+    token_progress = TOKEN_PROGRESS_NONE;
+    txn_end(); // the response is sent once the write completes
+}
+
+// queues a readmem. Up to MEM_CHUNK_LEN bytes is a single transfer with the usual response.
+// A longer read is split into parts: the register address and the first part, then reads that each
+// follow a repeated start with no stop in between, which a sequential-read device (EEPROM) continues
+// from where the previous part ended
+void mem_read_start(uint8_t addr, uint16_t reg, uint32_t len) {
+    txn_t *t;
+    uint32_t done = 0;
+    uint32_t n;
+    if (len <= MEM_CHUNK_LEN) {
+        t = txn_begin(TXN_OP_READMEM, addr, len);
+        t->reg = reg;
+        t->reg_len = mem_reg_len;
+        txn_end();
+        return;
+    }
+    pipeline_drain(); // the part state is shared, so any earlier split transfer must be finished
+    xfer_offset = 0;
+    xfer_seq = 0;
+    xfer_aborted = 0;
+    while (done < len) {
+        n = len - done;
+        if (n > MEM_CHUNK_LEN) {
+            n = MEM_CHUNK_LEN;
+        }
+        if (xfer_aborted && (done > 0)) {
+            // the host has stopped the read, or a part failed. End it with a 1-byte read and a stop
+            n = 1;
+            done = len - 1;
+        }
+        t = txn_begin((done == 0) ? TXN_OP_READMEM : TXN_OP_READ, addr, n);
+        t->reg = reg;
+        t->reg_len = mem_reg_len;
+        done += n;
+        t->nostop = (done < len);
+        t->tag = (done < len) ? TXN_TAG_PART : TXN_TAG_LAST;
+        txn_end();
+    }
+}
+
+// sets the readmem/writemem register address size and the writemem page size (0 if not paged)
+// returns 0 if either is invalid
+int mem_config(int reg_len, int page_size) {
+    if ((reg_len < 1) || (reg_len > 2) || (page_size < 0) || (page_size > 0xFFFF)) {
+        return 0;
+    }
+    mem_reg_len = reg_len;
+    mem_page_size = page_size;
+    return 1;
+}
+
+// true if reg fits in the register address size set by memcfg
+int mem_reg_valid(uint32_t reg) {
+    return (reg < (1UL << (8 * mem_reg_len)));
+}
+
+// starts a write from a BIN_OP_ command: the data that came inline with the command is
+// copied to byte_buffer, and if more is due the host is granted credit to send DATA frames
+void start_bin_write(uint8_t *data, uint16_t inline_len, uint32_t len) {
+    uint32_t max_len = do_mem_write ? MEM_MAX_LEN : sizeof(byte_buffer);
+    if ((len == 0) || (len > max_len) || (inline_len > len)) {
+        do_mem_write = 0;
+        do_batch = 0;
+        pipeline_drain();
+        m2m_respond(M2M_RESPONSE_ERR_CHAR);
+        return;
+    }
+    expected_num = len;
+    byte_buffer_index = 0;
+    if (store_bytes(data, inline_len)) {
+        complete_send();
+        return;
+    }
+    token_progress = TOKEN_PROGRESS_SEND;
+    rx_data_seq = 0;
+    rx_nak_sent = 0;
+    pipeline_drain(); // the credit is a reply too, so it must follow any earlier responses
+    frame_send2(FRAME_ACK, 0xFF, FRAME_WINDOW, NULL, 0);
+}
+
+// sends the stats report: as text in interactive mode, otherwise as read data.
+// Called with the pipeline drained, so that core1 is not updating the figures
+void send_stats_report(void) {
+    int n = stats_format(stats_report, sizeof(stats_report), time_us_64());
+    if (m2m_resp == 0) {
+        COL_BLUE;
+        printf("%s", stats_report);
+        COL_RESET;
+    } else if (input_mode == MODE_BIN) {
+        print_read_bin(0, (uint8_t *) stats_report, n);
+    } else {
+        print_read_m2m(0, (uint8_t *) stats_report, n);
+    }
+}
+
+// sends len bytes of the capture buffer from offset: as a hex dump in interactive mode, otherwise as
+// read data. The capture may be longer than a single buffer send, so it goes in parts, with the DATA
+// frames numbered on from one part to the next
+void send_capture(uint32_t offset, uint32_t len) {
+    uint8_t *buf = (uint8_t *) capture_buf + offset;
+    uint32_t done, n;
+    uint8_t seq = 0;
+    char c = 0;
+    if ((input_mode == MODE_BIN) && (len < FRAME_MAX_PAYLOAD)) {
+        print_read_bin(0, buf, len);
+        return;
+    }
+    for (done = 0; (done < len) && (c == 0); done += n) {
+        n = len - done;
+        if (n > CAPTURE_SEND_CHUNK) {
+            n = CAPTURE_SEND_CHUNK;
+        }
+        if (m2m_resp == 0) {
+            print_buf_hex_at(&buf[done], n, offset + done);
+        } else if (input_mode == MODE_BIN) {
+            c = send_data_frames(&buf[done], n, seq);
+            seq += (n + FRAME_DATA_CHUNK - 1) / FRAME_DATA_CHUNK;
+        } else {
+            c = send_hex_lines(&buf[done], n);
+        }
+    }
+    if (m2m_resp == 0) {
+        return;
+    }
+    if (input_mode == MODE_BIN) {
+        m2m_respond(c ? c : M2M_RESPONSE_OK_CHAR);
+    } else {
+        tx_putc(c ? c : M2M_RESPONSE_OK_CHAR);
+        tx_flush();
+    }
+}
+
+// decodes a binary command (FRAME_CMD payload), see the BIN_OP_ definitions in m2mframe.h
+// all fields are raw bytes, so there is no text parsing, and data is never hex encoded
+void decode_bin_cmd(uint8_t *cmd, uint16_t len) {
+    uint16_t n;
+    uint8_t level;
+    // minimum payload length (opcode plus fixed header) for each opcode
+    static const uint8_t hdr_len[] = {0, 2, 4, 4, 4, 5, 5, 2, 3, 3, 3, 5, 3, 0, 5, 8, 8, 4, 2, 5, 9, 17, 13, 2, 9, 3, 2, 4};
+    uint32_t baud;
+    uint32_t mlen;
+    uint32_t levels;
+    uint32_t cap[3]; // capture state, samples and bytes
+    uint16_t reg;
+    stream_stop(); // any command ends a stream
+    if ((len == 0) || (cmd[0] >= sizeof(hdr_len)) || (hdr_len[cmd[0]] == 0) || (len < hdr_len[cmd[0]])) {
+        pipeline_drain();
+        m2m_respond(M2M_RESPONSE_ERR_CHAR);
+        return;
+    }
+    // reads, writes and bus selections are queued behind any earlier ones, everything else waits for them
+    if ((cmd[0] != BIN_OP_WRITE) && (cmd[0] != BIN_OP_WRITE_HOLD) && (cmd[0] != BIN_OP_WRITEMEM) &&
+        (cmd[0] != BIN_OP_READ) && (cmd[0] != BIN_OP_READMEM) &&
+        (cmd[0] != BIN_OP_MEMWRITE) && (cmd[0] != BIN_OP_MEMREAD) && (cmd[0] != BIN_OP_BUS)) {
+        pipeline_drain();
+    }
+    token_progress = TOKEN_PROGRESS_NONE;
+    switch (cmd[0]) {
+        case BIN_OP_ADDR:
+            i2c_addr = cmd[1];
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            break;
+        case BIN_OP_BUS:
+            if ((cmd[1] >= I2C_BUS_COUNT) || (bus_type[cmd[1]] == BUS_NONE)) {
+                pipeline_drain();
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            i2c_bus_sel = cmd[1];
+            txn_begin(TXN_OP_NOP, 0, 0); // the response follows those of the transactions before it
+            txn_end();
+            break;
+        case BIN_OP_BUSCFG:
+            if (!bus_config(cmd[1], cmd[2], cmd[3])) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            break;
+        case BIN_OP_WRITE:
+        case BIN_OP_WRITE_HOLD:
+            i2c_addr = cmd[1];
+            do_repeated_start = (cmd[0] == BIN_OP_WRITE_HOLD);
+            do_mem_write = 0;
+            do_batch = 0;
+            start_bin_write(&cmd[4], len - 4, cmd[2] | (cmd[3] << 8));
+            break;
+        case BIN_OP_WRITEMEM:
+            mem_write_begin(cmd[1], cmd[2]);
+            start_bin_write(&cmd[5], len - 5, cmd[3] | (cmd[4] << 8));
+            break;
+        case BIN_OP_MEMWRITE:
+            reg = cmd[2] | (cmd[3] << 8);
+            mlen = cmd[4] | (cmd[5] << 8) | (cmd[6] << 16) | ((uint32_t) cmd[7] << 24);
+            if (!mem_reg_valid(reg)) {
+                mlen = 0; // rejected by start_bin_write
+            }
+            mem_write_begin(cmd[1], reg);
+            start_bin_write(&cmd[8], len - 8, mlen);
+            break;
+        case BIN_OP_MEMCFG:
+            if (!mem_config(cmd[1], cmd[2] | (cmd[3] << 8))) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            break;
+        case BIN_OP_STREAM:
+            stream_period_us = cmd[1] | (cmd[2] << 8) | (cmd[3] << 16) | ((uint32_t) cmd[4] << 24);
+            if (stream_period_us == 0) {
+                m2m_respond(M2M_RESPONSE_OK_CHAR);
+                break;
+            }
+            stream_items = 0;
+            for (n = 5; n + 3 <= len; n += 3) {
+                if (!stream_add_item(cmd[n], cmd[n + 1], cmd[n + 2])) {
+                    stream_items = 0;
+                    break;
+                }
+            }
+            // the response goes first, so that it precedes the samples
+            if ((stream_items == 0) || (stream_period_us < STREAM_MIN_PERIOD_US)) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            stream_start();
+            break;
+        case BIN_OP_BATCH:
+        case BIN_OP_PATTERN:
+            do_mem_write = 0;
+            do_batch = (cmd[0] == BIN_OP_PATTERN) ? BATCH_PATTERN : BATCH_PLAIN;
+            start_bin_write(&cmd[3], len - 3, cmd[1] | (cmd[2] << 8));
+            break;
+        case BIN_OP_READ:
+            i2c_addr = cmd[1];
+            n = cmd[2] | (cmd[3] << 8);
+            if ((n == 0) || (n > sizeof(byte_buffer))) {
+                pipeline_drain();
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            txn_begin(TXN_OP_READ, i2c_addr, n);
+            txn_end();
+            break;
+        case BIN_OP_READMEM:
+        case BIN_OP_MEMREAD:
+            if (cmd[0] == BIN_OP_READMEM) {
+                reg = cmd[2];
+                mlen = cmd[3] | (cmd[4] << 8);
+            } else {
+                reg = cmd[2] | (cmd[3] << 8);
+                mlen = cmd[4] | (cmd[5] << 8) | (cmd[6] << 16) | ((uint32_t) cmd[7] << 24);
+            }
+            if ((mlen == 0) || (mlen > MEM_MAX_LEN) || !mem_reg_valid(reg)) {
+                pipeline_drain();
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            mem_read_start(cmd[1], reg, mlen);
+            break;
+        case BIN_OP_STATS:
+            if (cmd[1] & 0x01) {
+                stats_reset(time_us_64());
+                m2m_respond(M2M_RESPONSE_OK_CHAR);
+                break;
+            }
+            send_stats_report();
+            break;
+        case BIN_OP_SCAN:
+            i2c_scan(i2c_bus_sel, cmd[1], cmd[2], byte_buffer);
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, byte_buffer, 16);
+            break;
+        case BIN_OP_SPEED:
+            baud = cmd[1] | (cmd[2] << 8) | (cmd[3] << 16) | ((uint32_t) cmd[4] << 24);
+            if ((baud < I2C_BAUD_MIN) || (baud > I2C_BAUD_MAX)) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            baud = i2c_set_speed(baud);
+            memcpy(byte_buffer, &baud, 4); // little-endian
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, byte_buffer, 4);
+            break;
+        case BIN_OP_TRYADDR:
+            if (bitbang_i2c_addr(i2c_bus_sel, cmd[1])) {
+                m2m_respond(M2M_RESPONSE_OK_CHAR);
+            } else {
+                m2m_respond(M2M_RESPONSE_PROT_ERR_CHAR);
+            }
+            break;
+        case BIN_OP_IOREAD:
+            if (!check_ioport_valid(cmd[1])) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            level = io_read_port(cmd[1], cmd[2] & 0x01);
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, &level, 1);
+            break;
+        case BIN_OP_IOWRITE:
+            if (!check_ioport_valid(cmd[1]) || (cmd[2] > 1)) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            io_write_port(cmd[1], cmd[2]);
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            break;
+        case BIN_OP_IOREADMASK:
+        case BIN_OP_IOWRITEMASK:
+        case BIN_OP_IOCFGMASK:
+            if (!check_iomask_valid(get_le32(&cmd[1]))) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            if (cmd[0] == BIN_OP_IOREADMASK) {
+                levels = io_read_mask(get_le32(&cmd[1]));
+                memcpy(byte_buffer, &levels, 4); // little-endian
+                m2m_respond_data(M2M_RESPONSE_OK_CHAR, byte_buffer, 4);
+                break;
+            }
+            if (cmd[0] == BIN_OP_IOWRITEMASK) {
+                io_write_mask(get_le32(&cmd[1]), get_le32(&cmd[5]));
+            } else {
+                io_config_mask(get_le32(&cmd[1]), get_le32(&cmd[5]), get_le32(&cmd[9]), get_le32(&cmd[13]));
+            }
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+            break;
+        case BIN_OP_CAPTURE:
+            levels = capture_start(cmd[1], cmd[2], get_le32(&cmd[3]), get_le32(&cmd[7]), cmd[11], cmd[12]);
+            if (levels == 0) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            memcpy(byte_buffer, &levels, 4); // little-endian
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, byte_buffer, 4);
+            break;
+        case BIN_OP_CAPSTATUS:
+            if (cmd[1] & 0x01) {
+                capture_stop();
+            }
+            byte_buffer[0] = (uint8_t) capture_poll(&cap[1], &cap[2]);
+            cap[2] *= 4;
+            memcpy(&byte_buffer[1], &cap[1], 8); // little-endian
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, byte_buffer, 9);
+            break;
+        case BIN_OP_CAPREAD:
+            if ((get_le32(&cmd[5]) == 0) || (get_le32(&cmd[1]) > sizeof(capture_buf)) ||
+                (get_le32(&cmd[5]) > sizeof(capture_buf) - get_le32(&cmd[1]))) {
+                m2m_respond(M2M_RESPONSE_ERR_CHAR);
+                break;
+            }
+            send_capture(get_le32(&cmd[1]), get_le32(&cmd[5]));
+            break;
+    }
+}
+
+// checks the count set by bytes:N for send, send+hold, batch and recv, which must fit byte_buffer
+// (only writemem can be longer), and responds with the error if not
+int check_send_count(void) {
+    if ((expected_num > 0) && (expected_num <= (int) sizeof(byte_buffer))) {
+        return 1;
+    }
+    pipeline_drain();
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_ERR_CHAR);
+    } else {
+        COL_RED;
+        if (expected_num == 0) {
+            printf("No bytes expected\n");
+        } else {
+            printf("At most %d bytes, except for writemem\n", (int) sizeof(byte_buffer));
+        }
+        COL_RESET;
+    }
+    return 0;
+}
+
+// value of a hex digit, or -1 if c is not one
+int hex_value(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    c |= 0x20; // lower case
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// parses an unsigned number at *p, decimal or hex with a 0x prefix, and moves *p past it
+// returns 0 if there are no digits, or the number does not fit in 32 bits
+int parse_number(const char **p, uint32_t *val) {
+    const char *s = *p;
+    uint32_t v = 0;
+    uint32_t base = 10;
+    int d;
+    int digits = 0;
+    if ((s[0] == '0') && ((s[1] | 0x20) == 'x')) {
+        base = 16;
+        s += 2;
+    }
+    while ((d = hex_value(*s)) >= 0) {
+        if (d >= (int) base) {
+            break;
+        }
+        if (v > (0xFFFFFFFFUL - d) / base) {
+            return 0; // overflow
+        }
+        v = v * base + d;
+        s++;
+        digits++;
+    }
+    if (digits == 0) {
+        return 0;
+    }
+    *val = v;
+    *p = s;
+    return 1;
+}
+
+// parses a list of up to max comma-separated numbers, e.g. the "0x50,0x10,4" of readmem:0x50,0x10,4
+// returns how many there were, or -1 if the text is anything else
+int parse_numbers(const char *s, uint32_t *vals, int max) {
+    int n = 0;
+    while (n < max) {
+        if (!parse_number(&s, &vals[n])) {
+            return -1;
+        }
+        n++;
+        if (*s == 0) {
+            return n;
+        }
+        if (*s != ',') {
+            return -1;
+        }
+        s++;
+    }
+    return -1;
+}
+
+// sends the M2M error response, or prints the message in interactive mode
+int cmd_error(const char *msg) {
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_ERR_CHAR);
+    } else {
+        COL_RED;
+        printf("%s\n", msg);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* --- commands ---
+each command is a handler in the command table (see commands[] below). A command token is its name,
+optionally followed by ':' and arguments, e.g. "readmem:0x50,0x10,4"; args points at the arguments,
+or is NULL if there are none. Handlers return a TOKEN_RESULT_ value */
+
+int cmd_device(char *args) {
+    printf("easy_adapter_%d\n\r", board_addr);
+    led_hold_off = 1;
+    // reset any state and variables
+    token_progress = TOKEN_PROGRESS_NONE;
+    expected_num = 0;
+    byte_buffer_index = 0;
+    do_repeated_start = 0;
+    do_batch = 0;
+    do_mem_write = 0;
+    mem_config(1, 0);
+    i2c_bus_sel = 0;
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_bin(char *args) {
+    // the reply is sent before switching, so it is still a plain character
+    if(m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        printf("Switching to binary mode\n");
+    }
+    input_mode = MODE_BIN;
+    m2m_resp = 1; // binary mode is only for machine use
+    frame_rx_reset(&frame_rx);
+    bin_escape_index = 0;
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_ascii(char *args) {
+    // the reply is sent before switching, so it is still a RESP frame
+    if(m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        printf("Switching to ASCII mode\n");
+    }
+    input_mode = MODE_ASCII;
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_bytes(char *args) {
+    uint32_t n;
+    // only writemem takes more than byte_buffer holds, the others check the count when they start
+    if ((parse_numbers(args, &n, 1) != 1) || (n > MEM_MAX_LEN)) {
+        expected_num = 0;
+        if (m2m_resp) {
+            m2m_respond(M2M_RESPONSE_ERR_CHAR);
+        } else {
+            COL_RED;
+            printf("Byte count must be between 0 and %d\n", MEM_MAX_LEN);
+            COL_RESET;
+        }
+        return TOKEN_RESULT_LINE_COMPLETE;
+    }
+    expected_num = n;
+    if(m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        printf("Expecting %d bytes\n", expected_num);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_send_hold(char *args) { // perform send, but hold the bus for a later repeated start
+    if (!check_send_count()) {
+        return TOKEN_RESULT_LINE_COMPLETE;
+    }
+    // consider remainder tokens on the line to be bytes for the send operation
+    byte_buffer_index = 0;
+    token_progress = TOKEN_PROGRESS_SEND;
+    do_repeated_start = 1;
+    do_batch = 0;
+    return TOKEN_RESULT_OK;
+}
+
+/* speed: (formats)
+- speed:400000        -> set the bus speed in Hz (1000 to 1000000)
+- speed               -> report the current bus speed
+in M2M mode the reply is the actual speed in decimal, followed by '.' */
+int cmd_speed(char *args) {
+    char speed_str[12];
+    uint32_t baud = 0;
+    if (args != NULL) {
+        if ((parse_numbers(args, &baud, 1) != 1) || (baud < I2C_BAUD_MIN) || (baud > I2C_BAUD_MAX)) {
+            if (m2m_resp) m2m_respond(M2M_RESPONSE_ERR_CHAR);
+            else { COL_RED; printf("Bus speed must be between %d and %d Hz\n", I2C_BAUD_MIN, I2C_BAUD_MAX); COL_RESET; }
+            return TOKEN_RESULT_LINE_COMPLETE;
+        }
+        i2c_set_speed(baud);
+    }
+    if (m2m_resp) {
+        sprintf(speed_str, "%lu", (unsigned long) i2c_baud_actual);
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) speed_str, strlen(speed_str));
+    } else {
+        COL_BLUE;
+        printf("I2C bus speed is %lu Hz (requested %lu Hz)\n", (unsigned long) i2c_baud_actual, (unsigned long) i2c_baud);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* scan: (formats)
+- scan                -> scan addresses 0x08 to 0x77
+- scan:0x03,0x7F      -> scan the given (inclusive) range
+in M2M mode the reply is a 16-byte bitmap, bit (addr % 8) of byte (addr / 8) set if present */
+int cmd_scan(char *args) {
+    uint32_t range[2] = {0x08, 0x77};
+    uint32_t val;
+    int found;
+    if (((args != NULL) && (parse_numbers(args, range, 2) != 2)) || (range[1] > 0x7F) || (range[0] > range[1])) {
+        return cmd_error("Invalid scan syntax");
+    }
+    found = i2c_scan(i2c_bus_sel, range[0], range[1], byte_buffer);
+    if (m2m_resp) {
+        print_read_m2m(0, byte_buffer, 16);
+    } else {
+        COL_BLUE;
+        for (val = range[0]; val <= range[1]; val++) {
+            if (byte_buffer[val / 8] & (1 << (val % 8))) {
+                printf("Device found at address 0x%02X\n", (unsigned int) val);
             }
         }
+        printf("%d device(s) found between 0x%02X and 0x%02X\n", found, (unsigned int) range[0], (unsigned int) range[1]);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_tryaddr(char *args) {
+    uint32_t val;
+    int retval;
+    if ((parse_numbers(args, &val, 1) != 1) || (val > 0x7F)) {
+        return cmd_error("Invalid I2C address");
+    }
+    retval = bitbang_i2c_addr(i2c_bus_sel, val);
+    if(m2m_resp) {
+        if (retval == 0) {
+            m2m_respond(M2M_RESPONSE_PROT_ERR_CHAR);
+        } else {
+            m2m_respond(M2M_RESPONSE_OK_CHAR);
+        }
+    } else {
+        if (retval == 0) {
+            COL_RED;
+            printf("Protocol error! Does the I2C device exist?\n");
+            COL_RESET;
+        } else {
+            COL_BLUE;
+            printf("Device found at address 0x%02X\n", (unsigned int) val);
+            COL_RESET;
+        }
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_iowrite(char *args) {
+    uint32_t v[2]; // port, level
+    if ((parse_numbers(args, v, 2) != 2) || !check_ioport_valid(v[0]) || (v[1] > 1)) {
+        return cmd_error("Error, invalid IO port or value");
+    }
+    io_write_port(v[0], v[1]);
+    if(m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        printf("Port %d set to output %d\n", (int) v[0], (int) v[1]);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_getiolvl(char *args) {
+    uint32_t ioport;
+    int ioval;
+    if ((parse_numbers(args, &ioport, 1) != 1) || !check_ioport_valid(ioport)) {
+        return cmd_error("Error, invalid IO port");
+    }
+    ioval = gpio_get_out_level(ioport);
+    if (m2m_resp) {
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) (ioval ? "1" : "0"), 1);
+    } else {
+        COL_BLUE;
+        printf("Port %d out level was %d\n", (int) ioport, ioval);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* io mask commands: (formats)
+each MASK selects GPIOs by bit (bit 6 for GPIO 6), and may only hold pins that ioread/iowrite accept
+- ioreadmask:MASK                  -> read the levels of the MASK pins, all at the same instant,
+                                      without reconfiguring them
+- iowritemask:MASK,VALUE           -> drive the MASK pins as outputs at the levels of the VALUE bits, at once
+- iocfgmask:MASK,OUT[,UP[,DOWN]]   -> make the MASK pins outputs (OUT bit 1) or inputs (OUT bit 0),
+                                      with a pull-up where the UP bit is set, a pull-down where DOWN is
+in M2M mode the reply to ioreadmask is the levels as 8 hex digits followed by '.' */
+int cmd_ioreadmask(char *args) {
+    uint32_t mask;
+    char levels_str[12];
+    if ((parse_numbers(args, &mask, 1) != 1) || !check_iomask_valid(mask)) {
+        return cmd_error("Error, invalid IO port mask");
+    }
+    sprintf(levels_str, "%08lx", (unsigned long) io_read_mask(mask));
+    if (m2m_resp) {
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) levels_str, 8);
+    } else {
+        COL_BLUE;
+        printf("Ports 0x%08lx read as 0x%s\n", (unsigned long) mask, levels_str);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_iowritemask(char *args) {
+    uint32_t v[2]; // mask, value
+    if ((parse_numbers(args, v, 2) != 2) || !check_iomask_valid(v[0])) {
+        return cmd_error("Error, invalid IO port mask");
+    }
+    io_write_mask(v[0], v[1]);
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        printf("Ports 0x%08lx set to output 0x%08lx\n", (unsigned long) v[0], (unsigned long) (v[1] & v[0]));
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_iocfgmask(char *args) {
+    uint32_t v[4] = {0, 0, 0, 0}; // mask, out, up, down
+    if ((parse_numbers(args, v, 4) < 2) || !check_iomask_valid(v[0])) {
+        return cmd_error("Error, invalid IO port mask");
+    }
+    io_config_mask(v[0], v[1], v[2], v[3]);
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        printf("Ports 0x%08lx configured, outputs 0x%08lx\n", (unsigned long) v[0], (unsigned long) (v[1] & v[0]));
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* memcfg: (formats)
+- memcfg:2,64         -> 2-byte register addresses; writemem split at 64-byte pages, with ACK polling
+- memcfg:1,0          -> 1-byte register addresses, not paged (the default, also set by device?)
+- memcfg              -> report the settings
+in M2M mode the reply to memcfg is "<regbytes>,<pagesize>" followed by '.' */
+int cmd_memcfg(char *args) {
+    char cfg_str[12];
+    uint32_t v[2]; // register address bytes, page size
+    if (args != NULL) {
+        if ((parse_numbers(args, v, 2) != 2) || (v[0] > 2) || (v[1] > 0xFFFF) || !mem_config(v[0], v[1])) {
+            return cmd_error("Invalid memcfg syntax");
+        }
+    }
+    if (m2m_resp) {
+        sprintf(cfg_str, "%d,%d", mem_reg_len, mem_page_size);
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) cfg_str, strlen(cfg_str));
+    } else {
+        COL_BLUE;
+        printf("Register address %d byte(s), page size %d\n", mem_reg_len, mem_page_size);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* readmem: (formats)
+- readmem:0x20,0x01,4   -> device 0x20, reg 0x01, length 4
+- readmem:0x01,4        -> use current i2c_addr, reg 0x01, length 4
+the register may be 16-bit and the length up to 65536 (see memcfg)
+*/
+int cmd_readmem(char *args) {
+    uint32_t v[3];
+    uint32_t a, r, l;
+    int n = parse_numbers(args, v, 3);
+    if (n == 2) {
+        // format: readmem:reg,len  -> use current i2c_addr
+        a = i2c_addr;
+        r = v[0];
+        l = v[1];
+    } else {
+        a = v[0];
+        r = v[1];
+        l = v[2];
+    }
+    if (((n != 2) && (n != 3)) || (a > 0x7F) || (l == 0) || (l > MEM_MAX_LEN) || !mem_reg_valid(r)) {
+        pipeline_drain();
+        return cmd_error("Invalid readmem syntax");
+    }
+    mem_read_start((uint8_t) a, (uint16_t) r, l);
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* writemem: (formats)
+- writemem:0x20,0x01   -> device 0x20, reg 0x01  (then send bytes via existing send flow: bytes:N + hex tokens)
+- writemem:0x01        -> use current i2c_addr, reg 0x01
+with a page size set by memcfg, the data is written a page at a time, polling for the write cycle to end
+実際の送信は既存の TOKEN_PROGRESS_SEND 処理にフックして行う（データは byte_buffer に蓄積される） */
+int cmd_writemem(char *args) {
+    uint32_t v[2];
+    uint32_t r;
+    int a;
+    int n = parse_numbers(args, v, 2);
+    if (n == 1) {
+        r = v[0];
+        a = -1; // use current i2c_addr
+    } else {
+        a = v[0];
+        r = v[1];
+    }
+    if (((n != 1) && (n != 2)) || ((n == 2) && (v[0] > 0x7F)) || (expected_num <= 0) || !mem_reg_valid(r)) {
+        return cmd_error("Invalid writemem syntax");
+    }
+    // caller must set bytes:N first to set expected_num, then provide bytes tokens on the line(s).
+    // more than 256 bytes are written as they arrive, a segment at a time (store_bytes)
+    mem_write_begin(a, (uint16_t) r);
+    // enter send mode to collect bytes (re-use the existing TOKEN_PROGRESS_SEND flow)
+    byte_buffer_index = 0;
+    token_progress = TOKEN_PROGRESS_SEND;
+    return TOKEN_RESULT_OK;
+}
+
+int cmd_ioread(char *args) {
+    // support optional parameter: ioread:<port> or ioread:<port>,pullup
+    const char *s = args;
+    uint32_t ioport;
+    int ioval;
+    int pullup = 0;
+    if (!parse_number(&s, &ioport) || !check_ioport_valid(ioport)) {
+        return cmd_error("Error, invalid IO port");
+    }
+    // Only enable internal pull-up if explicitly requested:
+    // e.g. "ioread:6,pullup"
+    if (*s == ',') {
+        pullup = (strcmp(s + 1, "pullup") == 0);
+    } else if (*s != 0) {
+        return cmd_error("Error, invalid IO port");
+    }
+    ioval = io_read_port(ioport, pullup);
+    if(m2m_resp) {
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) (ioval ? "1" : "0"), 1);
+    } else {
+        COL_BLUE;
+        printf("Port %d read input as %d\n", (int) ioport, ioval);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* stats: (formats)
+- stats               -> report the performance counters and timing histograms (see stats.h)
+- stats:reset         -> clear them
+in M2M mode the report is sent as hex data, like recv */
+int cmd_stats(char *args) {
+    if (args == NULL) {
+        send_stats_report();
+    } else if (strcmp(args, "reset") == 0) {
+        stats_reset(time_us_64());
+        if (m2m_resp) m2m_respond(M2M_RESPONSE_OK_CHAR);
+        else { COL_BLUE; printf("Statistics cleared\n"); COL_RESET; }
+    } else {
+        return cmd_error("Invalid stats syntax");
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* logic capture: (formats)
+- capture:14,2,1000000,4096        -> sample GPIO 14 and 15 (SDA and SCL) 4096 times at 1 MHz, starting now
+- capture:16,8,10000000,20000,14,4 -> sample GPIO 16 to 23 at 10 MHz, starting at a falling edge on GPIO 14
+the trigger types are 0 none, 1 high, 2 low, 3 rising edge, 4 falling edge. The capture runs in the
+background; the reply is the sample rate achieved (text data in M2M mode, like memcfg)
+- capstatus    -> report the state (0 idle, 1 armed, 2 running, 3 done), samples and bytes stored,
+                  as STATE,SAMPLES,BYTES text data in M2M mode
+- capstop      -> end the capture early, keeping the samples stored so far
+- capread      -> send the samples stored, packed as described in capture.h (hex data in M2M mode, like recv)
+- capread:0,64 -> send 64 bytes of them, from byte 0 */
+int cmd_capture(char *args) {
+    char reply[12];
+    uint32_t v[6]; // base, count, rate, samples, trigger pin, trigger type
+    uint32_t rate;
+    int n = parse_numbers(args, v, 6);
+    if ((n != 4) && (n != 6)) {
+        return cmd_error("Invalid capture syntax");
+    }
+    if (n == 4) {
+        v[4] = 0;
+        v[5] = CAPTURE_TRIG_NONE;
+    }
+    rate = ((v[0] > 0xFF) || (v[1] > 0xFF) || (v[4] > 0xFF) || (v[5] > 0xFF)) ? 0 :
+           capture_start(v[0], v[1], v[2], v[3], v[4], v[5]);
+    if (rate == 0) {
+        return cmd_error("Invalid capture pins, rate, length or trigger");
+    }
+    if (m2m_resp) {
+        sprintf(reply, "%lu", (unsigned long) rate);
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) reply, strlen(reply));
+    } else {
+        COL_BLUE;
+        printf("Capturing GPIO %d to %d at %lu Hz%s\n", (int) v[0], (int) (v[0] + v[1] - 1), (unsigned long) rate,
+               (v[5] == CAPTURE_TRIG_NONE) ? "" : ", waiting for the trigger");
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_capstatus(char *args) {
+    static const char *state_names[] = {"idle", "armed", "running", "done"};
+    char reply[32];
+    uint32_t samples, words;
+    int state = capture_poll(&samples, &words);
+    if (m2m_resp) {
+        sprintf(reply, "%d,%lu,%lu", state, (unsigned long) samples, (unsigned long) words * 4);
+        m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) reply, strlen(reply));
+    } else {
+        COL_BLUE;
+        printf("Capture %s, %lu samples (%lu bytes) stored\n", state_names[state], (unsigned long) samples,
+               (unsigned long) words * 4);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_capstop(char *args) {
+    capture_stop();
+    return cmd_capstatus(NULL);
+}
+
+int cmd_capread(char *args) {
+    uint32_t v[2]; // offset, length
+    uint32_t samples;
+    if (args == NULL) {
+        capture_poll(&samples, &v[1]);
+        v[0] = 0;
+        v[1] *= 4;
+    } else if (parse_numbers(args, v, 2) != 2) {
+        return cmd_error("Invalid capread syntax");
+    }
+    if ((v[1] == 0) || (v[0] > sizeof(capture_buf)) || (v[1] > sizeof(capture_buf) - v[0])) {
+        return cmd_error("Nothing captured, or beyond the capture buffer");
+    }
+    send_capture(v[0], v[1]);
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* stream: (formats)
+- stream:1000 0x48,0x00,2 0x50,0x10,6  -> every 1000 usec, read 2 bytes from register 0x00 of device 0x48
+                                         and 6 bytes from register 0x10 of device 0x50 (up to 8 items)
+- stream:stop                          -> stop streaming (any other command also stops it)
+after the response, each sample is sent as a line: index, timestamp in usec, then each item in hex
+('~' or 'T' instead if its read failed). See m2mframe.h for the binary mode records */
+int cmd_stream(char *args) {
+    if (strcmp(args, "stop") == 0) {
+        if (m2m_resp) m2m_respond(M2M_RESPONSE_OK_CHAR);
+        else { COL_BLUE; printf("Stream stopped\n"); COL_RESET; }
         return TOKEN_RESULT_LINE_COMPLETE;
     }
-    if (strncmp(token, "getiolvl:", 9) == 0) {
-        sscanf(token, "getiolvl:%d", &ioport);
-        port_valid = check_ioport_valid(ioport);
-        if (port_valid) {
-            ioval = gpio_get_out_level(ioport);
-            if (m2m_resp) {
-                if (ioval) {
-                    putchar('1');
-                } else {
-                    putchar('0');
-                }
-                putchar(M2M_RESPONSE_OK_CHAR);
-            } else {
-                COL_BLUE;
-                printf("Port %d out level was %d\n", ioport, ioval);
-                COL_RESET;
-            }
-        }
+    if (parse_numbers(args, &stream_period_us, 1) != 1) {
+        stream_period_us = 0; // reported as invalid at the end of the line
+    }
+    stream_items = 0;
+    // the items follow as tokens on the same line, the stream starts at the end of the line
+    token_progress = TOKEN_PROGRESS_STREAM;
+    return TOKEN_RESULT_OK;
+}
+
+/* batch: (format)
+- bytes:N then batch followed by the N script bytes in hex, like send (see m2mframe.h for the script)
+in M2M mode the reply is the per-step results as hex data, like recv */
+int cmd_batch(char *args) {
+    if (!check_send_count()) {
         return TOKEN_RESULT_LINE_COMPLETE;
     }
-    /* --- decode_token に追加するコマンド処理の一例 --- */
-    /* readmem: (formats)
-    - readmem:0x20,0x01,4   -> device 0x20, reg 0x01, length 4
-    - readmem:0x01,4        -> use current i2c_addr, reg 0x01, length 4
-    */
-    if (strncmp(token, "readmem:", 8) == 0) {
-        int a = 0, r = 0, l = 0;
-        int n = sscanf(token + 8, "%i,%i,%i", &a, &r, &l);
-        int target_dev;
-        int retval;
-        if (n == 3) {
-            target_dev = a;
-            mem_reg = (uint8_t) r;
-            int len = l;
-            retval = i2c_read_mem_addr((uint8_t)target_dev, mem_reg, byte_buffer, len);
-            if (m2m_resp) {
-                if (input_mode == MODE_ASCII) {
-                    if (retval == PICO_ERROR_GENERIC) {
-                        putchar(M2M_RESPONSE_PROT_ERR_CHAR);
-                    } else {
-                        print_buf_m2m_ascii(byte_buffer, len);
-                    }
-                } else {
-                    print_buf_m2m_bin(byte_buffer, len);
-                }
-            } else {
-                if (retval == PICO_ERROR_GENERIC) {
-                    COL_RED; printf("Protocol error reading bytes from mem!\n"); COL_RESET;
-                } else {
-                    print_buf_hex(byte_buffer, len);
-                }
-            }
-        } else if (n == 2) {
-            // format: readmem:reg,len  -> use current i2c_addr
-            target_dev = i2c_addr;
-            mem_reg = (uint8_t) a;
-            int len = r;
-            retval = i2c_read_mem_addr((uint8_t)target_dev, mem_reg, byte_buffer, len);
-            if (m2m_resp) {
-                if (input_mode == MODE_ASCII) {
-                    if (retval == PICO_ERROR_GENERIC) {
-                        putchar(M2M_RESPONSE_PROT_ERR_CHAR);
-                    } else {
-                        print_buf_m2m_ascii(byte_buffer, len);
-                    }
-                } else {
-                    print_buf_m2m_bin(byte_buffer, len);
-                }
-            } else {
-                if (retval == PICO_ERROR_GENERIC) {
-                    COL_RED; printf("Protocol error reading bytes from mem!\n"); COL_RESET;
-                } else {
-                    print_buf_hex(byte_buffer, len);
-                }
-            }
-        } else {
-            if (m2m_resp) putchar(M2M_RESPONSE_ERR_CHAR);
-            else { COL_RED; printf("Invalid readmem syntax\n"); COL_RESET; }
-        }
+    byte_buffer_index = 0;
+    token_progress = TOKEN_PROGRESS_SEND;
+    do_repeated_start = 0;
+    do_mem_write = 0;
+    do_batch = BATCH_PLAIN;
+    return TOKEN_RESULT_OK;
+}
+
+/* pattern: (format)
+- bytes:N then pattern followed by the N script bytes in hex, like batch. The script is played to a fixed
+  schedule, for GPIO sequences timed to the microsecond (see m2mframe.h)
+in M2M mode the reply is how late the pattern ran at most, in usec, as 4 bytes of hex data */
+int cmd_pattern(char *args) {
+    int res = cmd_batch(args);
+    if (res == TOKEN_RESULT_OK) {
+        do_batch = BATCH_PATTERN;
+    }
+    return res;
+}
+
+int cmd_send(char *args) {
+    if (!check_send_count()) {
         return TOKEN_RESULT_LINE_COMPLETE;
     }
+    // consider remainder tokens on the line to be bytes for the send operation
+    byte_buffer_index = 0;
+    token_progress = TOKEN_PROGRESS_SEND;
+    do_repeated_start = 0;
+    do_batch = 0;
+    return TOKEN_RESULT_OK;
+}
 
-    /* writemem: (formats)
-    - writemem:0x20,0x01   -> device 0x20, reg 0x01  (then send bytes via existing send flow: bytes:N + hex tokens)
-    - writemem:0x01        -> use current i2c_addr, reg 0x01
-    実際の送信は既存の TOKEN_PROGRESS_SEND 処理にフックして行う（データは byte_buffer に蓄積される） */
-    if (strncmp(token, "writemem:", 9) == 0) {
-        int a = 0, r = 0;
-        int n = sscanf(token + 9, "%i,%i", &a, &r);
-        if (n == 2) {
-            mem_dev_addr = a;
-            mem_reg = (uint8_t) r;
-        } else if (n == 1) {
-            mem_dev_addr = -1; // use current i2c_addr
-            mem_reg = (uint8_t) a;
-        } else {
-            if (m2m_resp) putchar(M2M_RESPONSE_ERR_CHAR);
-            else { COL_RED; printf("Invalid writemem syntax\n"); COL_RESET; }
-            return TOKEN_RESULT_LINE_COMPLETE;
-        }
-        // caller must set bytes:N first to set expected_num, then provide bytes tokens on the line(s).
-        do_mem_write = 1;
-        // enter send mode to collect bytes (re-use the existing TOKEN_PROGRESS_SEND flow)
-        byte_buffer_index = 0;
-        token_progress = TOKEN_PROGRESS_SEND;
-        do_repeated_start = 0; // for writemem we do a single write, no repeated start
-        return TOKEN_RESULT_OK;
+int cmd_recv(char *args) {
+    if (!check_send_count()) {
+        return TOKEN_RESULT_LINE_COMPLETE;
     }
+    byte_buffer_index = 0;
+    txn_begin(TXN_OP_READ, i2c_addr, expected_num);
+    txn_end();
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
 
-    /* --- TOKEN_PROGRESS_SEND ブロック（送信完了時に実際の書き込みを行う箇所）の修正例）---
-    現在の SEND 処理の中で、byte_buffer に expected_num バイト揃ったときに送っています。
-    その直前（"if (byte_buffer_index == expected_num) {" の箇所）に下記の分岐を追加します。 */
-    if (do_mem_write) {
-        int target = (mem_dev_addr == -1) ? i2c_addr : mem_dev_addr;
-        if (m2m_resp == 0) {
-            COL_BLUE; printf("Writemem: dev=0x%02X reg=0x%02X len=%d\n", target, mem_reg, expected_num); COL_RESET;
-            print_buf_hex(byte_buffer, expected_num);
-        }
-        retval = i2c_write_mem_addr((uint8_t)target, mem_reg, byte_buffer, expected_num);
-        // reset mem write flags
-        do_mem_write = 0;
-        mem_dev_addr = -1;
+int cmd_m2m_resp(char *args) {
+    if (args[0] == '1') {
+        m2m_resp = 1;
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        m2m_resp = 0;
+        printf("M2M response off\n");
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+// addr:0x50 or addr:80
+int cmd_addr(char *args) {
+    uint32_t val;
+    if ((parse_numbers(args, &val, 1) != 1) || (val > 0x7F)) {
+        return cmd_error("Invalid I2C address");
+    }
+    i2c_addr = val;
+    if(m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
     } else {
-        /* 既存の通常の i2c_write_blocking 処理（変更なし） */
-        if (do_repeated_start) {
-            retval = i2c_write_blocking(i2c_port, i2c_addr, byte_buffer, expected_num, true);
+        COL_BLUE;
+        printf("I2C address set to 0x%02X\n", i2c_addr);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* bus: (formats)
+- bus:2               -> the I2C commands that follow use bus 2 (it must have been set up with buscfg)
+- bus                 -> report the selected bus, and the pins of each bus
+bus 0 is selected at power-up, by device?, and when the selected bus is released.
+in M2M mode the reply to bus is "<bus>" followed by '.'. Selecting a bus is queued with the
+transactions, so those already queued on the previous bus carry on while the next bus starts */
+int cmd_bus(char *args) {
+    char bus_str[4];
+    uint32_t val;
+    uint8_t b;
+    if (args == NULL) {
+        pipeline_drain();
+        if (m2m_resp) {
+            sprintf(bus_str, "%d", i2c_bus_sel);
+            m2m_respond_data(M2M_RESPONSE_OK_CHAR, (const uint8_t *) bus_str, strlen(bus_str));
         } else {
-            retval = i2c_write_blocking(i2c_port, i2c_addr, byte_buffer, expected_num, false);
-        }
-    }
-
-    if (strncmp(token, "ioread:", 7) == 0) {
-        // support optional parameter: ioread:<port> or ioread:<port>,pullup
-        char opt[16] = {0};
-        // try parse with optional string after comma
-        if (sscanf(token, "ioread:%d,%15s", &ioport, opt) < 1) {
-            // fallback parsing
-            sscanf(token, "ioread:%d", &ioport);
-            opt[0] = '\0';
-        }
-        port_valid = check_ioport_valid(ioport);
-        if (port_valid) {
-            gpio_init(ioport);
-            gpio_set_dir(ioport, GPIO_IN);
-            // Only enable internal pull-up if explicitly requested:
-            // e.g. "ioread:6,pullup"
-            if (opt[0] != '\0' && strcmp(opt, "pullup") == 0) {
-                gpio_pull_up(ioport);
-            }
-            ioval = gpio_get(ioport);
-            if(m2m_resp) {
-                if (ioval) {
-                    putchar('1');
-                } else {
-                    putchar('0');
+            COL_BLUE;
+            for (b = 0; b < I2C_BUS_COUNT; b++) {
+                if (bus_type[b] != BUS_NONE) {
+                    printf("%c bus %d: %s, SDA GPIO %d, SCL GPIO %d\n", (b == i2c_bus_sel) ? '*' : ' ', b,
+                           (bus_type[b] == BUS_HW) ? "I2C controller" : "PIO", bus_sda[b], bus_scl[b]);
                 }
-                putchar(M2M_RESPONSE_OK_CHAR);
-            } else {
-                COL_BLUE;
-                printf("Port %d read input as %d\n", ioport, ioval);
-                COL_RESET;
-            }
-        } else {
-            if(m2m_resp) {
-                putchar(M2M_RESPONSE_ERR_CHAR);
-            } else {
-                COL_RED;
-                printf("Error, invalid IO port\n");
-                COL_RESET;
             }
+            COL_RESET;
         }
         return TOKEN_RESULT_LINE_COMPLETE;
     }
-    if (strcmp(token, "send") == 0) {
-        if (expected_num == 0) {
-            COL_RED;
-            printf("No bytes expected\n");
-            COL_RESET;
-            return TOKEN_RESULT_LINE_COMPLETE;
+    if ((parse_numbers(args, &val, 1) != 1) || (val >= I2C_BUS_COUNT) || (bus_type[val] == BUS_NONE)) {
+        pipeline_drain();
+        return cmd_error("Invalid or unconfigured I2C bus");
+    }
+    i2c_bus_sel = val;
+    txn_begin(TXN_OP_NOP, 0, 0);
+    txn_end();
+    if (m2m_resp == 0) {
+        COL_BLUE;
+        printf("I2C bus %d selected\n", i2c_bus_sel);
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* buscfg: (formats)
+- buscfg:1,4,5        -> bus 1 (the I2C0 controller) on SDA GPIO 4, SCL GPIO 5
+- buscfg:2,10,11      -> bus 2 (PIO) on SDA GPIO 10, SCL GPIO 11
+- buscfg:2            -> release bus 2, its pins become plain GPIOs again
+bus 0 is always on GPIO 14 and 15. The pins of a bus are not available to the io commands */
+int cmd_buscfg(char *args) {
+    uint32_t v[3]; // bus, SDA, SCL
+    int n = parse_numbers(args, v, 3);
+    if (((n != 1) && (n != 3)) || (v[0] >= I2C_BUS_COUNT) ||
+        ((n == 3) && ((v[1] >= BUS_PIN_NONE) || (v[2] >= BUS_PIN_NONE)))) {
+        return cmd_error("Invalid buscfg syntax");
+    }
+    if (n == 1) {
+        v[1] = BUS_PIN_NONE;
+        v[2] = BUS_PIN_NONE;
+    }
+    if (!bus_config(v[0], v[1], v[2])) {
+        return cmd_error("Invalid pins for the I2C bus");
+    }
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        if (n == 1) {
+            printf("I2C bus %lu released\n", (unsigned long) v[0]);
+        } else {
+            printf("I2C bus %lu on SDA GPIO %lu, SCL GPIO %lu\n", (unsigned long) v[0], (unsigned long) v[1],
+                   (unsigned long) v[2]);
         }
-        // consider remainder tokens on the line to be bytes for the send operation
-        byte_buffer_index = 0;
-        token_progress = TOKEN_PROGRESS_SEND;
-        do_repeated_start = 0;
-        return TOKEN_RESULT_OK;
+        COL_RESET;
     }
-    if (strcmp(token, "recv") == 0) {
-        if (expected_num == 0) {
-            COL_RED;
-            printf("No bytes expected\n");
-            COL_RESET;
-            return TOKEN_RESULT_LINE_COMPLETE;
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+/* colour: (formats)
+- colour:0            -> plain interactive output, with no colour escape sequences
+- colour:1            -> coloured output (the default) */
+int cmd_colour(char *args) {
+    if ((strcmp(args, "0") != 0) && (strcmp(args, "1") != 0)) {
+        return cmd_error("Invalid colour syntax");
+    }
+    use_colour = (args[0] == '1');
+    if (m2m_resp) {
+        m2m_respond(M2M_RESPONSE_OK_CHAR);
+    } else {
+        COL_BLUE;
+        printf("Colour %s\n", use_colour ? "on" : "off");
+        COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int cmd_noecho(char *args) {
+    do_echo = 0;
+    COL_BLUE;
+    printf("Echo off\n");
+    COL_RESET;
+    return TOKEN_RESULT_OK;
+}
+
+#define CMD_ARGS_NONE 0 // name only
+#define CMD_ARGS_REQUIRED 1 // name:args
+#define CMD_ARGS_OPTIONAL 2 // either
+
+typedef struct {
+    const char *name;
+    int (*handler)(char *args);
+    uint8_t args;
+    uint8_t pipelined; // only queues I2C transactions (or drains the queue itself when it must), so need
+                       // not wait for earlier ones to complete
+} command_t;
+
+// sorted by name (in strcmp order), for the binary search in find_command
+const command_t commands[] = {
+    {"addr", cmd_addr, CMD_ARGS_REQUIRED, 0},
+    {"ascii", cmd_ascii, CMD_ARGS_NONE, 0},
+    {"batch", cmd_batch, CMD_ARGS_NONE, 0},
+    {"bin", cmd_bin, CMD_ARGS_NONE, 0},
+    {"bus", cmd_bus, CMD_ARGS_OPTIONAL, 1},
+    {"buscfg", cmd_buscfg, CMD_ARGS_REQUIRED, 0},
+    {"bytes", cmd_bytes, CMD_ARGS_REQUIRED, 0},
+    {"capread", cmd_capread, CMD_ARGS_OPTIONAL, 0},
+    {"capstatus", cmd_capstatus, CMD_ARGS_NONE, 0},
+    {"capstop", cmd_capstop, CMD_ARGS_NONE, 0},
+    {"capture", cmd_capture, CMD_ARGS_REQUIRED, 0},
+    {"colour", cmd_colour, CMD_ARGS_REQUIRED, 0},
+    {"device?", cmd_device, CMD_ARGS_NONE, 0},
+    {"getiolvl", cmd_getiolvl, CMD_ARGS_REQUIRED, 0},
+    {"iocfgmask", cmd_iocfgmask, CMD_ARGS_REQUIRED, 0},
+    {"ioread", cmd_ioread, CMD_ARGS_REQUIRED, 0},
+    {"ioreadmask", cmd_ioreadmask, CMD_ARGS_REQUIRED, 0},
+    {"iowrite", cmd_iowrite, CMD_ARGS_REQUIRED, 0},
+    {"iowritemask", cmd_iowritemask, CMD_ARGS_REQUIRED, 0},
+    {"m2m_resp", cmd_m2m_resp, CMD_ARGS_REQUIRED, 0},
+    {"memcfg", cmd_memcfg, CMD_ARGS_OPTIONAL, 0},
+    {"noecho", cmd_noecho, CMD_ARGS_NONE, 0},
+    {"pattern", cmd_pattern, CMD_ARGS_NONE, 0},
+    {"readmem", cmd_readmem, CMD_ARGS_REQUIRED, 1},
+    {"recv", cmd_recv, CMD_ARGS_NONE, 1},
+    {"scan", cmd_scan, CMD_ARGS_OPTIONAL, 0},
+    {"send", cmd_send, CMD_ARGS_NONE, 0},
+    {"send+hold", cmd_send_hold, CMD_ARGS_NONE, 0},
+    {"speed", cmd_speed, CMD_ARGS_OPTIONAL, 0},
+    {"stats", cmd_stats, CMD_ARGS_OPTIONAL, 0},
+    {"stream", cmd_stream, CMD_ARGS_REQUIRED, 0},
+    {"tryaddr", cmd_tryaddr, CMD_ARGS_REQUIRED, 0},
+    {"writemem", cmd_writemem, CMD_ARGS_REQUIRED, 0},
+};
+
+// looks up the command token, and points *args at its arguments (NULL if there are none)
+// returns NULL if it is not a command, or has arguments it should not have (or the reverse)
+const command_t *find_command(char *token, char **args) {
+    char *colon = strchr(token, ':');
+    size_t len = (colon != NULL) ? (size_t) (colon - token) : strlen(token);
+    int lo = 0;
+    int hi = (int) (sizeof(commands) / sizeof(commands[0])) - 1;
+    int mid, cmp;
+    const command_t *c;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = &commands[mid];
+        cmp = strncmp(token, c->name, len);
+        if ((cmp == 0) && (c->name[len] != 0)) {
+            cmp = -1; // the token is a prefix of the name, so sorts before it
         }
-        byte_buffer_index = 0;
-        retval = i2c_read_blocking(i2c_port, i2c_addr, byte_buffer, expected_num, false);
-        if(m2m_resp) {
-            if (input_mode == MODE_ASCII) {
-                if (retval == PICO_ERROR_GENERIC) {
-                    putchar(M2M_RESPONSE_PROT_ERR_CHAR);
-                } else {
-                    print_buf_m2m_ascii(byte_buffer, expected_num);
-                }
-            } else {
-                print_buf_m2m_bin(byte_buffer, expected_num);
+        if (cmp == 0) {
+            *args = (colon != NULL) ? colon + 1 : NULL;
+            if (((colon == NULL) && (c->args == CMD_ARGS_REQUIRED)) ||
+                ((colon != NULL) && (c->args == CMD_ARGS_NONE))) {
+                return NULL;
             }
+            return c;
+        }
+        if (cmp < 0) {
+            hi = mid - 1;
         } else {
-            if (retval == PICO_ERROR_GENERIC) {
-                COL_RED;
-                printf("Protocol error reading bytes! Does the I2C device exist?\n");
-                COL_RESET;
-            } else {
-                print_buf_hex(byte_buffer, expected_num);
-            }
+            lo = mid + 1;
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
     }
-    if (strncmp(token, "m2m_resp:", 9) == 0) {
-        if (token[9] == '1') {
-            m2m_resp = 1;
-            putchar(M2M_RESPONSE_OK_CHAR);
-        } else {
-            m2m_resp = 0;
-            printf("M2M response off\n");
+    return NULL;
+}
+
+// ends a command line: a send that is still expecting bytes asks for the next line,
+// and a stream command starts streaming
+int decode_line_end(void) {
+    if (token_progress == TOKEN_PROGRESS_STREAM) {
+        token_progress = TOKEN_PROGRESS_NONE;
+        if ((stream_items == 0) || (stream_period_us < STREAM_MIN_PERIOD_US)) {
+            return cmd_error("Invalid stream syntax");
         }
+        if (m2m_resp) m2m_respond(M2M_RESPONSE_OK_CHAR);
+        else { COL_BLUE; printf("Streaming, enter any command to stop\n"); COL_RESET; }
+        stream_start();
         return TOKEN_RESULT_LINE_COMPLETE;
     }
-    if (strncmp(token, "addr:0x", 7) == 0) {
-        // get i2c_addr
-        sscanf(token, "addr:0x%02X", &val);
-        i2c_addr = val;
-        if(m2m_resp) {
-            putchar(M2M_RESPONSE_OK_CHAR);
+    if (token_progress == TOKEN_PROGRESS_SEND) {
+        // we are still expecting more bytes, on the next line
+        if (input_mode == MODE_BIN) {
+            // grant the host credit to stream the bytes as DATA frames
+            rx_data_seq = 0;
+            rx_nak_sent = 0;
+            frame_send2(FRAME_ACK, 0xFF, FRAME_WINDOW, NULL, 0);
+        } else if (m2m_resp) {
+            m2m_respond(M2M_RESPONSE_CONTINUE_CHAR);
         } else {
             COL_BLUE;
-            printf("I2C address set to 0x%02X\n", i2c_addr);
+            printf("Remaining bytes expected: %lu\n", (unsigned long) (expected_num - mem_offset - byte_buffer_index));
             COL_RESET;
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
-    } else if (strncmp(token, "addr:", 5) == 0) {
-        // get i2c_addr in decimal
-        sscanf(token, "addr:%d", &val);
-        i2c_addr = val;
-        if(m2m_resp) {
-            putchar(M2M_RESPONSE_OK_CHAR);
-        } else {
-            COL_BLUE;
-            printf("I2C address set to 0x%02X\n", i2c_addr);
-            COL_RESET;
+    }
+    return TOKEN_RESULT_LINE_COMPLETE;
+}
+
+int decode_token(char *token) {
+    const command_t *c;
+    char *args;
+    uint32_t v[3];
+    int hi, lo;
+    uint8_t byte;
+    // the bytes of a send are by far the most common tokens, so they are handled first
+    if ((token_progress == TOKEN_PROGRESS_SEND) && (token[0] != 0) && (token[1] != 0) && (token[2] == 0)) {
+        hi = hex_value(token[0]);
+        lo = hex_value(token[1]);
+        if ((hi < 0) || (lo < 0)) {
+            return cmd_error("Invalid byte");
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
+        byte = (uint8_t) ((hi << 4) | lo);
+        if (store_bytes(&byte, 1)) {
+            // send the bytes
+            complete_send();
+            return TOKEN_RESULT_LINE_COMPLETE;
+        }
+        return TOKEN_RESULT_OK; // continue reading tokens on the send line
     }
-    if (strcmp(token, "noecho") == 0) {
-        do_echo = 0;
-        COL_BLUE;
-        printf("Echo off\n");
-        COL_RESET;
-        return 0;
+    c = find_command(token, &args);
+    if ((c == NULL) || !c->pipelined) {
+        pipeline_drain();
     }
-    if (strcmp(token, "end_tok") == 0) {
-        if (token_progress == TOKEN_PROGRESS_SEND) {
-            // we are still expecting more bytes, on the next line
-            if (m2m_resp) {
-                putchar(M2M_RESPONSE_CONTINUE_CHAR);
-            } else {
-                COL_BLUE;
-                printf("Remaining bytes expected: %d\n", expected_num - byte_buffer_index);
-                COL_RESET;
-            }
+    if (c != NULL) {
+        return c->handler(args);
+    }
+    if (token_progress == TOKEN_PROGRESS_STREAM) {
+        if ((parse_numbers(token, v, 3) != 3) || (v[0] > 0x7F) || (v[1] > 0xFF) || (v[2] > 255) ||
+            !stream_add_item(v[0], v[1], v[2])) {
+            stream_period_us = 0; // reported as invalid at the end of the line
         }
-        return TOKEN_RESULT_LINE_COMPLETE;
+        return TOKEN_RESULT_OK;
     }
     if (token_progress == TOKEN_PROGRESS_SEND) {
-        if (strlen(token) != 2) {
+        if (m2m_resp) {
+            m2m_respond(M2M_RESPONSE_ERR_CHAR);
+        } else {
             COL_RED;
             printf("Invalid byte: %s\n", token);
             COL_RESET;
-            return TOKEN_RESULT_LINE_COMPLETE;
-        }
-        sscanf(token, "%02X", &val);
-        byte_buffer[byte_buffer_index] = val;
-        byte_buffer_index++;
-        if (byte_buffer_index == expected_num) {
-            // send the bytes
-            if (m2m_resp==0) {
-                COL_BLUE;
-                printf("Sending %d bytes\n", expected_num);
-                COL_RESET;
-                print_buf_hex(byte_buffer, expected_num);
-            }
-            if (do_repeated_start) {
-                retval = i2c_write_blocking(i2c_port, i2c_addr, byte_buffer, expected_num, true);
-            } else {
-                retval = i2c_write_blocking(i2c_port, i2c_addr, byte_buffer, expected_num, false);
-            }
-            byte_buffer_index = 0;
-            expected_num = 0;
-            do_repeated_start = 0;
-            token_progress = TOKEN_PROGRESS_NONE;
-            if (retval == PICO_ERROR_GENERIC) {
-                if (m2m_resp) {
-                    putchar(M2M_RESPONSE_PROT_ERR_CHAR);
-                } else {
-                    COL_RED;
-                    printf("Protocol error sending bytes! Does the I2C device exist?\n");
-                    COL_RESET;
-                }
-                return TOKEN_RESULT_LINE_COMPLETE;
-            }
-            if (m2m_resp) {
-                putchar(M2M_RESPONSE_OK_CHAR);
-            }
-            return TOKEN_RESULT_LINE_COMPLETE;
         }
-        return TOKEN_RESULT_OK; // continue reading tokens on the send line
+        return TOKEN_RESULT_LINE_COMPLETE;
     }
     // done
     if (m2m_resp) {
-        putchar(M2M_RESPONSE_ERR_CHAR);
+        m2m_respond(M2M_RESPONSE_ERR_CHAR);
         return TOKEN_RESULT_LINE_COMPLETE;
     } else {
         COL_RED;
@@ -808,36 +2983,71 @@ int decode_token(char *token) {
 }
 
 // if in ASCII mode, parse each space-separated token
+// the tokens are split in place, by replacing each space in buf with a terminating 0
 int process_line(uint8_t *buf, uint16_t len) {
     int res;
-    char token[20];
-    uint16_t i = 0;
-    uint16_t j = 0;
+    uint16_t i;
+    uint16_t start = 0;
     if (len == 0) {
         return TOKEN_RESULT_ERROR;
     }
-    while (i < len) {
-        if (buf[i] == ' ') {
-            token[j] = 0;
-            //printf("token: %s\n", token);
-            res = decode_token(token);
+    for (i = 0; i < len; i++) {
+        if (buf[i] != ' ') {
+            continue;
+        }
+        buf[i] = 0;
+        if (i > start) {
+            res = decode_token((char *) &buf[start]);
             if (res == TOKEN_RESULT_LINE_COMPLETE) {
                 return TOKEN_RESULT_LINE_COMPLETE;
             }
-            j = 0;
+        }
+        start = i + 1;
+    }
+    // the line always ends with a space (see scan_uart_char), anything after the last one is dropped
+    return decode_line_end();
+}
+
+// LED timer: briefly flashes the LED every 30 ticks normally, or holds it off (after device?)
+// or on for LED_HOLD_TICKS
+bool led_timer_callback(repeating_timer_t *rt) {
+    if (led_hold_off) {
+        if (led_counter == 0) {
+            led_counter = LED_HOLD_TICKS;
+            led_ctrl(0);
+        }
+        led_counter--;
+        if (led_counter == 0) {
+            led_hold_off = 0;
+        }
+    } else if (led_hold_on) {
+        if (led_counter == 0) {
+            led_counter = LED_HOLD_TICKS;
+            led_ctrl(1);
+        }
+        led_counter--;
+        if (led_counter == 0) {
+            led_hold_on = 0;
+        }
+    } else {
+        if (led_counter_default<=0) {
+            led_ctrl(1);    // turn LED on
+            led_counter_default = 30;
         } else {
-            token[j] = buf[i];
-            j++;
+            led_counter_default--;
+            if (led_counter_default==28) {
+                led_ctrl(0);    // turn LED off
+            }
         }
-        i++;
     }
-    res = decode_token("end_tok");
+    return true; // keep repeating
 }
 
 int
 main(void)
 {
     int numbytes;
+    uint32_t start;
     stdio_init_all();
     sleep_ms(100);
     board_addr = get_board_address();
@@ -845,44 +3055,27 @@ main(void)
     led_setup(); // initialize LED pin to be an output
     i2c_setup(); // configures the I2C pins accordingly
 
+    // the LED is driven from a timer, so that blinking never holds up command processing
+    add_repeating_timer_ms(LED_TICK_MS, led_timer_callback, NULL, &led_timer);
+
+    // I2C transactions run on core1, while core0 keeps servicing USB
+    txn_queue_init(&txn_queue);
+    txn_engine_init(&txn_engine, i2c_buses, I2C_BUS_COUNT);
+    stats_reset(time_us_64());
+    multicore_launch_core1(core1_main);
+
     while (1) {
+        rx_fill();
+        txn_poll();
+        stream_poll();
         numbytes = scan_uart_input();
         if (numbytes > 0) {
+            stream_stop(); // any command ends a stream
+            stats_inc(STAT_LINES);
+            start = parse_clock();
             process_line(uart_buffer, numbytes);
+            stats_record(STAT_HIST_PARSE, parse_clock() - start);
         }
-
-        if (led_hold_off) {
-            if (led_counter <= 0) {
-                led_counter = 20;
-                led_ctrl(0);
-            }
-            led_counter--;
-            sleep_ms(20);
-            if (led_counter == 0) {
-                led_hold_off = 0;
-            }
-        } else if (led_hold_on) {
-            if (led_counter <= 0) {
-                led_counter = 20;
-                led_ctrl(1);
-            }
-            led_counter--;
-            sleep_ms(20);
-            if (led_counter == 0) {
-                led_hold_on = 0;
-            }
-        } else {
-            if (led_counter_default<=0) {
-                led_ctrl(1);    // turn LED on
-                led_counter_default = 30;
-            } else {
-                led_counter_default--;
-                if (led_counter_default==28) {
-                    led_ctrl(0);    // turn LED off
-                }
-            }
-        }
-        sleep_ms(1);
     }
 }
 
@@ -0,0 +1,247 @@
+/****************************************
+ * pioi2c.c
+ * non-blocking I2C master transfers on a PIO state machine (pioi2c.pio), fed by DMA
+ * a transfer is built as a list of state machine words (start, address, data, stop), which one DMA
+ * channel writes to the TX FIFO while another takes each byte sampled from the RX FIFO. A NAK
+ * stops the state machine with its IRQ flag set, and the end of the transfer is the state machine
+ * stalling on the empty TX FIFO
+ * **************************************/
+
+#include "pioi2c.h"
+#include <string.h>
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "pioi2c.pio.h"
+
+#define PIO_I2C_PIO pio1 // pio0 is the logic capture's
+#define PIO_I2C_ICOUNT_LSB 10
+#define PIO_I2C_FINAL_LSB 9
+#define PIO_I2C_DATA_LSB 1
+#define PIO_I2C_NAK_LSB 0
+
+static int prog_offset = -1; // the program is shared by every state machine
+
+bool
+pio_i2c_init(pio_i2c_t *d, uint8_t sda, uint32_t baud)
+{
+    pio_sm_config c;
+    int sm;
+    if (!d->claimed) {
+        if ((sm = pio_claim_unused_sm(PIO_I2C_PIO, false)) < 0) {
+            return false;
+        }
+        if (prog_offset < 0) {
+            prog_offset = pio_add_program(PIO_I2C_PIO, &i2c_program);
+        }
+        d->sm = (uint8_t) sm;
+        d->tx_chan = dma_claim_unused_channel(true);
+        d->rx_chan = dma_claim_unused_channel(true);
+        d->claimed = true;
+    }
+    d->sda = sda;
+    d->len = 0;
+    d->restart_on_next = false;
+    pio_sm_set_enabled(PIO_I2C_PIO, d->sm, false);
+    c = i2c_program_get_default_config(prog_offset);
+    sm_config_set_out_pins(&c, sda, 1);
+    sm_config_set_set_pins(&c, sda, 1);
+    sm_config_set_in_pins(&c, sda);
+    sm_config_set_sideset_pins(&c, sda + 1);
+    sm_config_set_jmp_pin(&c, sda);
+    sm_config_set_out_shift(&c, false, true, 16);
+    sm_config_set_in_shift(&c, false, true, 8);
+    // the IRQ flag only marks a NAK, it is polled rather than raising an interrupt
+    pio_set_irq0_source_enabled(PIO_I2C_PIO, (enum pio_interrupt_source) (pis_interrupt0 + d->sm), false);
+    pio_set_irq1_source_enabled(PIO_I2C_PIO, (enum pio_interrupt_source) (pis_interrupt0 + d->sm), false);
+    pio_sm_init(PIO_I2C_PIO, d->sm, prog_offset + i2c_offset_entry_point, &c);
+    pio_i2c_set_baudrate(d, baud);
+    return true;
+}
+
+void
+pio_i2c_deinit(pio_i2c_t *d)
+{
+    if (d->claimed) {
+        pio_sm_set_enabled(PIO_I2C_PIO, d->sm, false);
+        dma_channel_abort(d->tx_chan);
+        dma_channel_abort(d->rx_chan);
+    }
+}
+
+// a bit takes 32 state machine clocks
+uint32_t
+pio_i2c_set_baudrate(pio_i2c_t *d, uint32_t baud)
+{
+    uint64_t sys = clock_get_hz(clk_sys);
+    uint32_t div = (uint32_t) ((sys * 256 + 16 * baud) / (32 * (uint64_t) baud)); // in 1/256ths
+    if (div < 0x100) {
+        div = 0x100;
+    } else if (div > 0xFFFFFF) {
+        div = 0xFFFFFF;
+    }
+    pio_sm_set_clkdiv_int_frac(PIO_I2C_PIO, d->sm, div >> 8, div & 0xFF);
+    return (uint32_t) ((sys * 256) / (32 * (uint64_t) div));
+}
+
+void
+pio_i2c_reset(pio_i2c_t *d)
+{
+    uint32_t both = (1u << d->sda) | (1u << (d->sda + 1));
+    pio_sm_set_enabled(PIO_I2C_PIO, d->sm, false);
+    dma_channel_abort(d->tx_chan);
+    dma_channel_abort(d->rx_chan);
+    pio_sm_clear_fifos(PIO_I2C_PIO, d->sm);
+    pio_sm_restart(PIO_I2C_PIO, d->sm);
+    // both lines released (pulled up) while they are connected, so the bus does not glitch
+    gpio_pull_up(d->sda);
+    gpio_pull_up(d->sda + 1);
+    pio_sm_set_pins_with_mask(PIO_I2C_PIO, d->sm, both, both);
+    pio_sm_set_pindirs_with_mask(PIO_I2C_PIO, d->sm, both, both);
+    pio_gpio_init(PIO_I2C_PIO, d->sda);
+    gpio_set_oeover(d->sda, GPIO_OVERRIDE_INVERT);
+    pio_gpio_init(PIO_I2C_PIO, d->sda + 1);
+    gpio_set_oeover(d->sda + 1, GPIO_OVERRIDE_INVERT);
+    pio_sm_set_pins_with_mask(PIO_I2C_PIO, d->sm, 0, both);
+    pio_sm_exec(PIO_I2C_PIO, d->sm, pio_encode_jmp(prog_offset + i2c_offset_entry_point));
+    pio_interrupt_clear(PIO_I2C_PIO, d->sm);
+    pio_sm_set_enabled(PIO_I2C_PIO, d->sm, true);
+    d->restart_on_next = false;
+    d->len = 0;
+}
+
+// appends the stop sequence to the words at w, returns the number of words
+static size_t
+put_stop(uint16_t *w)
+{
+    w[0] = 2u << PIO_I2C_ICOUNT_LSB;
+    w[1] = set_scl_sda_program_instructions[I2C_SC0_SD0]; // SDA may be high, pull it down
+    w[2] = set_scl_sda_program_instructions[I2C_SC1_SD0]; // release SCL
+    w[3] = set_scl_sda_program_instructions[I2C_SC1_SD1]; // then SDA, back to idle
+    return 4;
+}
+
+static int
+pio_i2c_start(pio_i2c_t *d, uint8_t addr, const uint8_t *src, uint8_t *dst, size_t len, bool nostop,
+              uint32_t timeout_us)
+{
+    dma_channel_config c;
+    size_t i;
+    size_t n = 0;
+    if ((len == 0) || (len > I2C_DMA_MAX_LEN) || !d->claimed) {
+        return PICO_ERROR_GENERIC;
+    }
+    if (d->restart_on_next) {
+        d->cmd[n++] = 3u << PIO_I2C_ICOUNT_LSB;
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC0_SD1];
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC1_SD1];
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC1_SD0];
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC0_SD0];
+    } else {
+        d->cmd[n++] = 1u << PIO_I2C_ICOUNT_LSB;
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC1_SD0];
+        d->cmd[n++] = set_scl_sda_program_instructions[I2C_SC0_SD0];
+    }
+    // the NAK bit set releases SDA for the device's ACK
+    d->cmd[n++] = (addr << 2) | ((dst != NULL) ? 3u : 1u);
+    for (i = 0; i < len; i++) {
+        if (dst != NULL) {
+            // all ones, so SDA is released for the device's data. The last byte is NAKed, as it should be
+            d->cmd[n++] = (0xFFu << PIO_I2C_DATA_LSB) |
+                          ((i == len - 1) ? ((1u << PIO_I2C_FINAL_LSB) | (1u << PIO_I2C_NAK_LSB)) : 0);
+        } else {
+            d->cmd[n++] = (src[i] << PIO_I2C_DATA_LSB) | (1u << PIO_I2C_NAK_LSB);
+        }
+    }
+    if (!nostop) {
+        n += put_stop(&d->cmd[n]);
+    }
+    d->dst = dst;
+    d->len = len;
+    d->reading = (dst != NULL);
+    d->restart_on_next = nostop;
+    d->draining = false;
+    d->deadline = make_timeout_time_us(timeout_us);
+
+    // the FIFOs are not cleared, they may still hold the stop after a NAK. Every byte is sampled, the address too; for a write they are all dropped in rx[0]
+    c = dma_channel_get_default_config(d->rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, d->reading);
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_I2C_PIO, d->sm, false));
+    dma_channel_configure(d->rx_chan, &c, d->rx, &PIO_I2C_PIO->rxf[d->sm], len + 1, true);
+    c = dma_channel_get_default_config(d->tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_I2C_PIO, d->sm, true));
+    dma_channel_configure(d->tx_chan, &c, &PIO_I2C_PIO->txf[d->sm], d->cmd, n, true);
+    return 0;
+}
+
+int
+pio_i2c_start_write(pio_i2c_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return pio_i2c_start(d, addr, src, NULL, len, nostop, timeout_us);
+}
+
+int
+pio_i2c_start_read(pio_i2c_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us)
+{
+    return pio_i2c_start(d, addr, NULL, dst, len, nostop, timeout_us);
+}
+
+int
+pio_i2c_poll(pio_i2c_t *d)
+{
+    uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + d->sm);
+    uint16_t stop[4];
+    size_t i;
+    if (d->len == 0) {
+        return PICO_ERROR_GENERIC;
+    }
+    if (pio_interrupt_get(PIO_I2C_PIO, d->sm)) {
+        // not acknowledged: drop the rest of the transfer, carry on from the entry point, and end
+        // with a stop. The stop runs while the caller handles the error
+        dma_channel_abort(d->tx_chan);
+        dma_channel_abort(d->rx_chan);
+        pio_sm_drain_tx_fifo(PIO_I2C_PIO, d->sm);
+        pio_sm_clear_fifos(PIO_I2C_PIO, d->sm);
+        pio_sm_exec(PIO_I2C_PIO, d->sm, pio_encode_jmp(prog_offset + i2c_offset_entry_point));
+        pio_interrupt_clear(PIO_I2C_PIO, d->sm);
+        put_stop(stop);
+        for (i = 0; i < 4; i++) {
+            pio_sm_put(PIO_I2C_PIO, d->sm, (uint32_t) stop[i] << 16);
+        }
+        d->restart_on_next = false;
+        d->len = 0;
+        return PICO_ERROR_GENERIC;
+    }
+    if (time_reached(d->deadline)) {
+        dma_channel_abort(d->tx_chan);
+        dma_channel_abort(d->rx_chan);
+        d->restart_on_next = false;
+        d->len = 0;
+        return PICO_ERROR_TIMEOUT;
+    }
+    if (dma_channel_is_busy(d->tx_chan) || dma_channel_is_busy(d->rx_chan) ||
+        !pio_sm_is_tx_fifo_empty(PIO_I2C_PIO, d->sm)) {
+        return I2C_DMA_BUSY;
+    }
+    // the last words are in the state machine: it is done once it stalls waiting for more. The
+    // stall flag is set for as long as the state machine is stalled, so it is cleared once first
+    if (!d->draining) {
+        d->draining = true;
+        PIO_I2C_PIO->fdebug = stall;
+        return I2C_DMA_BUSY;
+    }
+    if (!(PIO_I2C_PIO->fdebug & stall)) {
+        return I2C_DMA_BUSY;
+    }
+    if (d->reading) {
+        memcpy(d->dst, &d->rx[1], d->len);
+    }
+    i = d->len;
+    d->len = 0;
+    return (int) i;
+}
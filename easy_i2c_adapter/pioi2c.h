@@ -0,0 +1,46 @@
+#ifndef _PIOI2C_HEADER_FILE_
+#define _PIOI2C_HEADER_FILE_
+
+/***********************************
+ * pioi2c.h
+ * non-blocking I2C master transfers on a PIO state machine, fed by DMA,
+ * for buses beyond the two I2C controllers. Same calls and results as i2cdma.h
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "i2cdma.h"
+
+// a start or repeated start (up to 5 words), the address, the data and a stop (4 words)
+#define PIO_I2C_MAX_WORDS (I2C_DMA_MAX_LEN + 10)
+
+typedef struct {
+    bool claimed; // the state machine and DMA channels, claimed by the first pio_i2c_init
+    uint8_t sm;
+    uint8_t sda; // SCL is the next GPIO
+    int tx_chan;
+    int rx_chan;
+    uint16_t cmd[PIO_I2C_MAX_WORDS]; // state machine words: instruction sequences and data bytes
+    uint8_t rx[I2C_DMA_MAX_LEN + 1]; // a byte is sampled for every byte on the bus, the address too
+    uint8_t *dst;
+    size_t len;
+    bool reading;
+    bool restart_on_next; // the previous transfer ended without a stop
+    bool draining;        // the DMA is done, waiting for the state machine to finish the last byte
+    absolute_time_t deadline;
+} pio_i2c_t;
+
+// sets the state machine up for SDA on GPIO sda and SCL on sda + 1, at baud Hz. The pins are taken
+// over by pio_i2c_reset. returns false if there is no free state machine
+bool pio_i2c_init(pio_i2c_t *d, uint8_t sda, uint32_t baud);
+void pio_i2c_deinit(pio_i2c_t *d); // stops the state machine, the pins are left as they are
+uint32_t pio_i2c_set_baudrate(pio_i2c_t *d, uint32_t baud); // returns the speed achieved
+// connects the pins to the state machine and restarts it with the bus idle, also after a timeout
+void pio_i2c_reset(pio_i2c_t *d);
+int pio_i2c_start_write(pio_i2c_t *d, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint32_t timeout_us);
+int pio_i2c_start_read(pio_i2c_t *d, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint32_t timeout_us);
+int pio_i2c_poll(pio_i2c_t *d); // as i2c_dma_poll
+
+#endif // _PIOI2C_HEADER_FILE_
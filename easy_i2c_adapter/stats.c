@@ -0,0 +1,76 @@
+/****************************************
+ * stats.c
+ * performance counters and timing histograms
+ * no Pico SDK dependencies, so that it can also be built as host code
+ * **************************************/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "stats.h"
+
+stats_t stats;
+
+static const char *counter_names[STAT_COUNTERS] = {
+    "lines", "frames", "errors", "i2c_writes", "i2c_reads", "i2c_tx_bytes", "i2c_rx_bytes",
+    "i2c_naks", "i2c_timeouts", "ack_polls", "host_waits", "host_resends", "crc_errors", "usb_rx_bytes"
+};
+
+static const char *hist_names[STAT_HISTS] = {
+    "parse", "bus", "output", "host_wait", "stall"
+};
+
+void
+stats_reset(uint64_t now)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.since = now;
+}
+
+// appends to buf at *pos, never beyond size; the report is cut short if it does not fit
+static void __attribute__((format(printf, 4, 5)))
+append(char *buf, int size, int *pos, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+    if (*pos >= size - 1) {
+        return;
+    }
+    va_start(args, fmt);
+    n = vsnprintf(&buf[*pos], size - *pos, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        *pos += n;
+        if (*pos > size - 1) {
+            *pos = size - 1;
+        }
+    }
+}
+
+// one line per item:
+// "time <usec since reset>", "<counter> <value>" for each counter, then for each histogram
+// "hist <name> <count> <total usec> <max usec>" followed by "<bucket>:<count>" for the non-empty buckets
+int
+stats_format(char *buf, int size, uint64_t now)
+{
+    int pos = 0;
+    int i, b;
+    const stats_hist_t *h;
+    buf[0] = 0;
+    append(buf, size, &pos, "time %llu\n", (unsigned long long) (now - stats.since));
+    for (i = 0; i < STAT_COUNTERS; i++) {
+        append(buf, size, &pos, "%s %lu\n", counter_names[i], (unsigned long) stats.counter[i]);
+    }
+    for (i = 0; i < STAT_HISTS; i++) {
+        h = &stats.hist[i];
+        append(buf, size, &pos, "hist %s %lu %llu %lu", hist_names[i], (unsigned long) h->count,
+               (unsigned long long) h->total, (unsigned long) h->max);
+        for (b = 0; b < STATS_BUCKETS; b++) {
+            if (h->bucket[b] != 0) {
+                append(buf, size, &pos, " %d:%lu", b, (unsigned long) h->bucket[b]);
+            }
+        }
+        append(buf, size, &pos, "\n");
+    }
+    return pos;
+}
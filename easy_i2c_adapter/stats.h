@@ -0,0 +1,84 @@
+#ifndef _STATS_HEADER_FILE_
+#define _STATS_HEADER_FILE_
+
+/***********************************
+ * stats.h
+ * performance counters and timing histograms, reported by the stats command
+ * *********************************/
+
+#include <stdint.h>
+
+// counters
+#define STAT_LINES 0 // command lines (ASCII, or LINE frames in binary mode)
+#define STAT_FRAMES 1 // binary commands (FRAME_CMD)
+#define STAT_ERRORS 2 // M2M error responses ('X', '~' or 'T')
+#define STAT_I2C_WRITES 3 // I2C write transfers, including the register address of a readmem
+#define STAT_I2C_READS 4 // I2C read transfers, including ACK polls
+#define STAT_I2C_TX_BYTES 5 // bytes written on the bus
+#define STAT_I2C_RX_BYTES 6 // bytes read from the bus
+#define STAT_I2C_NAKS 7 // transfers that were not acknowledged
+#define STAT_I2C_TIMEOUTS 8 // transfers that timed out, each followed by a bus recovery
+#define STAT_ACK_POLLS 9 // EEPROM write cycles waited for
+#define STAT_HOST_WAITS 10 // waits for the host's '&' or ACK while sending read data
+#define STAT_HOST_RESENDS 11 // DATA frames the host asked to be sent again
+#define STAT_CRC_ERRORS 12 // frames received with a bad CRC
+#define STAT_USB_RX_BYTES 13 // bytes received from the host
+#define STAT_COUNTERS 14
+
+// histograms, of durations in microseconds
+#define STAT_HIST_PARSE 0 // handling a command on core0, excluding the output and stall phases
+#define STAT_HIST_BUS 1 // each I2C transfer, including any bus recovery
+#define STAT_HIST_OUTPUT 2 // sending the response of a transaction, including waits for the host
+#define STAT_HIST_HOST_WAIT 3 // each wait for the host's '&' or ACK
+#define STAT_HIST_STALL 4 // core0 waiting for core1 to finish transactions
+#define STAT_HISTS 5
+
+// log2 buckets: bucket 0 counts durations of 0 usec, bucket n durations of 2^(n-1) to 2^n - 1 usec.
+// The last bucket also counts anything longer
+#define STATS_BUCKETS 24
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t bucket[STATS_BUCKETS];
+} stats_hist_t;
+
+// each counter and histogram is only ever updated by one core at a time (core1's are only used by
+// core0 while core1 is idle), so no locking is needed
+typedef struct {
+    uint32_t counter[STAT_COUNTERS];
+    stats_hist_t hist[STAT_HISTS];
+    uint64_t since; // time of the last reset, usec since boot
+} stats_t;
+
+extern stats_t stats;
+
+// the hot-path updates are inline, a few instructions each
+static inline void stats_inc(int counter) {
+    stats.counter[counter]++;
+}
+
+static inline void stats_add(int counter, uint32_t n) {
+    stats.counter[counter] += n;
+}
+
+static inline void stats_record(int hist, uint32_t us) {
+    stats_hist_t *h = &stats.hist[hist];
+    int b = (us == 0) ? 0 : 32 - __builtin_clz(us);
+    if (b >= STATS_BUCKETS) {
+        b = STATS_BUCKETS - 1;
+    }
+    h->bucket[b]++;
+    h->count++;
+    h->total += us;
+    if (us > h->max) {
+        h->max = us;
+    }
+}
+
+void stats_reset(uint64_t now);
+// writes the report as text lines into buf (see the stats command in main.c), returns its length
+int stats_format(char *buf, int size, uint64_t now);
+
+#endif // _STATS_HEADER_FILE_
@@ -0,0 +1,76 @@
+/****************************************
+ * txbuf.c
+ * output staging buffer, flushed straight to the USB stdio driver, so that a response
+ * leaves in full-size USB packets rather than one small packet per character
+ * **************************************/
+
+#include <string.h>
+#include "pico/stdio_usb.h"
+#include "txbuf.h"
+
+uint8_t tx_buf[TXBUF_SIZE];
+uint16_t tx_len = 0;
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+void
+tx_flush(void)
+{
+    if (tx_len > 0) {
+        stdio_usb.out_chars((const char *) tx_buf, tx_len);
+        tx_len = 0;
+    }
+}
+
+void
+tx_write(const uint8_t *data, uint16_t len)
+{
+    uint16_t n;
+    while (len > 0) {
+        if (tx_len >= TXBUF_SIZE) {
+            tx_flush();
+        }
+        n = TXBUF_SIZE - tx_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&tx_buf[tx_len], data, n);
+        tx_len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void
+tx_puts(const char *s)
+{
+    tx_write((const uint8_t *) s, strlen(s));
+}
+
+void
+tx_hex(uint8_t b)
+{
+    tx_putc(hex_digits[b >> 4]);
+    tx_putc(hex_digits[b & 0x0F]);
+}
+
+void
+tx_dec(uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        tx_putc(digits[--n]);
+    }
+}
+
+void
+tx_newline(void)
+{
+    tx_putc('\r');
+    tx_putc('\n');
+}
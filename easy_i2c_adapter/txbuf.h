@@ -0,0 +1,32 @@
+#ifndef _TXBUF_HEADER_FILE_
+#define _TXBUF_HEADER_FILE_
+
+/***********************************
+ * txbuf.h
+ * output staging buffer: a response (or a line of one) is assembled here and sent to the host
+ * in a single write, instead of a printf or putchar per character
+ * *********************************/
+
+#include <stdint.h>
+
+#define TXBUF_SIZE 512
+
+extern uint8_t tx_buf[TXBUF_SIZE];
+extern uint16_t tx_len;
+
+void tx_flush(void); // sends everything buffered, raw (no CR/LF translation)
+
+static inline void tx_putc(uint8_t c) {
+    if (tx_len >= TXBUF_SIZE) {
+        tx_flush();
+    }
+    tx_buf[tx_len++] = c;
+}
+
+void tx_write(const uint8_t *data, uint16_t len);
+void tx_puts(const char *s);
+void tx_hex(uint8_t b); // two upper-case hex digits
+void tx_dec(uint64_t v); // decimal
+void tx_newline(void); // CR LF, as printf sends for '\n'
+
+#endif // _TXBUF_HEADER_FILE_
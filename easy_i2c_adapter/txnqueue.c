@@ -0,0 +1,207 @@
+/****************************************
+ * txnqueue.c
+ * I2C transaction queue and execution engine
+ * no Pico SDK dependencies, so that it can also be built as host code
+ * **************************************/
+
+#include "txnqueue.h"
+
+#define TXN_ERROR_TIMEOUT -1 // same values as PICO_ERROR_TIMEOUT and PICO_ERROR_GENERIC
+#define TXN_ERROR_GENERIC -2
+
+// run phases
+#define TXN_PHASE_REG 0 // READMEM: writing the register address
+#define TXN_PHASE_DATA 1 // the transfer of the data
+#define TXN_PHASE_POLL 2 // after a write, waiting for the device to acknowledge again
+
+// the submit index and the done flags are published with release/acquire ordering, so that the slot
+// contents written before them are visible to the other core once it sees the new value
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+void
+txn_queue_init(txn_queue_t *q)
+{
+    q->submit_head = 0;
+    q->done_tail = 0;
+}
+
+txn_t *
+txn_alloc(txn_queue_t *q)
+{
+    if ((q->submit_head - q->done_tail) >= TXN_QUEUE_DEPTH) {
+        return NULL;
+    }
+    return &q->slots[q->submit_head & (TXN_QUEUE_DEPTH - 1)];
+}
+
+void
+txn_submit(txn_queue_t *q)
+{
+    q->slots[q->submit_head & (TXN_QUEUE_DEPTH - 1)].done = 0;
+    STORE_RELEASE(&q->submit_head, q->submit_head + 1);
+}
+
+txn_t *
+txn_completed(txn_queue_t *q)
+{
+    txn_t *t = &q->slots[q->done_tail & (TXN_QUEUE_DEPTH - 1)];
+    if ((q->done_tail == q->submit_head) || !LOAD_ACQUIRE(&t->done)) {
+        return NULL;
+    }
+    return t;
+}
+
+void
+txn_release(txn_queue_t *q)
+{
+    STORE_RELEASE(&q->done_tail, q->done_tail + 1);
+}
+
+int
+txn_pending(txn_queue_t *q)
+{
+    return (int) (q->submit_head - q->done_tail);
+}
+
+// ends the run with the outcome of a transfer start: TXN_BUSY if it started
+static int
+txn_run_started(txn_run_t *r, int ret)
+{
+    if (ret == 0) {
+        return TXN_BUSY;
+    }
+    r->t->result = ret;
+    r->t = NULL;
+    return ret;
+}
+
+int
+txn_run_begin(txn_run_t *r, const txn_bus_t *bus, txn_t *t)
+{
+    r->t = t;
+    r->phase = TXN_PHASE_DATA;
+    switch (t->op) {
+        case TXN_OP_WRITE:
+        case TXN_OP_WRITEMEM:
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, t->data, t->len, false, t->nostop));
+        case TXN_OP_READ:
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, t->data, t->len, true, t->nostop));
+        case TXN_OP_READMEM:
+            // send register address with repeated-start, then read
+            r->buf[0] = (t->reg_len == 2) ? (uint8_t) (t->reg >> 8) : (uint8_t) t->reg;
+            r->buf[1] = (uint8_t) t->reg;
+            r->phase = TXN_PHASE_REG;
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, r->buf, t->reg_len, false, true));
+        case TXN_OP_NOP:
+            t->result = 0;
+            r->t = NULL;
+            return 0;
+    }
+    return txn_run_started(r, TXN_ERROR_GENERIC);
+}
+
+int
+txn_run_step(txn_run_t *r, const txn_bus_t *bus)
+{
+    txn_t *t = r->t;
+    int ret = bus->check(bus->ctx);
+    if (ret == TXN_BUSY) {
+        return TXN_BUSY;
+    }
+    if (ret >= 0) {
+        if (r->phase == TXN_PHASE_REG) {
+            r->phase = TXN_PHASE_DATA;
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, t->data, t->len, true, t->nostop));
+        }
+        if ((r->phase == TXN_PHASE_DATA) && t->poll) {
+            r->phase = TXN_PHASE_POLL;
+            r->result = ret;
+            r->poll_start = txn_time_us();
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, r->buf, 1, true, false));
+        }
+        if (r->phase == TXN_PHASE_POLL) {
+            ret = r->result;
+        }
+    } else if ((r->phase == TXN_PHASE_POLL) && (ret != TXN_ERROR_TIMEOUT)) {
+        // the device ignores its address until the internal write cycle is over, so it is
+        // probed again, until the longest write cycle has passed
+        if ((txn_time_us() - r->poll_start) < TXN_POLL_TIMEOUT_US) {
+            return txn_run_started(r, bus->start(bus->ctx, t->addr, r->buf, 1, true, false));
+        }
+        ret = TXN_ERROR_GENERIC;
+    }
+    t->result = ret;
+    r->t = NULL;
+    return ret;
+}
+
+void
+txn_engine_init(txn_engine_t *e, const txn_bus_t *buses, uint8_t bus_count)
+{
+    uint8_t b;
+    e->buses = buses;
+    e->bus_count = (bus_count < TXN_BUS_MAX) ? bus_count : TXN_BUS_MAX;
+    for (b = 0; b < TXN_BUS_MAX; b++) {
+        e->run[b].t = NULL;
+    }
+    e->exec_tail = 0;
+    e->executed = 0;
+}
+
+// hands a finished transaction back to the producer
+static void
+txn_engine_done(txn_engine_t *e, txn_queue_t *q, txn_t *t)
+{
+    e->executed |= 1u << (t - q->slots);
+    STORE_RELEASE(&t->done, 1);
+}
+
+int
+txn_engine_step(txn_engine_t *e, txn_queue_t *q)
+{
+    uint32_t head = LOAD_ACQUIRE(&q->submit_head);
+    uint32_t i, bit;
+    int busy = 0;
+    uint8_t b;
+    txn_t *t;
+    // the transfers in progress first, so that a bus that finishes starts its next one at once
+    for (b = 0; b < e->bus_count; b++) {
+        t = e->run[b].t;
+        if (t == NULL) {
+            continue;
+        }
+        if (txn_run_step(&e->run[b], &e->buses[b]) != TXN_BUSY) {
+            txn_engine_done(e, q, t);
+        }
+        busy = 1;
+    }
+    // the producer may already have released and reused the slots passed here: exec_tail
+    // only ever stops at a slot that is not done, which the producer cannot have passed
+    while (e->exec_tail != head) {
+        bit = 1u << (e->exec_tail & (TXN_QUEUE_DEPTH - 1));
+        if (!(e->executed & bit)) {
+            break;
+        }
+        e->executed &= ~bit;
+        e->exec_tail++;
+    }
+    // each idle bus starts its oldest waiting transaction
+    for (i = e->exec_tail; i != head; i++) {
+        t = &q->slots[i & (TXN_QUEUE_DEPTH - 1)];
+        if (e->executed & (1u << (i & (TXN_QUEUE_DEPTH - 1)))) {
+            continue;
+        }
+        if (t->bus >= e->bus_count) {
+            t->result = TXN_ERROR_GENERIC;
+            txn_engine_done(e, q, t);
+            busy = 1;
+        } else if (e->run[t->bus].t == NULL) {
+            if (txn_run_begin(&e->run[t->bus], &e->buses[t->bus], t) != TXN_BUSY) {
+                txn_engine_done(e, q, t);
+            }
+            busy = 1;
+        }
+    }
+    return busy;
+}
@@ -0,0 +1,105 @@
+#ifndef _TXNQUEUE_HEADER_FILE_
+#define _TXNQUEUE_HEADER_FILE_
+
+/***********************************
+ * txnqueue.h
+ * I2C transaction queue shared between the command parser (core0)
+ * and the transaction engine (core1)
+ * *********************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TXN_QUEUE_DEPTH 8 // must be a power of 2, at most 32
+#define TXN_DATA_MAX 260 // room for a register address plus a full byte_buffer
+#define TXN_BUS_MAX 4 // buses the engine can drive at once
+#define TXN_BUSY 0x7fffffff // result of a bus check, or a run step, while the transfer is in progress
+#define TXN_POLL_TIMEOUT_US 20000 // longest EEPROM write cycle waited for, when ACK polling
+
+// transaction types
+#define TXN_OP_WRITE 1 // write len bytes of data
+#define TXN_OP_READ 2 // read len bytes into data
+#define TXN_OP_READMEM 3 // write reg (reg_len bytes, MSB first) without a stop, then read len bytes into data
+#define TXN_OP_WRITEMEM 4 // write len bytes of data, which starts with the register address
+#define TXN_OP_NOP 5 // no transfer, completes at once; queues a response behind the earlier ones
+
+// tags, for the owner of the queue to tell transactions apart; not used by the engine
+#define TXN_TAG_NONE 0
+#define TXN_TAG_PART 1 // part of a larger transfer, more parts follow
+#define TXN_TAG_LAST 2 // last part of a larger transfer
+
+typedef struct {
+    uint8_t op;
+    uint8_t bus; // index into the engine's buses
+    uint8_t addr;
+    uint16_t reg;
+    uint8_t reg_len; // 1 or 2 bytes
+    uint8_t nostop; // hold the bus afterwards, for a repeated start
+    uint8_t poll; // after a write, wait until the device acknowledges again (EEPROM write cycle)
+    uint8_t tag;
+    uint16_t len;
+    int result; // set by the engine: bytes transferred, or a negative PICO_ERROR_ code
+    uint8_t done; // set by the engine once result is final
+    uint8_t data[TXN_DATA_MAX];
+} txn_t;
+
+// non-blocking bus operations used by the engine. start begins a transfer with the same arguments
+// as i2c_write_blocking/i2c_read_blocking (buf is filled in by a read), and returns 0, or a negative
+// PICO_ERROR_ code if the transfer could not start. check returns TXN_BUSY while the transfer is in
+// progress, then its outcome: the number of bytes transferred, or a negative PICO_ERROR_ code
+typedef struct {
+    int (*start)(void *ctx, uint8_t addr, uint8_t *buf, size_t len, bool read, bool nostop);
+    int (*check)(void *ctx);
+    void *ctx;
+} txn_bus_t;
+
+// single-producer single-consumer ring of transaction slots. Slots are submitted and released
+// by the producer in order; the engine may execute them out of order across buses, and marks each
+// one done. Each field is only ever written by one side, so no locks are needed
+typedef struct {
+    txn_t slots[TXN_QUEUE_DEPTH];
+    uint32_t submit_head; // written by the producer
+    uint32_t done_tail; // written by the producer
+} txn_queue_t;
+
+// a transaction in progress on one bus: a READMEM writes the register address then reads, and a
+// write with poll set is followed by 1-byte reads until the device acknowledges again
+typedef struct {
+    txn_t *t; // NULL while the bus is idle
+    uint8_t phase;
+    uint8_t buf[2]; // the register address, or the byte read by an ACK poll
+    int result; // of the write, while ACK polling
+    uint32_t poll_start;
+} txn_run_t;
+
+// engine state, only used by the engine's side. Each bus runs its transactions one at a time in the
+// order they were submitted, while transactions on different buses overlap
+typedef struct {
+    const txn_bus_t *buses;
+    uint8_t bus_count;
+    txn_run_t run[TXN_BUS_MAX];
+    uint32_t exec_tail; // oldest slot not yet executed
+    uint32_t executed; // bit per slot, set once it is done, until exec_tail passes it
+} txn_engine_t;
+
+uint32_t txn_time_us(void); // provided by the owner of the queue, for the ACK polling deadline
+
+void txn_queue_init(txn_queue_t *q);
+// producer side
+txn_t *txn_alloc(txn_queue_t *q); // next free slot to fill, or NULL if the queue is full
+void txn_submit(txn_queue_t *q); // hands the slot from txn_alloc to the engine
+txn_t *txn_completed(txn_queue_t *q); // oldest transaction, if it is done and not yet released, or NULL
+void txn_release(txn_queue_t *q); // frees the slot returned by txn_completed
+int txn_pending(txn_queue_t *q); // number of transactions submitted but not yet released
+// engine side
+void txn_engine_init(txn_engine_t *e, const txn_bus_t *buses, uint8_t bus_count);
+// starts the transactions whose buses are free and advances those in progress, without waiting.
+// returns 0 if there is nothing to do
+int txn_engine_step(txn_engine_t *e, txn_queue_t *q);
+// a single transaction, outside the queue: txn_run_begin starts it, then txn_run_step advances it
+// until it has finished. Each returns TXN_BUSY, or the result (also stored in t->result)
+int txn_run_begin(txn_run_t *r, const txn_bus_t *bus, txn_t *t);
+int txn_run_step(txn_run_t *r, const txn_bus_t *bus);
+
+#endif // _TXNQUEUE_HEADER_FILE_
@@ -0,0 +1,250 @@
+# Throughput and latency benchmark for the easy_adapter M2M protocol
+# requires pyserial
+# measures operations per second and p50/p99 latency of the easyadapter.py calls,
+# in ASCII and/or framed binary mode, and can save the results as JSON, so that
+# changes to the firmware or the PC library can be compared run against run
+#
+# examples:
+#   python benchmark.py                          (first easy_adapter found, board 0)
+#   python benchmark.py --port /tmp/easy_adapter --json results.json
+#   python benchmark.py --sim ../easy_i2c_adapter/build_sim/host/easy_adapter_sim
+#   python benchmark.py --port /tmp/easy_adapter --baseline old.json --threshold 10
+#
+# the default targets suit the simulated adapter (a sensor register file at 0x48).
+# With real hardware, choose a device that accepts writes with --addr and --mem-addr;
+# the writes change its contents. --io-pin is driven high and low, so it must be free
+
+import easyadapter as ea
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+DEFAULT_SIZES = [1, 16, 64, 256]
+SIM_BOOT_TIME = 3.5  # seconds, the firmware waits 3 seconds at startup before reading commands
+
+
+def percentile(sorted_values, pct):
+    if len(sorted_values) == 0:
+        return 0
+    # nearest-rank percentile
+    rank = max(1, int(-(-pct * len(sorted_values) // 100)))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+# runs fn() iterations times (after a few warm-up calls) and returns the result entry.
+# fn returns True for success; failed calls are counted but not included in the latencies
+def measure(name, mode, size, fn, iterations, warmup):
+    for i in range(warmup):
+        fn()
+    latencies = []
+    errors = 0
+    start = time.perf_counter_ns()
+    for i in range(iterations):
+        t0 = time.perf_counter_ns()
+        ok = fn()
+        t1 = time.perf_counter_ns()
+        if ok:
+            latencies.append(t1 - t0)
+        else:
+            errors += 1
+    total = time.perf_counter_ns() - start
+    latencies.sort()
+    n = len(latencies)
+    entry = {
+        "op": name,
+        "mode": mode,
+        "size": size,
+        "iterations": iterations,
+        "errors": errors,
+        "ops_per_sec": round(n * 1e9 / total, 2) if total > 0 else 0,
+        "p50_us": round(percentile(latencies, 50) / 1000, 1),
+        "p99_us": round(percentile(latencies, 99) / 1000, 1),
+        "mean_us": round(sum(latencies) / n / 1000, 1) if n > 0 else 0,
+        "min_us": round(latencies[0] / 1000, 1) if n > 0 else 0,
+        "max_us": round(latencies[-1] / 1000, 1) if n > 0 else 0,
+    }
+    if size is not None:
+        entry["bytes_per_sec"] = round(entry["ops_per_sec"] * size, 1)
+    return entry
+
+
+# the list of (op, size, fn) to measure, built on the adapter's calls
+def make_cases(adapter, args):
+    cases = []
+    addr = args.addr
+    cases.append(("i2c_try_address", None, lambda: adapter.i2c_try_address(addr) is True))
+    for size in args.sizes:
+        # i2c_write sends byte1 followed by data, so size bytes in all
+        data = bytes((i * 7) & 0xff for i in range(size - 1))
+        cases.append(("i2c_write", size, lambda data=data: adapter.i2c_write(addr, 0x10, data) is True))
+    for size in args.sizes:
+        cases.append(("i2c_read", size, lambda size=size: adapter.i2c_read(addr, size) is not None))
+    cases.append(("io_read", None, lambda: adapter.io_read(args.io_pin) >= 0))
+    level = [0]
+
+    def io_toggle():
+        level[0] ^= 1
+        return adapter.io_write(args.io_pin, level[0]) is True
+
+    cases.append(("io_write", None, io_toggle))
+    for size in args.mem_sizes:
+        data = bytes((i * 13) & 0xff for i in range(size))
+        cases.append(("mem_write", size,
+                      lambda data=data: adapter.mem_write(args.mem_addr, args.mem_reg, data) is True))
+    for size in args.mem_sizes:
+        cases.append(("mem_read", size,
+                      lambda size=size: adapter.mem_read(args.mem_addr, args.mem_reg, size) is not None))
+    return cases
+
+
+def run_mode(adapter, mode, args, results):
+    cases = make_cases(adapter, args)
+    for name, size, fn in cases:
+        if args.ops and name not in args.ops:
+            continue
+        entry = measure(name, mode, size, fn, args.iterations, args.warmup)
+        results.append(entry)
+        print_entry(entry)
+
+
+def print_header():
+    print(f"{'op':<16}{'mode':<8}{'size':>6}{'ops/s':>10}{'p50 us':>10}{'p99 us':>10}{'KB/s':>9}{'errors':>8}")
+
+
+def print_entry(e):
+    size = "" if e["size"] is None else str(e["size"])
+    kbps = "" if "bytes_per_sec" not in e else f"{e['bytes_per_sec'] / 1024:.1f}"
+    print(f"{e['op']:<16}{e['mode']:<8}{size:>6}{e['ops_per_sec']:>10.1f}{e['p50_us']:>10.1f}"
+          f"{e['p99_us']:>10.1f}{kbps:>9}{e['errors']:>8}")
+
+
+# compares the results against an earlier JSON file. An entry regresses if its
+# throughput has dropped, or its p99 latency has risen, by more than threshold percent.
+# returns the number of regressions
+def compare(results, baseline_file, threshold):
+    with open(baseline_file) as f:
+        baseline = json.load(f)
+    old = {(e["op"], e["mode"], e["size"]): e for e in baseline["results"]}
+    regressions = 0
+    print(f"\nCompared with {baseline_file} (threshold {threshold}%)")
+    for e in results:
+        b = old.get((e["op"], e["mode"], e["size"]))
+        if b is None or b["ops_per_sec"] == 0 or b["p99_us"] == 0:
+            continue
+        ops_change = (e["ops_per_sec"] - b["ops_per_sec"]) * 100 / b["ops_per_sec"]
+        p99_change = (e["p99_us"] - b["p99_us"]) * 100 / b["p99_us"]
+        flag = ""
+        if ops_change < -threshold or p99_change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        size = "" if e["size"] is None else str(e["size"])
+        print(f"{e['op']:<16}{e['mode']:<8}{size:>6}  ops/s {ops_change:+7.1f}%  p99 {p99_change:+7.1f}%{flag}")
+    return regressions
+
+
+# starts the simulated adapter on a pty, and returns the process and the port to use
+def start_sim(sim_path, sim_args):
+    link = os.path.join(tempfile.mkdtemp(prefix="easy_bench_"), "adapter")
+    proc = subprocess.Popen([sim_path, "--link", link] + sim_args, stderr=subprocess.PIPE, text=True)
+    line = proc.stderr.readline()
+    if proc.poll() is not None or not line:
+        print(f"Error starting {sim_path}")
+        sys.exit(1)
+    time.sleep(SIM_BOOT_TIME)
+    return proc, link
+
+
+def parse_sizes(text):
+    return [int(s, 0) for s in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="easy_adapter throughput and latency benchmark")
+    parser.add_argument("--port", help="serial port of the adapter (default: search for --board)")
+    parser.add_argument("--board", type=int, default=0, help="board number to search for (default 0)")
+    parser.add_argument("--sim", metavar="PATH", help="start the simulated adapter at PATH and benchmark it")
+    parser.add_argument("--sim-args", default="", help="extra options for the simulated adapter")
+    parser.add_argument("--mode", choices=["ascii", "binary", "both"], default="both")
+    parser.add_argument("--iterations", type=int, default=200, help="calls measured per operation (default 200)")
+    parser.add_argument("--warmup", type=int, default=5, help="calls made before measuring (default 5)")
+    parser.add_argument("--sizes", type=parse_sizes, default=DEFAULT_SIZES,
+                        help="i2c_write/i2c_read sizes in bytes, 1 to 256 (default 1,16,64,256)")
+    parser.add_argument("--mem-sizes", type=parse_sizes, default=DEFAULT_SIZES,
+                        help="mem_write/mem_read sizes in bytes (default 1,16,64,256)")
+    parser.add_argument("--addr", type=lambda s: int(s, 0), default=0x48, help="device for i2c_* (default 0x48)")
+    parser.add_argument("--mem-addr", type=lambda s: int(s, 0), default=0x48,
+                        help="device for mem_* (default 0x48)")
+    parser.add_argument("--mem-reg", type=lambda s: int(s, 0), default=0x00, help="register for mem_* (default 0)")
+    parser.add_argument("--io-pin", type=int, default=6, help="GPIO for io_read/io_write (default 6)")
+    parser.add_argument("--bus-speed", type=int, help="I2C bus speed in Hz to set before measuring")
+    parser.add_argument("--ops", type=lambda s: s.split(","), help="comma-separated subset of operations to run")
+    parser.add_argument("--json", metavar="FILE", help="write the results to FILE")
+    parser.add_argument("--baseline", metavar="FILE", help="compare with the results in FILE")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percentage change counted as a regression (default 10)")
+    args = parser.parse_args()
+
+    for size in args.sizes:
+        if size < 1 or size > 256:
+            parser.error("--sizes must be between 1 and 256")
+    for size in args.mem_sizes:
+        if size < 1 or size > 65536:
+            parser.error("--mem-sizes must be between 1 and 65536")
+
+    sim = None
+    port = args.port
+    if args.sim is not None:
+        sim, port = start_sim(args.sim, args.sim_args.split())
+    adapter = ea.EasyAdapter()
+    results = []
+    try:
+        if adapter.find_device(args.board, port) is None:
+            sys.exit(1)
+        adapter.m2m_mode(1)
+        if args.bus_speed is not None:
+            adapter.set_bus_speed(args.bus_speed)
+        print_header()
+        if args.mode in ("ascii", "both"):
+            run_mode(adapter, "ascii", args, results)
+        if args.mode in ("binary", "both"):
+            if not adapter.bin_mode(1):
+                sys.exit(1)
+            run_mode(adapter, "binary", args, results)
+            adapter.bin_mode(0)
+    finally:
+        adapter.close()
+        if sim is not None:
+            sim.terminate()
+            sim.wait()
+
+    report = {
+        "meta": {
+            "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "port": adapter.adapter_port,
+            "board": args.board,
+            "simulated": sim is not None,
+            "sim_args": args.sim_args if sim is not None else None,
+            "bus_speed": args.bus_speed,
+            "iterations": args.iterations,
+            "warmup": args.warmup,
+            "python": platform.python_version(),
+            "platform": platform.platform(),
+        },
+        "results": results,
+    }
+    if args.json is not None:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+        print(f"Results written to {args.json}")
+    if args.baseline is not None:
+        if compare(results, args.baseline, args.threshold) > 0:
+            sys.exit(2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,215 @@
+# Adapter daemon: keeps the easy_adapter's serial port open, and shares it with any number of
+# local programs over a Unix domain socket
+# requires pyserial
+# programs connect with easyadapter.EasyAdapterClient, which has the same i2c_write, i2c_read,
+# io_read, io_write, i2c_try_address, select_bus and bus_config calls as EasyAdapter, without opening
+# the port or searching for the adapter.
+#
+# examples:
+#   python easy_daemon.py                            (first easy_adapter found, board 0)
+#   python easy_daemon.py --board 1 --socket /tmp/easy_adapter_1.sock
+#   python easy_daemon.py --port /tmp/easy_adapter   (the simulated adapter)
+#
+# requests from the clients are taken in turn, one from each client that has any waiting, so a
+# busy client can't starve the others. Several requests (from any clients) are outstanding on the
+# adapter at once, see AsyncEasyAdapter. A client that writes with hold=1 owns the bus until its
+# next I2C call, so no other client's transfer can come between a write and its repeated start.
+# If the owner disconnects, or sends nothing for HOLD_TIMEOUT seconds, the daemon ends the
+# transfer with a one-byte read, which releases the bus with a stop.
+# Each client has its own selected I2C bus (bus 0 until it calls select_bus): before a client's I2C
+# call, the daemon selects that client's bus on the adapter if another client's is selected.
+#
+# the socket carries one JSON object per line. A request is {"op": name, "args": [...]}, and the reply
+# {"result": value} or {"error": text}; data bytes are sent as {"bytes": hex string}
+
+import easyadapter as ea
+import argparse
+import asyncio
+import collections
+import json
+import os
+import signal
+import sys
+
+HOLD_TIMEOUT = 1.0  # seconds
+OPS = ("i2c_write", "i2c_read", "io_read", "io_write", "i2c_try_address", "select_bus", "bus_config")
+I2C_OPS = ("i2c_write", "i2c_read", "i2c_try_address")
+
+
+def encode(value):
+    if isinstance(value, bytes):
+        return {"bytes": value.hex()}
+    return value
+
+
+class Client:
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+        self.requests = collections.deque()
+        self.connected = True
+        self.bus = 0  # the I2C bus this client selected
+
+
+class Daemon:
+    def __init__(self, adapter, max_outstanding):
+        self.adapter = adapter
+        self.max_outstanding = max_outstanding
+        self.clients = collections.deque()  # in turn order
+        self.work = asyncio.Event()  # set when a request arrives or a request finishes
+        self.outstanding = 0
+        self.holder = None  # the client that owns the bus after a write with hold=1
+        self.hold_addr = 0
+        self.hold_time = 0
+        self.bus = 0  # the bus selected on the adapter, None if not known
+
+    async def serve_client(self, reader, writer):
+        client = Client(reader, writer)
+        self.clients.append(client)
+        try:
+            while True:
+                line = await reader.readline()
+                if not line:
+                    break
+                try:
+                    req = json.loads(line)
+                    if req.get("op") not in OPS:
+                        raise ValueError(f"unknown op {req.get('op')}")
+                    client.requests.append(req)
+                except (ValueError, AttributeError) as e:
+                    client.requests.append({"error": str(e)})
+                self.work.set()
+        except ConnectionError:
+            pass
+        client.connected = False
+        self.clients.remove(client)
+        self.work.set()
+        writer.close()
+
+    # the client whose request goes next: the bus owner if there is one, otherwise the next client
+    # in turn that has a request waiting
+    def next_client(self):
+        if self.holder is not None:
+            return self.holder if len(self.holder.requests) > 0 else None
+        for i in range(len(self.clients)):
+            client = self.clients[0]
+            self.clients.rotate(-1)
+            if len(client.requests) > 0:
+                return client
+        return None
+
+    async def release_hold(self):
+        print(f"Releasing the bus held at address 0x{self.hold_addr:02x}")
+        self.holder = None
+        self.outstanding += 1
+        await self.adapter.i2c_read(self.hold_addr, 1)
+        self.outstanding -= 1
+        self.work.set()
+
+    async def run(self):
+        loop = asyncio.get_running_loop()
+        while True:
+            if self.holder is not None and (not self.holder.connected or
+                                            (len(self.holder.requests) == 0 and
+                                             loop.time() - self.hold_time > HOLD_TIMEOUT)):
+                await self.release_hold()
+            client = None
+            if self.outstanding < self.max_outstanding:
+                client = self.next_client()
+            if client is None:
+                self.work.clear()
+                try:
+                    await asyncio.wait_for(self.work.wait(), HOLD_TIMEOUT if self.holder is not None else None)
+                except asyncio.TimeoutError:
+                    pass
+                continue
+            req = client.requests.popleft()
+            op = req.get("op")
+            args = req.get("args", [])
+            if op == "select_bus" and len(args) > 0:
+                req["prev_bus"] = client.bus
+                client.bus = args[0]
+                self.bus = args[0]
+            elif op == "bus_config":
+                self.bus = None  # releasing the selected bus selects bus 0
+            elif op in I2C_OPS and self.bus != client.bus:
+                # the adapter is on another client's bus: switch it over first, in order with the request
+                self.bus = client.bus
+                self.outstanding += 1
+                loop.create_task(self.execute(None, {"op": "select_bus", "args": [client.bus]}))
+                await asyncio.sleep(0)
+            if op in I2C_OPS:
+                # a write with hold=1 takes ownership of the bus, the owner's next I2C call ends it
+                hold = op == "i2c_write" and len(args) >= 4 and args[3] == 1
+                self.holder = client if hold else None
+                self.hold_addr = args[0] if len(args) > 0 else 0
+                self.hold_time = loop.time()
+            self.outstanding += 1
+            # the call sends its request before the next one is started, so each client's requests
+            # reach the adapter, and are answered, in the order they were made
+            loop.create_task(self.execute(client, req))
+            await asyncio.sleep(0)
+
+    async def execute(self, client, req):
+        try:
+            if "error" in req:
+                reply = {"error": req["error"]}
+            else:
+                result = await getattr(self.adapter, req["op"])(*req.get("args", []))
+                reply = {"result": encode(result)}
+                if req["op"] == "select_bus" and not result:
+                    # the adapter kept its bus, which may be any client's by now
+                    self.bus = None
+                    if client is not None and "prev_bus" in req:
+                        client.bus = req["prev_bus"]
+        except Exception as e:
+            reply = {"error": str(e)}
+        self.outstanding -= 1
+        self.work.set()
+        if client is not None and client.connected:
+            try:
+                client.writer.write(json.dumps(reply).encode() + b"\n")
+                await client.writer.drain()
+            except ConnectionError:
+                pass
+
+
+async def main_async(args):
+    adapter = ea.AsyncEasyAdapter(max_outstanding=args.max_outstanding)
+    if not await adapter.init(args.board, args.port):
+        sys.exit(1)
+    daemon = Daemon(adapter, args.max_outstanding)
+    if os.path.exists(args.socket):
+        os.remove(args.socket)
+    server = await asyncio.start_unix_server(daemon.serve_client, path=args.socket)
+    print(f"Serving easy_adapter_{args.board} at {args.socket}")
+    task = asyncio.current_task()
+    asyncio.get_running_loop().add_signal_handler(signal.SIGTERM, task.cancel)
+    try:
+        async with server:
+            await daemon.run()
+    except asyncio.CancelledError:
+        pass
+    finally:
+        await adapter.close()
+        os.remove(args.socket)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="easy_adapter daemon, shares one adapter between programs")
+    parser.add_argument("--board", type=int, default=0, help="board number to search for (default 0)")
+    parser.add_argument("--port", help="serial port of the adapter (default: search for --board)")
+    parser.add_argument("--socket", help="path of the Unix socket (default " + ea.daemon_socket_path(0) + " for board 0)")
+    parser.add_argument("--max-outstanding", type=int, default=8,
+                        help="requests outstanding on the adapter at once (default 8)")
+    args = parser.parse_args()
+    if args.socket is None:
+        args.socket = ea.daemon_socket_path(args.board)
+    try:
+        asyncio.run(main_async(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
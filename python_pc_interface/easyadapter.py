@@ -1,103 +1,625 @@
 # Python module for interfacing via serial to an I2C adapter
 # requires pyserial
 # rev 1.1 - shabaz - feb 2025 - added known I2C addresses
+# rev 1.2 - persistent serial session, responses complete on the terminating character
+# rev 1.3 - ports probed in parallel, cached board to port map
+# rev 1.4 - AsyncEasyAdapter for asyncio, with pipelined requests
+# rev 1.5 - EasyAdapterClient, to share an adapter through easy_daemon.py
+# rev 1.6 - logic capture, decoded into per-pin samples or a VCD file
+# rev 1.7 - multiple I2C buses: bus 1 (I2C0) and PIO buses 2 and 3, selected with select_bus
 
 import serial  # Note: this is the pyserial module, NOT the serial module
 from serial.tools import list_ports
 from array import *
 import time
 import sys
+import binascii
+import asyncio
+import collections
+import threading
+import json
+import os
+import re
+import socket
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+# framed binary M2M protocol, see m2mframe.h in the firmware
+# frame layout: SOF TYPE SEQ LEN(2) PAYLOAD CRC(2), little-endian, CRC-16/CCITT-FALSE
+FRAME_SOF = 0xA5
+FRAME_MAX_PAYLOAD = 256
+FRAME_DATA_CHUNK = 128
+FRAME_WINDOW = 4
+FRAME_LINE = 0x01
+FRAME_DATA = 0x02
+FRAME_ACK = 0x03
+FRAME_NAK = 0x04
+FRAME_RESP = 0x05
+FRAME_CMD = 0x06
+FRAME_BAD = -1  # returned by _read_frame for a frame that failed its CRC check
+BIN_OP_ADDR = 0x01
+BIN_OP_WRITE = 0x02
+BIN_OP_WRITE_HOLD = 0x03
+BIN_OP_READ = 0x04
+BIN_OP_READMEM = 0x05
+BIN_OP_WRITEMEM = 0x06
+BIN_OP_TRYADDR = 0x07
+BIN_OP_IOREAD = 0x08
+BIN_OP_IOWRITE = 0x09
+BIN_OP_SCAN = 0x0A
+BIN_OP_SPEED = 0x0B
+BIN_OP_BATCH = 0x0C
+BIN_OP_DELAY = 0x0D
+BIN_OP_STREAM = 0x0E
+BIN_OP_MEMREAD = 0x0F
+BIN_OP_MEMWRITE = 0x10
+BIN_OP_MEMCFG = 0x11
+BIN_OP_STATS = 0x12
+BIN_OP_IOREADMASK = 0x13
+BIN_OP_IOWRITEMASK = 0x14
+BIN_OP_IOCFGMASK = 0x15
+BIN_OP_CAPTURE = 0x16
+BIN_OP_CAPSTATUS = 0x17
+BIN_OP_CAPREAD = 0x18
+BIN_OP_PATTERN = 0x19
+BIN_OP_BUS = 0x1A
+BIN_OP_BUSCFG = 0x1B
+FRAME_SAMPLE = 0x07
+
+STATS_BUCKETS = 24
+I2C_SDA_PIN = 14
+I2C_SCL_PIN = 15
+# logic capture trigger types and states, see capture.h in the firmware
+CAPTURE_TRIGGERS = {"none": 0, "high": 1, "low": 2, "rising": 3, "falling": 4}
+CAPTURE_STATES = ("idle", "armed", "running", "done")
+HEX_LINE_MAX = 256  # longest M2M hex response line expected (16 bytes as "xx " and the '&')
+HEX_BUF_SIZE = 16384  # initial size of the hex response buffer, enough for a 4K read
+
+# USB vendor and product IDs of the Pico SDK's stdio_usb serial port; only ports with these IDs
+# are probed, unless none of the ports has them (for instance if the platform doesn't report IDs)
+USB_IDS = [(0x2E8A, 0x000A)]
+# remembers which port (and USB serial number) each board was last found at, so that find_device can
+# check that one port instead of probing them all. Set EASY_ADAPTER_CACHE to use another file
+PORT_CACHE_FILE = os.environ.get("EASY_ADAPTER_CACHE",
+                                 os.path.join(os.path.expanduser("~"), ".easy_adapter_ports.json"))
+# the reply to device?, "easy_adapter_N" and a newline, which the Pico's stdio sends as CR LF
+DEVICE_ID_RE = re.compile(rb"easy_adapter_(\d+)\r?\n")
+
+def _load_port_cache():
+    try:
+        with open(PORT_CACHE_FILE) as f:
+            cache = json.load(f)
+        if isinstance(cache, dict):
+            return cache
+    except (OSError, ValueError):
+        pass
+    return {}
+
+def _save_port_cache(cache):
+    try:
+        tmp = PORT_CACHE_FILE + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump(cache, f, indent=2)
+        os.replace(tmp, PORT_CACHE_FILE)
+    except OSError:
+        pass  # the cache only saves time, discovery works without it
+
+# the ports worth probing: those with the adapter's USB IDs, or all of them if none has
+def _candidate_ports(infos):
+    matching = [p for p in infos if (p.vid, p.pid) in USB_IDS]
+    if len(matching) == 0:
+        matching = infos
+    return matching
+
+# finds all connected adapters, probing the ports in parallel, and refreshes the port cache.
+# returns a dict of board number to port
+def discover_adapters(wait_period=500):
+    adapter = EasyAdapter(session=False)
+    found = adapter._discover(list_ports.comports(), wait_period)
+    boards = {}
+    for port, board, ser in found:
+        ser.close()
+        if board not in boards:
+            boards[board] = port
+    return boards
+
+# parses the text of a stats report (see get_stats)
+def parse_stats(text):
+    stats = {"time_us": 0, "counters": {}, "histograms": {}}
+    for line in text.splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[0] == "time":
+            stats["time_us"] = int(fields[1])
+        elif len(fields) == 2:
+            stats["counters"][fields[0]] = int(fields[1])
+        elif len(fields) >= 5 and fields[0] == "hist":
+            buckets = [0] * STATS_BUCKETS
+            for item in fields[5:]:
+                b, n = item.split(":")
+                if int(b) < STATS_BUCKETS:
+                    buckets[int(b)] = int(n)
+            stats["histograms"][fields[1]] = {"count": int(fields[2]), "total_us": int(fields[3]),
+                                              "max_us": int(fields[4]), "buckets": buckets}
+    return stats
+
+# unpacks the samples of a logic capture (see capture.h in the firmware). Each little-endian 32-bit word
+# holds 32 // pin_count samples in its top bits, oldest first, and each sample holds the first pin in
+# its lowest bit. Returns a list of the sample values, with bit i for pin i, at most samples of them
+def unpack_capture(data, pin_count, samples=None):
+    per_word = 32 // pin_count
+    mask = (1 << pin_count) - 1
+    shifts = [32 - per_word * pin_count + k * pin_count for k in range(per_word)]
+    values = []
+    with memoryview(data) as view:
+        for i in range(0, len(view) - 3, 4):
+            word = int.from_bytes(view[i:i + 4], "little")
+            values.extend([(word >> shift) & mask for shift in shifts])
+    if samples is not None and samples < len(values):
+        del values[samples:]
+    return values
+
+# a logic capture, as returned by EasyAdapter.capture: the samples of pin_count GPIOs from first_pin,
+# taken rate times a second. It can also be built from a buffer packed as the adapter does, e.g.
+# cap = LogicCapture(bytes([0x1b, 0x00, 0x00, 0x00]), first_pin=14, pin_count=2, rate=1000000)
+# cap.pin(14)                 # b'\x01\x00\x01\x00...', one 0 or 1 per sample
+# cap.write_vcd("i2c.vcd")    # for a waveform viewer such as GTKWave or PulseView
+class LogicCapture:
+    def __init__(self, data, first_pin, pin_count, rate, samples=None):
+        self.first_pin = first_pin
+        self.pin_count = pin_count
+        self.rate = rate
+        self.values = unpack_capture(data, pin_count, samples)
+
+    def __len__(self):
+        return len(self.values)
+
+    # the GPIO numbers captured
+    @property
+    def gpios(self):
+        return range(self.first_pin, self.first_pin + self.pin_count)
+
+    # the levels of one GPIO, as bytes holding a 0 or 1 for each sample
+    def pin(self, gpio):
+        if gpio not in self.gpios:
+            print(f"GPIO {gpio} was not captured")
+            return None
+        shift = gpio - self.first_pin
+        return bytes([(v >> shift) & 1 for v in self.values])
+
+    # every GPIO captured, as a dict of GPIO number to its levels (see pin)
+    def pins(self):
+        return {gpio: self.pin(gpio) for gpio in self.gpios}
+
+    # the capture as the text of a Value Change Dump. names: a dict of GPIO number to signal name,
+    # by default gpioN, or sda and scl for the I2C pins. Only the changes are listed, so a long
+    # capture of a quiet bus stays small
+    def vcd(self, names=None):
+        names = names or {}
+        # the smallest time unit that gives each sample a whole number of units
+        unit, per_second = ("ns", 1000000000) if 1000000000 % self.rate == 0 else ("ps", 1000000000000)
+        default_names = {I2C_SDA_PIN: "sda", I2C_SCL_PIN: "scl"}
+        ids = [chr(33 + i) for i in range(self.pin_count)]
+        lines = ["$version easyadapter logic capture $end", f"$timescale 1{unit} $end",
+                 "$scope module easy_adapter $end"]
+        for i, gpio in enumerate(self.gpios):
+            name = names.get(gpio, default_names.get(gpio, f"gpio{gpio}"))
+            lines.append(f"$var wire 1 {ids[i]} {name} $end")
+        lines += ["$upscope $end", "$enddefinitions $end"]
+        prev = None
+        for k, value in enumerate(self.values):
+            changed = value ^ prev if prev is not None else (1 << self.pin_count) - 1
+            if changed == 0:
+                continue
+            lines.append(f"#{(k * per_second) // self.rate}")
+            if prev is None:
+                lines.append("$dumpvars")
+            lines += [f"{(value >> i) & 1}{ids[i]}" for i in range(self.pin_count) if (changed >> i) & 1]
+            if prev is None:
+                lines.append("$end")
+            prev = value
+        lines.append(f"#{(len(self.values) * per_second) // self.rate}")
+        return "\n".join(lines) + "\n"
+
+    # writes the capture as a Value Change Dump (see vcd) to a file path, or an open text file
+    def write_vcd(self, file, names=None):
+        if hasattr(file, "write"):
+            file.write(self.vcd(names))
+        else:
+            with open(file, "w") as f:
+                f.write(self.vcd(names))
+
+# builds a batch script of I2C and GPIO steps, which the adapter runs back to back in a single
+# round trip. Normally created with EasyAdapter.batch(), the script runs when the with block ends:
+# with adapter.batch() as b:
+#     b.write(0x40, [0x00, 0x01])
+#     b.delay_ms(10)
+#     b.mem_read(0x40, 0x10, 6)
+# print(b.results)  # [True, True, b'...'], one entry per step
+# writes, io_write, io_write_mask, bus and delays give True or False, reads give the data or None,
+# io_read gives 0, 1 or -1, io_read_mask the levels or -1.
+# the adapter stops at the first step that fails, the steps after it give None (-1 for io_read)
+class Batch:
+    def __init__(self, adapter, wait_period=2000):
+        self.adapter = adapter
+        self.wait_period = wait_period
+        self.script = bytearray()
+        self.steps = []  # (opcode, number of data bytes the step returns)
+        self.results = []
+        self.ok = False
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None:
+            self.run()
+
+    def _add(self, op, fields, data=b"", rlen=0):
+        self.script += bytes((op,)) + bytes(fields) + bytes(data)
+        self.steps.append((op, rlen))
+        return len(self.steps) - 1
+
+    # each step function returns the index of its entry in results
+    def write(self, addr, data, hold=False):
+        op = BIN_OP_WRITE_HOLD if hold else BIN_OP_WRITE
+        return self._add(op, (addr, len(data) & 0xff, len(data) >> 8), data)
+
+    def read(self, addr, num_bytes):
+        return self._add(BIN_OP_READ, (addr, num_bytes & 0xff, num_bytes >> 8), rlen=num_bytes)
+
+    def mem_read(self, addr, reg, num_bytes):
+        return self._add(BIN_OP_READMEM, (addr, reg, num_bytes & 0xff, num_bytes >> 8), rlen=num_bytes)
+
+    def mem_write(self, addr, reg, data):
+        return self._add(BIN_OP_WRITEMEM, (addr, reg, len(data) & 0xff, len(data) >> 8), data)
+
+    def io_write(self, gpio_num, val):
+        return self._add(BIN_OP_IOWRITE, (gpio_num, val))
+
+    def io_read(self, gpio_num, pullup=False):
+        return self._add(BIN_OP_IOREAD, (gpio_num, 1 if pullup else 0), rlen=1)
+
+    def io_write_mask(self, mask, value):
+        return self._add(BIN_OP_IOWRITEMASK, mask.to_bytes(4, "little") + value.to_bytes(4, "little"))
+
+    def io_read_mask(self, mask):
+        return self._add(BIN_OP_IOREADMASK, mask.to_bytes(4, "little"), rlen=4)
+
+    # the steps after this one run on I2C bus n, which stays selected once the batch ends
+    def bus(self, n):
+        return self._add(BIN_OP_BUS, (n,))
+
+    def delay_ms(self, ms):
+        return self.delay_us(int(ms * 1000))
+
+    def delay_us(self, us):
+        self.wait_period += us // 1000 + 1
+        return self._add(BIN_OP_DELAY, us.to_bytes(4, "little"))
+
+    # runs the script on the adapter and fills in results. Returns True if every step succeeded
+    def run(self):
+        rdata = self.adapter.run_batch(bytes(self.script), self.wait_period)
+        self.results = []
+        self.ok = rdata is not None
+        i = 0
+        for op, rlen in self.steps:
+            if rdata is None or i >= len(rdata) or rdata[i] != 0x2e:  # '.'
+                self.ok = False
+                self.results.append(-1 if op in (BIN_OP_IOREAD, BIN_OP_IOREADMASK) else (False if rlen == 0 else None))
+                rdata = None  # the adapter stopped here
+                continue
+            if op == BIN_OP_IOREAD:
+                self.results.append(rdata[i + 1])
+            elif op == BIN_OP_IOREADMASK:
+                self.results.append(int.from_bytes(rdata[i + 1:i + 5], "little"))
+            elif rlen > 0:
+                self.results.append(bytes(rdata[i + 1:i + 1 + rlen]))
+            else:
+                self.results.append(True)
+            i += 1 + rlen
+        return self.ok
+
+# a timed pattern: the steps of a Batch, played to a fixed schedule. Each delay runs from the time the
+# previous delay was due to end (the start of the pattern for the first), not from the end of the steps
+# in between, so the steps' own running times don't add up, and the edges come at the times given to
+# within a few microseconds, the same on every run. For power-up and reset sequencing:
+# with adapter.pattern() as p:
+#     p.io_write_mask(0x3 << 20, 0)           # RESET (GPIO 20) and EN (GPIO 21) low
+#     p.delay_us(100)
+#     p.io_write_mask(1 << 21, 1 << 21)       # EN high at 100 usec
+#     p.delay_us(250)
+#     p.io_write_mask(1 << 20, 1 << 20)       # RESET high at 350 usec
+#     p.delay_ms(2)
+#     p.write(0x40, [0x00, 0x01])             # configure the device at 2.35 msec
+# print(p.ok, p.late_us)
+# the adapter responds once, at the end. late_us is the most any delay was reached after its time had
+# already passed (0 if every step fitted in its slot), or None if a step failed (ok is then False)
+class Pattern(Batch):
+    def __init__(self, adapter, wait_period=2000):
+        super().__init__(adapter, wait_period)
+        self.late_us = None
+
+    def run(self):
+        self.late_us = self.adapter.run_pattern(bytes(self.script), self.wait_period)
+        self.ok = self.late_us is not None
+        return self.ok
+
+# collects the data of a read: into the caller's memoryview if there is one (anything beyond its
+# end is dropped), otherwise into a new buffer
+class _Sink:
+    def __init__(self, into=None):
+        self.into = into
+        self.pos = 0
+        self.buffer = bytearray() if into is None else None
+
+    def add(self, data):
+        if self.into is None:
+            self.buffer += data
+            return
+        n = min(len(data), len(self.into) - self.pos)
+        self.into[self.pos:self.pos + n] = data[:n]
+        self.pos += n
+
+    # the data as bytes, or the number of bytes stored in the caller's memoryview
+    def result(self):
+        return bytes(self.buffer) if self.into is None else self.pos
 
 class EasyAdapter:
-    def __init__(self):
+    def __init__(self, session=True):
         self.txterm = b"\r"
         self.adapter_port = None
         self.cmd_wait_period = 500
         self.dbg_print = False
+        # session mode keeps one serial port open for the lifetime of the adapter,
+        # instead of opening and closing the port for every command
+        self.session = session
+        self.ser = None
+        self.read_slice = 0.02  # upper bound (seconds) on a single blocking read
+        self.framed = False  # True once bin_mode(1) has switched the adapter to binary frames
+        self._memcfg = None  # (reg_bytes, page_size) last sent with memcfg, None if not known
+        self._capture = None  # (first_pin, pin_count, rate) of the latest capture_start
+        # receive buffers, kept from one read to the next: frames are read into _frame_buf, and
+        # hex responses into _hex_buf, which only grows when a longer response comes along
+        self._frame_buf = memoryview(bytearray(5 + FRAME_MAX_PAYLOAD + 2))
+        self._hex_buf = bytearray(HEX_BUF_SIZE)
 
-    # sends a command and returns the serial buffer result
-    def send_command(self, cmd):
+    # opens the persistent serial session (called automatically by init() in session mode)
+    def open(self):
         if self.adapter_port is None:
             print("No easy_adapter selected. Call find_device() first")
+            return False
+        if self.ser is None or not self.ser.is_open:
+            self.ser = serial.Serial(self.adapter_port, 115200, timeout=self.read_slice)
+        return True
+
+    # closes the persistent serial session, if there is one
+    def close(self):
+        if self.ser is not None:
+            self.ser.close()
+            self.ser = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    # returns a serial port ready for a command, or None if no adapter is selected.
+    # in session mode this is the persistent port, otherwise a freshly opened one
+    def _acquire_port(self):
+        if self.adapter_port is None:
+            print("No easy_adapter selected. Call find_device() first")
+            return None
+        if self.session:
+            if not self.open():
+                return None
+            ser = self.ser
+            # discard anything left over from an earlier command that timed out
+            if ser.in_waiting > 0:
+                ser.reset_input_buffer()
+            return ser
+        return serial.Serial(self.adapter_port, 115200, timeout=self.read_slice)
+
+    def _release_port(self, ser):
+        if not self.session:
+            ser.close()
+
+    # converts a wait period in milliseconds (negative means the default) into a deadline
+    def _deadline(self, wait_period):
+        if wait_period < 0:
+            wait_period = self.cmd_wait_period
+        return time.monotonic() + (wait_period / 1000.0)
+
+    # reads from the port until done(buffer) returns True, or the deadline passes.
+    # each read blocks in the OS until data arrives, so no CPU time is spent polling
+    # if done is None, everything received before the deadline is returned
+    def _read_response(self, ser, deadline, done=None):
+        buffer = bytearray()
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return buffer
+            if ser.timeout != self.read_slice:
+                ser.timeout = self.read_slice
+            chunk = ser.read(ser.in_waiting or 1)
+            if chunk:
+                buffer += chunk
+                if done is not None and done(buffer):
+                    return buffer
+
+    # sends a command and returns the serial buffer result
+    # until: optional bytes; the read finishes as soon as the response ends with any of them,
+    # otherwise the full wait period is used (needed for free-text, non-M2M responses)
+    def send_command(self, cmd, until=None, wait_period=-1):
+        ser = self._acquire_port()
+        if ser is None:
             return
-        ser = serial.Serial(self.adapter_port, 115200, timeout=0.2)
         if self.dbg_print:
             print(f"dbg send_command: {cmd}")
+        deadline = self._deadline(wait_period)
+        if self.framed:
+            # return the RESP frame content in the same order as the ASCII response
+            ftype, seq, payload = self._frame_command(ser, cmd, deadline)
+            self._release_port(ser)
+            if ftype != FRAME_RESP or len(payload) == 0:
+                return b""
+            return payload[1:] + payload[:1]
         ser.write(cmd.encode() + self.txterm)
-        buffer = bytes()
-        now = time.time_ns() // 1000000
-        while ((time.time_ns() // 1000000) - now) < self.cmd_wait_period:
-            if ser.in_waiting > 0:
-                buffer += ser.read(ser.in_waiting)
-        ser.close()
+        done = None
+        if until is not None:
+            done = lambda buf: buf[-1] in until
+        buffer = bytes(self._read_response(ser, deadline, done))
+        self._release_port(ser)
         return buffer
     
     # sends a command and decodes the response (only use this function in m2m mode)
     # returns 1 if '.' is received, 2 if '&' is received,
-    # returns 3 if '~' (protocol error) received, 0 for general error
+    # returns 3 if '~' (protocol error) received, 4 if 'T' (bus timeout, the adapter recovered the bus)
+    # received, 0 for general error
     def send_and_confirm(self, cmd, wait_period=-1):
-        if self.adapter_port is None:
-            print("No easy_adapter selected. Call find_device() first")
+        ser = self._acquire_port()
+        if ser is None:
             return
-        if wait_period < 0:
-            wait_period = self.cmd_wait_period
-        ser = serial.Serial(self.adapter_port, 115200, timeout=0.2)
         if self.dbg_print:
             print(f"dbg send_and_confirm: {cmd}")
-        ser.write(cmd.encode() + self.txterm)
-        buffer = bytes()
+        deadline = self._deadline(wait_period)
+        if self.framed:
+            ftype, seq, payload = self._frame_command(ser, cmd, deadline)
+            buffer = payload[:1] if ftype == FRAME_RESP else b""
+        else:
+            ser.write(cmd.encode() + self.txterm)
+            buffer = self._read_response(ser, deadline, lambda buf: buf[-1] in b".&~XT")
+        self._release_port(ser)
         resp_found = 0
-        now = time.time_ns() // 1000000
-        while ((time.time_ns() // 1000000) - now) < wait_period:
-            if ser.in_waiting > 0:
-                buffer += ser.read(ser.in_waiting)
-                if b"." in buffer:
-                    resp_found = 1
-                    break
-                if b"&" in buffer:
-                    resp_found = 2
-                    break
-                if b"~" in buffer:
-                    resp_found = 3
-                    break
-        ser.close()
+        if b"." in buffer:
+            resp_found = 1
+        elif b"&" in buffer:
+            resp_found = 2
+        elif b"~" in buffer:
+            resp_found = 3
+        elif b"T" in buffer:
+            resp_found = 4
         if resp_found == 0:
-            print(f"Error, sent '{cmd}' but received '{buffer}'")
+            print(f"Error, sent '{cmd}' but received '{bytes(buffer)}'")
         return resp_found
     
+    # opens port, sends device? and waits for the reply, until deadline.
+    # returns (board, ser) with the port left open, or (None, None); exceptions are left to the caller
+    def _probe(self, port, deadline):
+        ser = serial.Serial(port, 115200, timeout=self.read_slice)
+        try:
+            ser.write(self.txterm + b"device?" + self.txterm)
+            buffer = self._read_response(ser, deadline, lambda buf: DEVICE_ID_RE.search(buf) is not None)
+        except Exception:
+            ser.close()
+            raise
+        m = DEVICE_ID_RE.search(buffer)
+        if m is None:
+            ser.close()
+            return None, None
+        return int(m.group(1)), ser
+
+    # probes the candidate ports (ListPortInfo entries) all at once, so that discovery takes one
+    # wait period rather than one per port. Updates the port cache with every adapter that answered.
+    # returns a list of (port, board, ser) in port order, each ser left open
+    def _discover(self, infos, wait_period=-1):
+        candidates = _candidate_ports(infos)
+        found = []
+        if len(candidates) == 0:
+            return found
+        deadline = self._deadline(wait_period)
+        self._perm_error = False
+
+        def probe(info):
+            try:
+                return self._probe(info.device, deadline)
+            except serial.SerialException as e:
+                if "PermissionError" in str(e):
+                    self._perm_error = True
+            except Exception as e:
+                print(f"Error: {e}")
+            return None, None
+
+        with ThreadPoolExecutor(max_workers=len(candidates)) as pool:
+            replies = list(pool.map(probe, candidates))
+        cache = _load_port_cache()
+        for info, (board, ser) in zip(candidates, replies):
+            if board is None:
+                continue
+            found.append((info.device, board, ser))
+            cache[f"easy_adapter_{board}"] = {"port": info.device, "serial_number": info.serial_number,
+                                               "vid": info.vid, "pid": info.pid, "time": int(time.time())}
+        _save_port_cache(cache)
+        return found
+
+    # the port that the cache says board is at: the port with the cached USB serial number if the
+    # platform reports one (the port name can change between connections), otherwise the cached port name
+    def _cached_port(self, board, infos):
+        entry = _load_port_cache().get(f"easy_adapter_{board}")
+        if not isinstance(entry, dict):
+            return None
+        for info in infos:
+            if entry.get("serial_number") is not None and info.serial_number == entry["serial_number"]:
+                return info.device
+        for info in infos:
+            if info.device == entry.get("port"):
+                return info.device
+        return None
+
+    # selects port as the adapter, with ser as its open session port
+    def _select(self, board, port, ser):
+        print(f"Found easy_adapter_{board} at port {port}")
+        self.adapter_port = port
+        self.framed = False  # device? always returns the adapter to ASCII input
+        self._memcfg = (1, 0)  # and resets the memcfg settings
+        if self.session:
+            self.close()
+            self.ser = ser  # keep the port open for the session
+        else:
+            ser.close()
+        return port
+
     # finds the easy_adapter device by searching available COM ports.
     # this function is called automatically by init() so the user doesn't have to call it
-    def find_device(self, board=0):
-        perm_error = 0
-        ports = list_ports.comports()
-        for port in ports:
-            # try to see if port can be opened
+    # port: check only this port, for instance the pseudo-terminal of the host simulation build
+    # the port that the board was last found at is checked first (see PORT_CACHE_FILE); if the board
+    # isn't there, all ports with the adapter's USB IDs are probed in parallel, and the cache is updated.
+    # use_cache=False skips the cached port
+    def find_device(self, board=0, port=None, use_cache=True):
+        self._perm_error = False
+        if port is not None:
             try:
-                ser = serial.Serial(port.device, 115200, timeout=0.2)
-                ser.write(self.txterm + b"device?" + self.txterm)
-                found = 0
-                buffer = bytes()
-                now = time.time_ns() // 1000000
-                while ((time.time_ns() // 1000000) - now) < self.cmd_wait_period:
-                    if ser.in_waiting > 0:
-                        buffer += ser.read(ser.in_waiting)
-                if b"easy_adapter_" + str(board).encode() in buffer:
-                # if b"easy_adapter" in buffer:
-                    found = 1
-                if found == 1:
-                    print(f"Found easy_adapter_{board} at port {port.device}")
-                    self.adapter_port = port.device
-                    return port.device
-                else:
+                found, ser = self._probe(port, self._deadline(-1))
+                if found == board:
+                    return self._select(board, port, ser)
+                if ser is not None:
                     ser.close()
             except serial.SerialException as e:
                 if "PermissionError" in str(e):
-                    perm_error = 1
-                pass
+                    self._perm_error = True
             except Exception as e:
                 print(f"Error: {e}")
-                pass
-        if perm_error == 1:
+        else:
+            infos = list_ports.comports()
+            cached = self._cached_port(board, infos) if use_cache else None
+            if cached is not None:
+                try:
+                    found, ser = self._probe(cached, self._deadline(-1))
+                    if found == board:
+                        return self._select(board, cached, ser)
+                    if ser is not None:
+                        ser.close()
+                except Exception:
+                    pass  # the cache is stale, probe all the ports
+            selected = None
+            for p, found, ser in self._discover(infos):
+                if found == board and selected is None:
+                    selected = (p, ser)
+                else:
+                    ser.close()
+            if selected is not None:
+                return self._select(board, selected[0], selected[1])
+        if self._perm_error:
             print("Permission error. Close any serial console that may be using the port")
             print("Try using sudo if you're using Linux")
         else:
@@ -107,23 +629,373 @@ class EasyAdapter:
     # enters or exits M2M mode, 1 for entering the mode, 0 for exiting
     def m2m_mode(self, val):
         cmd = f"m2m_resp:{val}"
-        buffer = self.send_command(cmd)
         if val == 1:
-            if b"." not in buffer:
+            buffer = self.send_command(cmd, until=b".")
+            if buffer is None or b"." not in buffer:
                 print(f"Error entering M2M mode")
         else:
-            if b"M2M response off" not in buffer:
+            buffer = self.send_command(cmd, until=b"\n")
+            if buffer is None or b"M2M response off" not in buffer:
                 print(f"Error exiting M2M mode")
     
+    # enters or exits the framed binary M2M mode, 1 for entering the mode, 0 for exiting
+    # M2M mode must already be on. In binary mode, commands travel in CRC-checked frames,
+    # and i2c_write/i2c_read move their data in DATA frames with several frames in flight
+    # at once, rather than 16-byte lines that each wait for an '&'
+    def bin_mode(self, val):
+        if val == 1:
+            buffer = self.send_command("bin", until=b".X")
+            if buffer is None or b"." not in buffer:
+                print(f"Error entering binary mode")
+                return False
+            self.framed = True
+        else:
+            result = self.send_and_confirm("ascii")
+            self.framed = False
+            if result != 1:
+                print(f"Error exiting binary mode")
+                return False
+        return True
+
+    def _send_frame(self, ser, ftype, seq, payload=b""):
+        n = len(payload)
+        body = bytes((ftype, seq & 0xff, n & 0xff, n >> 8)) + bytes(payload)
+        crc = binascii.crc_hqx(body, 0xFFFF)
+        ser.write(bytes((FRAME_SOF,)) + body + bytes((crc & 0xff, crc >> 8)))
+
+    # reads exactly n bytes into the frame buffer at pos, returns False if the deadline passes first
+    def _read_exact(self, ser, pos, n, deadline):
+        end = pos + n
+        while pos < end:
+            if time.monotonic() >= deadline:
+                return False
+            if ser.timeout != self.read_slice:
+                ser.timeout = self.read_slice
+            pos += ser.readinto(self._frame_buf[pos:end])
+        return True
+
+    # reads one frame and returns (type, seq, payload)
+    # type is None if the deadline passed, or FRAME_BAD if the frame failed its CRC check
+    def _read_frame(self, ser, deadline):
+        buf = self._frame_buf
+        while True:
+            if not self._read_exact(ser, 0, 1, deadline):
+                return None, 0, b""
+            if buf[0] == FRAME_SOF:
+                break
+        if not self._read_exact(ser, 1, 4, deadline):
+            return None, 0, b""
+        n = buf[3] | (buf[4] << 8)
+        if n > FRAME_MAX_PAYLOAD:
+            return FRAME_BAD, buf[2], b""
+        if not self._read_exact(ser, 5, n + 2, deadline):
+            return None, 0, b""
+        crc = binascii.crc_hqx(buf[1:5 + n], 0xFFFF)
+        if crc != (buf[5 + n] | (buf[6 + n] << 8)):
+            return FRAME_BAD, buf[2], b""
+        return buf[1], buf[2], bytes(buf[5:5 + n])
+
+    # sends a command line in a LINE frame, and returns the first frame received in reply
+    # a line that arrived corrupted (NAK) is sent once more
+    def _frame_command(self, ser, cmd, deadline):
+        for attempt in range(2):
+            self._send_frame(ser, FRAME_LINE, 0, cmd.encode())
+            ftype, seq, payload = self._read_frame(ser, deadline)
+            if ftype != FRAME_NAK and ftype != FRAME_BAD:
+                break
+        return ftype, seq, payload
+
+    # converts a RESP frame into the send_and_confirm result codes
+    def _resp_code(self, ftype, payload):
+        if ftype != FRAME_RESP or len(payload) == 0:
+            return 0
+        return {0x2e: 1, 0x26: 2, 0x7e: 3, 0x54: 4}.get(payload[0], 0)
+
+    # streams data to the adapter in DATA frames, keeping up to 'credit' frames unacknowledged
+    # returns the send_and_confirm style result code of the RESP that ends the transfer
+    def _stream_out(self, ser, data, credit, wait_period):
+        chunks = [data[i:i + FRAME_DATA_CHUNK] for i in range(0, len(data), FRAME_DATA_CHUNK)]
+        nxt = 0
+        acked = 0
+        while True:
+            while nxt < len(chunks) and (nxt - acked) < credit:
+                self._send_frame(ser, FRAME_DATA, nxt, chunks[nxt])
+                nxt += 1
+            ftype, seq, resp = self._read_frame(ser, self._deadline(wait_period))
+            if ftype == FRAME_ACK:
+                delta = (seq + 1 - acked) & 0xff
+                if delta <= nxt - acked:
+                    acked += delta
+                if len(resp) > 0 and resp[0] > 0:
+                    credit = resp[0]
+            elif ftype == FRAME_NAK:
+                delta = (seq - acked) & 0xff
+                if delta < nxt - acked:
+                    acked += delta
+                    nxt = acked  # go back and resend from the requested frame
+            else:
+                return self._resp_code(ftype, resp)
+
+    # collects DATA frames until the RESP that ends a read, acknowledging each one,
+    # and asks for a resend (NAK) from the first frame that is missing or corrupted
+    # frame is the first (type, seq, payload) already received in reply to the command
+    # returns (result code, data), the data includes anything carried in the RESP itself
+    def _stream_in(self, ser, frame, wait_period, into=None):
+        ftype, seq, resp = frame
+        sink = _Sink(into)
+        expected = 0
+        nak_sent = False
+        while True:
+            if ftype == FRAME_DATA:
+                if seq == (expected & 0xff):
+                    sink.add(resp)
+                    expected += 1
+                    nak_sent = False
+                    self._send_frame(ser, FRAME_ACK, seq, bytes((FRAME_WINDOW,)))
+                elif not nak_sent and ((seq - expected) & 0xff) < 128:
+                    self._send_frame(ser, FRAME_NAK, expected)
+                    nak_sent = True
+            elif ftype == FRAME_BAD:
+                if not nak_sent:
+                    self._send_frame(ser, FRAME_NAK, expected)
+                    nak_sent = True
+            else:
+                break
+            ftype, seq, resp = self._read_frame(ser, self._deadline(wait_period))
+        result = self._resp_code(ftype, resp)
+        if result == 1:
+            sink.add(memoryview(resp)[1:])
+        return result, sink.result()
+
+    # sends a binary command (FRAME_CMD, see BIN_OP_ in m2mframe.h) and returns (result code, data)
+    # header: the fixed fields after the opcode; data: raw bytes to write, if any.
+    # as much data as fits goes in the command frame, the adapter asks for the rest as DATA frames
+    # into: a memoryview to receive the data read, in which case the number of bytes is returned instead
+    def _bin_command(self, op, header, data=b"", wait_period=-1, into=None):
+        ser = self._acquire_port()
+        if ser is None:
+            return 0, b""
+        if self.dbg_print:
+            print(f"dbg _bin_command: op {op:02x} header {bytes(header).hex()} {len(data)} data bytes")
+        room = FRAME_MAX_PAYLOAD - 1 - len(header)
+        payload = bytes((op,)) + bytes(header) + bytes(data[:room])
+        self._send_frame(ser, FRAME_CMD, 0, payload)
+        frame = self._read_frame(ser, self._deadline(wait_period))
+        if frame[0] == FRAME_ACK and len(data) > room:
+            credit = frame[2][0] if len(frame[2]) > 0 and frame[2][0] > 0 else FRAME_WINDOW
+            result = self._stream_out(ser, bytes(data[room:]), credit, wait_period)
+            rdata = b"" if into is None else 0
+        else:
+            result, rdata = self._stream_in(ser, frame, wait_period, into)
+        self._release_port(ser)
+        return result, rdata
+
+    # returns a Batch, to collect I2C and GPIO steps that the adapter runs in one round trip
+    def batch(self, wait_period=2000):
+        return Batch(self, wait_period)
+
+    # returns a Pattern, to collect GPIO (and I2C) steps that the adapter plays to a fixed schedule
+    def pattern(self, wait_period=2000):
+        return Pattern(self, wait_period)
+
+    # sends a batch script (see Batch) and returns the per-step results as raw bytes:
+    # each step's response character followed by any data it read. Returns None if the
+    # adapter rejected the script. The script can be up to 256 bytes
+    def run_batch(self, script, wait_period=2000):
+        rdata = self._run_script(BIN_OP_BATCH, "batch", script, wait_period)
+        if rdata is None:
+            print("run_batch was unsuccessful")
+        return rdata
+
+    # sends a batch script to be played as a timed pattern (see Pattern), and returns how late it
+    # ran at most, in microseconds, or None if the script was rejected or a step failed
+    def run_pattern(self, script, wait_period=2000):
+        rdata = self._run_script(BIN_OP_PATTERN, "pattern", script, wait_period)
+        if rdata is None or len(rdata) != 4:
+            print("run_pattern was unsuccessful")
+            return None
+        return int.from_bytes(rdata, "little")
+
+    # sends a script like the data of a write, with the batch or pattern command, and returns the data
+    # of the response, or None if unsuccessful
+    def _run_script(self, op, cmd, script, wait_period):
+        if self.framed:
+            result, rdata = self._bin_command(op, (len(script) & 0xff, len(script) >> 8), script, wait_period)
+            return rdata if result == 1 else None
+        self.send_and_confirm(f"bytes:{len(script)}")
+        lines = [bytes(script[i:i + 16]).hex(" ") for i in range(0, len(script), 16)]
+        lines[0] = f"{cmd} {lines[0]}"
+        for line in lines[:-1]:
+            result = self.send_and_confirm(line)
+            if result != 2:
+                print(f"Error sending {cmd}. Expected 2(&) but received {result}")
+                return None
+        return self._read_hex_response(lines[-1], wait_period)
+
+    # streams samples of device registers, read by the adapter at a fixed period and timestamped by it
+    # items: list of (addr, reg, num_bytes), up to 8; period_us: sampling period in microseconds (at least 100)
+    # yields (index, timestamp_us, data) for each sample, where data has one entry per item: the bytes read,
+    # or None if the read failed. index counts periods, so a gap means samples were skipped.
+    # the stream stops when the generator is closed (for instance by leaving the for loop) or after max_samples
+    # example, logging a temperature register every 1 msec:
+    # for index, t, (temp,) in adapter.stream(1000, [(0x48, 0x00, 2)], max_samples=1000):
+    #     print(t, temp.hex())
+    def stream(self, period_us, items, max_samples=None, wait_period=-1):
+        ser = self._acquire_port()
+        if ser is None:
+            return
+        lengths = [n for (addr, reg, n) in items]
+        count = 0
+        try:
+            if self.framed:
+                header = int(period_us).to_bytes(4, "little") + bytes(v for item in items for v in item)
+                self._send_frame(ser, FRAME_CMD, 0, bytes((BIN_OP_STREAM,)) + header)
+                ftype, seq, payload = self._read_frame(ser, self._deadline(wait_period))
+                if self._resp_code(ftype, payload) != 1:
+                    print("Error starting stream")
+                    return
+                index = 0
+                while max_samples is None or count < max_samples:
+                    ftype, seq, payload = self._read_frame(ser, self._deadline(wait_period) + period_us / 1e6)
+                    if ftype != FRAME_SAMPLE:
+                        print("Stream interrupted")
+                        return
+                    index += (seq - index) & 0xff  # the frame carries the low byte of the index
+                    yield index, int.from_bytes(payload[:8], "little"), self._stream_sample(payload[8:], lengths)
+                    count += 1
+            else:
+                cmd = f"stream:{int(period_us)} " + " ".join(f"0x{a:02x},0x{r:02x},{n}" for (a, r, n) in items)
+                ser.write(cmd.encode() + self.txterm)
+                buffer = self._read_response(ser, self._deadline(wait_period), lambda buf: buf[-1] in b".X")
+                if not buffer.endswith(b"."):
+                    print("Error starting stream")
+                    return
+                buffer = bytearray()
+                while max_samples is None or count < max_samples:
+                    if b"\n" not in buffer:
+                        buffer += self._read_response(ser, self._deadline(wait_period) + period_us / 1e6,
+                                                      lambda buf: b"\n" in buf)
+                        if b"\n" not in buffer:
+                            print("Stream interrupted")
+                            return
+                    line, _, buffer = buffer.partition(b"\n")
+                    fields = line.decode().split()
+                    data = [None if f in ("~", "T") else bytes.fromhex(f) for f in fields[2:]]
+                    yield int(fields[0]), int(fields[1]), data
+                    count += 1
+        finally:
+            self._stop_stream(ser, wait_period)
+            self._release_port(ser)
+
+    # splits the items of a binary mode stream sample, each is a response char followed by its data
+    def _stream_sample(self, payload, lengths):
+        data = []
+        i = 0
+        for n in lengths:
+            data.append(bytes(payload[i + 1:i + 1 + n]) if payload[i:i + 1] == b"." else None)
+            i += 1 + n
+        return data
+
+    # stops a stream, discarding any samples still on their way, up to the response to the stop command
+    def _stop_stream(self, ser, wait_period):
+        if self.framed:
+            self._send_frame(ser, FRAME_CMD, 0, bytes((BIN_OP_STREAM, 0, 0, 0, 0)))
+            deadline = self._deadline(wait_period)
+            while True:
+                ftype, seq, payload = self._read_frame(ser, deadline)
+                if ftype is None or ftype == FRAME_RESP:
+                    break
+        else:
+            ser.write(b"stream:stop" + self.txterm)
+            self._read_response(ser, self._deadline(wait_period), lambda buf: buf[-1] in b".X")
+
     # tries an I2C address, returns True if the address is found, False otherwise
-    def i2c_try_address(self, addr):
+    def i2c_try_address(self, addr, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_TRYADDR, (addr,), wait_period=wait_period)
+            return result == 1
         cmd = f"tryaddr:0x{addr:02x}"
-        result = self.send_and_confirm(cmd)
+        result = self.send_and_confirm(cmd, wait_period)
         if result == 1:
             return True
         else:
             return False
     
+    # sets the I2C bus speed in Hz, for example 400000 for Fast-mode or 1000000 for Fast-mode Plus
+    # the speed stays in effect (including for i2c_try_address) until changed or power-cycled
+    # returns the actual speed the adapter achieved, or None if unsuccessful
+    def set_bus_speed(self, hz, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_SPEED, int(hz).to_bytes(4, "little"),
+                                              wait_period=wait_period)
+            if result != 1 or len(rdata) != 4:
+                print(f"Error setting bus speed to {hz} Hz")
+                return None
+            return int.from_bytes(rdata, "little")
+        buffer = self.send_command(f"speed:{int(hz)}", until=b".X", wait_period=wait_period)
+        if buffer is None or not buffer.endswith(b"."):
+            print(f"Error setting bus speed to {hz} Hz")
+            return None
+        return int(buffer[:-1])
+
+    # selects the I2C bus used by the I2C calls that follow (and i2c_scan, i2c_try_address), until
+    # selected again. Bus 0 (GPIO 14 and 15) is always there, buses 1 to 3 are set up with bus_config.
+    # In binary mode, transfers already sent on one bus carry on while the next bus starts
+    # returns True if successful, False otherwise
+    def select_bus(self, bus, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_BUS, (bus,), wait_period=wait_period)
+        else:
+            result = self.send_and_confirm(f"bus:{bus}", wait_period)
+        if result != 1:
+            print(f"Error selecting I2C bus {bus}")
+            return False
+        return True
+
+    # sets up I2C bus 1 to 3 on the given GPIO pins, or releases it (its pins become plain GPIOs) if
+    # sda is None. Bus 1 is the I2C0 controller, with SDA on GPIO 0, 4, 8 ... and SCL on GPIO 1, 5, 9 ...;
+    # buses 2 and 3 run on the adapter's PIO, on any free pins with scl = sda + 1
+    # example, for a second bus on GPIO 4 and 5, and a third on GPIO 10 and 11:
+    # bus_config(1, 4, 5)
+    # bus_config(2, 10, 11)
+    # returns True if successful, False otherwise
+    def bus_config(self, bus, sda=None, scl=None, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_BUSCFG, (bus, 0xff if sda is None else sda,
+                                                              0xff if scl is None else scl),
+                                              wait_period=wait_period)
+        elif sda is None:
+            result = self.send_and_confirm(f"buscfg:{bus}", wait_period)
+        else:
+            result = self.send_and_confirm(f"buscfg:{bus},{sda},{scl}", wait_period)
+        if result != 1:
+            print(f"Error configuring I2C bus {bus}")
+            return False
+        return True
+
+    # scans a range of I2C addresses on the adapter, in a single command
+    # returns a list of (address, names) for each device that responded, where names
+    # is the list of possible devices at that address, from the known address table (db)
+    # returns None if the scan was unsuccessful
+    # example:
+    # for addr, names in adapter.i2c_scan():
+    #     print(f"0x{addr:02x}: {', '.join(names)}")
+    def i2c_scan(self, first=0x08, last=0x77, wait_period=2000):
+        if self.framed:
+            result, bitmap = self._bin_command(BIN_OP_SCAN, (first, last), wait_period=wait_period)
+            bitmap = self._check_read_result(result, bitmap, "i2c_scan")
+        else:
+            bitmap = self._read_hex_response(f"scan:0x{first:02x},0x{last:02x}", wait_period)
+            if bitmap is None:
+                print("i2c_scan was unsuccessful")
+        if bitmap is None or len(bitmap) != 16:
+            return None
+        found = []
+        for addr in range(first, last + 1):
+            if bitmap[addr // 8] & (1 << (addr % 8)):
+                found.append((addr, self.get_known_device_names(addr, self.db)))
+        return found
+
     # sends an I2C write command to the adapter
     # addr: I2C address
     # byte1: first byte to send
@@ -135,122 +1007,301 @@ class EasyAdapter:
     # pass the first byte as data[0] and the rest as data[1:]
     # returns True if the command was successful, False otherwise
     def i2c_write(self, addr, byte1, data, hold=0):
+        if self.framed:
+            payload = bytes([byte1]) + bytes(data)
+            op = BIN_OP_WRITE_HOLD if hold == 1 else BIN_OP_WRITE
+            result, rdata = self._bin_command(op, (addr, len(payload) & 0xff, len(payload) >> 8), payload, 2000)
+            return self._check_write_result(result)
         cmd = f"addr:0x{addr:02x}"
         result = self.send_and_confirm(cmd)
         num_bytes = len(data) + 1
         cmd = f"bytes:{num_bytes}"
         result = self.send_and_confirm(cmd)
         if hold == 1:
-            cmd = f"send+hold {byte1:02x}"
+            cmd = "send+hold"
         else:
-            cmd = f"send {byte1:02x}"
-        # loop though the data, in groups of 16 bytes
-        for i in range(1, len(data)+1):
-            if (i) % 16 != 0:
-                if cmd == "":  # this is a new line, no need for preceding space
-                    cmd += f"{data[i-1]:02x}"
-                else:
-                    cmd += f" {data[i-1]:02x}"
-            else:
-                result = self.send_and_confirm(cmd, wait_period=2000)
-                cmd = ""
-                if i != len(data) - 1:
-                    if self.dbg_print:
-                        print(f"checking for &, i is {i}, len(data) is {len(data)}")
-                    # check if the result represents the '&' continuation character
-                    if result == 3:
-                        print("Protocol error, does the I2C device exist?")
-                        return False
-                    elif result != 2:
-                        print(f"Error sending. Expected 2(&) but received {result}")
-                        return False
-                    cmd = f"{data[i-1]:02x}"
-                else:
-                    # check if the result represents the '.' character
-                    if self.dbg_print:
-                        print(f"i is {i}, len(data) is {len(data)}")
-                        print("checking for .")
-                    if result == 3:
-                        print("Protocol error, does the I2C device exist?")
-                        return False
-                    elif result != 1:
-                        print(f"Error sending. Expected 1(.) but received {result}")
-                        return False
-        # send any remaining content if cmd is not empty
-        if cmd != "":
-            if self.dbg_print:
-                print("sending remainder")
-            result = self.send_and_confirm(cmd, wait_period=2000)
-            # check if the result represents contains the '.' character
-            if result == 3:
-                print("Protocol error, does the I2C device exist?")
-                return False
-            elif result != 1:
-                print(f"Error sending. Expected 1(.) but received {result}")
+            cmd = "send"
+        return self._send_hex_lines(cmd, [byte1] + list(data))
+    
+    # sends cmd followed by the data as hex byte tokens, in lines of 16 bytes
+    # the adapter answers '&' after each line while it expects more bytes, and '.' after the last
+    def _send_hex_lines(self, cmd, data, wait_period=2000):
+        for i in range(0, len(data), 16):
+            line = bytes(data[i:i + 16]).hex(" ")
+            if i == 0:
+                line = f"{cmd} {line}"
+            result = self.send_and_confirm(line, wait_period=wait_period)
+            if i + 16 < len(data):
+                if self.dbg_print:
+                    print(f"checking for &, i is {i}, len(data) is {len(data)}")
+                # check if the result represents the '&' continuation character
+                if result == 3:
+                    print("Protocol error, does the I2C device exist?")
+                    return False
+                elif result == 4:
+                    print("Bus timeout, the adapter has recovered the bus")
+                    return False
+                elif result != 2:
+                    print(f"Error sending. Expected 2(&) but received {result}")
+                    return False
+            elif not self._check_write_result(result):
                 return False
         if self.dbg_print:
             print("done!")
         return True
+
+    # checks the result code of the final response to a write
+    def _check_write_result(self, result):
+        if result == 3:
+            print("Protocol error, does the I2C device exist?")
+            return False
+        elif result == 4:
+            print("Bus timeout, the adapter has recovered the bus")
+            return False
+        elif result != 1:
+            print(f"Error sending. Expected 1(.) but received {result}")
+            return False
+        return True
+
+    # checks the result code and data of a binary mode read
+    def _check_read_result(self, result, rdata, name):
+        if result == 1:
+            return rdata
+        if result == 3:
+            print("Protocol error, does the I2C device exist?")
+        elif result == 4:
+            print("Bus timeout, the adapter has recovered the bus")
+        print(f"{name} was unsuccessful")
+        return None
     
     # sends an I2C read command to the adapter and returns the data read
     # addr: I2C address
     # num_bytes: number of bytes to read
+    # wait_period: maximum time (ms) to wait for each line of the response
     # returns the data read as a byte array
     # returns None if the read was unsuccessful
-    def i2c_read(self, addr, num_bytes):
-        status = False
+    def i2c_read(self, addr, num_bytes, wait_period=-1):
+        buffer = bytearray(num_bytes)
+        count = self.i2c_read_into(addr, buffer, wait_period)
+        if count is None:
+            return None
+        return bytes(buffer) if count == num_bytes else bytes(buffer[:count])
+
+    # reads len(buf) bytes into buf, which can be a bytearray, a memoryview or a NumPy array
+    # (any writable, contiguous buffer), so that repeated reads can reuse the same buffer
+    # returns the number of bytes read, or None if the read was unsuccessful
+    # example:
+    # buf = bytearray(64)
+    # n = adapter.i2c_read_into(0x50, buf)
+    def i2c_read_into(self, addr, buf, wait_period=-1):
+        view = memoryview(buf).cast("B")
+        num_bytes = len(view)
+        if self.framed:
+            result, count = self._bin_command(BIN_OP_READ, (addr, num_bytes & 0xff, num_bytes >> 8),
+                                              wait_period=wait_period, into=view)
+            return self._check_read_result(result, count, "i2c_read")
         cmd = f"addr:0x{addr:02x}"
         result = self.send_and_confirm(cmd)
         cmd = f"bytes:{num_bytes}"
         result = self.send_and_confirm(cmd)
-        cmd = "recv"
-        if self.adapter_port is None:
-            print("No easy_adapter selected. Call find_device() first")
+        count = self._read_hex_response("recv", wait_period, view)
+        if count is None:
+            print("i2c_read was unsuccessful")
+        return count
+
+    # reads count values of a NumPy dtype, for instance ">i2" for big-endian 16-bit samples, into a
+    # new array, or into out (whose size then sets the count). Returns the array, or None if unsuccessful
+    def i2c_read_array(self, addr, count=None, dtype="u1", out=None, wait_period=-1):
+        import numpy as np  # NumPy is only needed for the _array calls
+        if out is None:
+            out = np.empty(count, dtype)
+        if self.i2c_read_into(addr, out, wait_period) != out.nbytes:
+            return None
+        return out
+
+    # reads one line of a hex response into the hex buffer at pos, until it ends with an M2M response
+    # character, the deadline passes, or HEX_LINE_MAX bytes have arrived. Returns the new end of the data
+    def _read_hex_line(self, ser, pos, deadline):
+        view = memoryview(self._hex_buf)
+        end = pos + HEX_LINE_MAX
+        while pos < end:
+            if time.monotonic() >= deadline:
+                break
+            if ser.timeout != self.read_slice:
+                ser.timeout = self.read_slice
+            n = ser.readinto(view[pos:pos + min(ser.in_waiting or 1, end - pos)])
+            pos += n
+            # after an empty read, view[pos - 1] is left over from the line before, or an earlier response
+            if n > 0 and view[pos - 1] in b"&.X~T":
+                break
+        return pos
+
+    # sends a command whose M2M response is hex data in lines of 16 bytes, each ending with '&'
+    # which is answered with '&' to continue. Returns the data, or None if unsuccessful
+    # into: a memoryview to decode the data into, in which case the number of bytes is returned instead
+    def _read_hex_response(self, cmd, wait_period=-1, into=None):
+        status = False
+        ser = self._acquire_port()
+        if ser is None:
             return
-        ser = serial.Serial(self.adapter_port, 115200, timeout=0.2)
         if self.dbg_print:
-            print(f"dbg i2c_read: {cmd}")
+            print(f"dbg _read_hex_response: {cmd}")
         ser.write(cmd.encode() + self.txterm)
-        buffer = bytes()
-        now = time.time_ns() // 1000000
-        while ((time.time_ns() // 1000000) - now) < self.cmd_wait_period:
-            if ser.in_waiting > 0:
-                buffer += ser.read(ser.in_waiting)
-                now = time.time_ns() // 1000000 # reset the timer
-                if buffer[-1] == 38:  # check if the last byte is an '&' character
-                    # we need to send back an '&' character to the adapter
-                    ser.write(b"&")
-                elif buffer[-1] == 46: # check if the last byte is a '.' character
-                    # no more data to read, we are done
-                    status = True
-                    break
-                elif buffer[-1] == 88: # check if the last byte is an 'X' character
-                    # error
-                    status = False
-                    break
-                elif buffer[-1] == 126: # check if the last byte is a '~' character
-                    # protocol error
-                    print("Protocol error, does the I2C device exist?")
-                    status = False
-                    break
-        ser.close()
+        buf = self._hex_buf
+        if into is not None and len(buf) < len(into) * 3 + len(into) // 16 + HEX_LINE_MAX:
+            buf.extend(bytes(len(into) * 3 + len(into) // 16 + HEX_LINE_MAX - len(buf)))
+        fill = 0
+        while True:
+            if len(buf) - fill < HEX_LINE_MAX:
+                buf.extend(bytes(len(buf)))
+            # the deadline restarts for every line, as the adapter sends 16 bytes at a time
+            deadline = self._deadline(wait_period)
+            n = self._read_hex_line(ser, fill, deadline)
+            if n == fill:
+                break
+            fill = n
+            end = buf[fill - 1]
+            if end == 38:  # check if the last byte is an '&' character
+                # it becomes a separator, so that the whole response is decoded in one go at the end
+                buf[fill - 1] = 32
+                # we need to send back an '&' character to the adapter
+                ser.write(b"&")
+            elif end == 46: # check if the last byte is a '.' character
+                # no more data to read, we are done
+                fill -= 1
+                status = True
+                break
+            elif end == 88: # check if the last byte is an 'X' character
+                # error
+                status = False
+                break
+            elif end == 126: # check if the last byte is a '~' character
+                # protocol error
+                print("Protocol error, does the I2C device exist?")
+                status = False
+                break
+            elif end == 84: # check if the last byte is a 'T' character
+                # bus timeout
+                print("Bus timeout, the adapter has recovered the bus")
+                status = False
+                break
+            else:
+                break  # timed out part-way through a line
+        self._release_port(ser)
         if status:
-            # read the hex data from the buffer, ignoring any & and . characters and save in a byte array
-            buffer = buffer.replace(b"&", b"").replace(b".", b"")
-            buffer = bytes.fromhex(buffer.decode())
+            with memoryview(buf) as view:
+                try:
+                    data = bytes.fromhex(str(view[:fill], "ascii"))
+                except ValueError:
+                    return None
             if self.dbg_print:
                 print("done!")
-            return buffer
+            if into is None:
+                return data
+            sink = _Sink(into)
+            sink.add(data)
+            return sink.result()
+        return None
+
+    # sets the register address size (1 or 2 bytes) and the page size (0 if the device is not paged)
+    # used by mem_read and mem_write. The adapter is only sent memcfg when the settings change
+    # returns True if successful, False otherwise
+    def mem_config(self, reg_bytes=1, page_size=0, wait_period=-1):
+        if self._memcfg == (reg_bytes, page_size):
+            return True
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_MEMCFG, (reg_bytes, page_size & 0xff, page_size >> 8),
+                                              wait_period=wait_period)
         else:
-            print("i2c_read was unsuccessful")
+            buffer = self.send_command(f"memcfg:{reg_bytes},{page_size}", until=b".X", wait_period=wait_period)
+            result = 1 if buffer is not None and buffer.endswith(b".") else 0
+        if result != 1:
+            print(f"Error setting {reg_bytes}-byte register addresses with page size {page_size}")
+            self._memcfg = None
+            return False
+        self._memcfg = (reg_bytes, page_size)
+        return True
+
+    # reads num_bytes (up to 65536) from a register (memory) address of an I2C device,
+    # by writing the register address and then reading with a repeated start
+    # reg_bytes: 2 for devices with 16-bit addresses, such as EEPROMs from 32 Kbit upwards
+    # returns the data read as a byte array, or None if the read was unsuccessful
+    # example, to read 8 bytes from register 0x10 of the device at address 0x50:
+    # buffer = mem_read(0x50, 0x10, 8)
+    # or 4096 bytes from address 0 of a 24C256 EEPROM:
+    # buffer = mem_read(0x50, 0, 4096, reg_bytes=2)
+    def mem_read(self, addr, reg, num_bytes, reg_bytes=1, wait_period=-1):
+        buffer = bytearray(num_bytes)
+        count = self.mem_read_into(addr, reg, buffer, reg_bytes, wait_period)
+        if count is None:
+            return None
+        return bytes(buffer) if count == num_bytes else bytes(buffer[:count])
+
+    # reads len(buf) bytes from a register (memory) address into buf, as i2c_read_into
+    # returns the number of bytes read, or None if the read was unsuccessful
+    def mem_read_into(self, addr, reg, buf, reg_bytes=1, wait_period=-1):
+        view = memoryview(buf).cast("B")
+        num_bytes = len(view)
+        page_size = self._memcfg[1] if self._memcfg is not None else 0
+        if not self.mem_config(reg_bytes, page_size):
             return None
+        if self.framed:
+            if reg_bytes == 1 and num_bytes <= 256:
+                result, count = self._bin_command(BIN_OP_READMEM, (addr, reg, num_bytes & 0xff, num_bytes >> 8),
+                                                  wait_period=wait_period, into=view)
+            else:
+                header = bytes((addr,)) + reg.to_bytes(2, "little") + num_bytes.to_bytes(4, "little")
+                result, count = self._bin_command(BIN_OP_MEMREAD, header, wait_period=wait_period, into=view)
+            return self._check_read_result(result, count, "mem_read")
+        count = self._read_hex_response(f"readmem:0x{addr:02x},0x{reg:02x},{num_bytes}", wait_period, view)
+        if count is None:
+            print("mem_read was unsuccessful")
+        return count
+
+    # reads count values of a NumPy dtype from a register (memory) address, as i2c_read_array
+    # example, 1000 little-endian 16-bit samples from an EEPROM:
+    # samples = mem_read_array(0x50, 0, 1000, "<i2", reg_bytes=2)
+    def mem_read_array(self, addr, reg, count=None, dtype="u1", reg_bytes=1, out=None, wait_period=-1):
+        import numpy as np  # NumPy is only needed for the _array calls
+        if out is None:
+            out = np.empty(count, dtype)
+        if self.mem_read_into(addr, reg, out, reg_bytes, wait_period) != out.nbytes:
+            return None
+        return out
+
+    # writes data (up to 65536 bytes) to a register (memory) address of an I2C device.
+    # Up to 256 bytes go in a single I2C write; more are written in 256-byte parts
+    # reg_bytes: 2 for devices with 16-bit addresses
+    # page_size: for an EEPROM, its page size in bytes. The data is then written a page at a time,
+    # and the adapter waits for each page to be programmed (ACK polling) before the next
+    # returns True if the command was successful, False otherwise
+    # example, to write 0x01, 0x02 to register 0x10 of the device at address 0x50:
+    # mem_write(0x50, 0x10, [0x01, 0x02])
+    # or 1024 bytes to a 24C256 EEPROM, which has 64-byte pages:
+    # mem_write(0x50, 0, data, reg_bytes=2, page_size=64)
+    def mem_write(self, addr, reg, data, reg_bytes=1, page_size=0, wait_period=2000):
+        if not self.mem_config(reg_bytes, page_size):
+            return False
+        if self.framed:
+            if reg_bytes == 1 and page_size == 0 and len(data) <= 256:
+                result, rdata = self._bin_command(BIN_OP_WRITEMEM, (addr, reg, len(data) & 0xff, len(data) >> 8),
+                                                  bytes(data), wait_period)
+            else:
+                header = bytes((addr,)) + reg.to_bytes(2, "little") + len(data).to_bytes(4, "little")
+                result, rdata = self._bin_command(BIN_OP_MEMWRITE, header, bytes(data), wait_period)
+            return self._check_write_result(result)
+        result = self.send_and_confirm(f"bytes:{len(data)}")
+        return self._send_hex_lines(f"writemem:0x{addr:02x},0x{reg:02x}", list(data), wait_period)
     
     # sets a GPIO pin to logic level 0 or 1
     # example, to set Pi Pico GPIO 5 to logic zero:
     # io_write(5, 0)
-    def io_write(self, gpio_num, val):
-        cmd = f"iowrite:{gpio_num},{val}"
-        result = self.send_and_confirm(cmd)
+    def io_write(self, gpio_num, val, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_IOWRITE, (gpio_num, val), wait_period=wait_period)
+        else:
+            cmd = f"iowrite:{gpio_num},{val}"
+            result = self.send_and_confirm(cmd, wait_period)
         if result != 1:
             print(f"Error setting GPIO {gpio_num} to logic {val}")
             return False
@@ -260,11 +1311,17 @@ class EasyAdapter:
     # example, to read Pi Pico GPIO 5:
     # io_read(5)
     # returns -1 if the read was unsuccessful
-    def io_read(self, gpio_num):
+    def io_read(self, gpio_num, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_IOREAD, (gpio_num, 0), wait_period=wait_period)
+            if result != 1 or len(rdata) != 1:
+                print(f"Error reading GPIO {gpio_num}")
+                return -1
+            return rdata[0]
         cmd = f"ioread:{gpio_num}"
-        buffer = self.send_command(cmd)
+        buffer = self.send_command(cmd, until=b".X", wait_period=wait_period)
         # check if the buffer contains the '.' character
-        if b"." not in buffer:
+        if buffer is None or b"." not in buffer:
             print(f"Error reading GPIO {gpio_num}")
             return -1
         if b"0." in buffer:
@@ -274,6 +1331,191 @@ class EasyAdapter:
         else:
             return -1
     
+    # reads the levels of several GPIO pins at the same instant, in a single command
+    # mask: the pins to read, one bit per pin (bit 6 for GPIO 6). The pins are not reconfigured, so
+    # set them up as inputs with io_config_mask first (outputs read back their own level)
+    # returns the levels as an integer, bit 6 for GPIO 6, or -1 if the read was unsuccessful
+    # example, to read an 8-bit parallel bus on GPIO 16 to 23:
+    # io_config_mask(0xff << 16, outputs=0, pullups=0xff << 16)
+    # value = io_read_mask(0xff << 16) >> 16
+    def io_read_mask(self, mask, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_IOREADMASK, mask.to_bytes(4, "little"), wait_period=wait_period)
+            if result != 1 or len(rdata) != 4:
+                print(f"Error reading GPIO mask 0x{mask:08x}")
+                return -1
+            return int.from_bytes(rdata, "little")
+        buffer = self.send_command(f"ioreadmask:0x{mask:x}", until=b".X", wait_period=wait_period)
+        if buffer is None or not buffer.endswith(b".") or len(buffer) < 9:
+            print(f"Error reading GPIO mask 0x{mask:08x}")
+            return -1
+        return int(buffer[-9:-1], 16)
+
+    # sets several GPIO pins as outputs, each to the level of its bit in value, all at the same instant
+    # example, to output 0x5a on GPIO 16 to 23:
+    # io_write_mask(0xff << 16, 0x5a << 16)
+    # returns True if successful, False otherwise
+    def io_write_mask(self, mask, value, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_IOWRITEMASK,
+                                              mask.to_bytes(4, "little") + (value & mask).to_bytes(4, "little"),
+                                              wait_period=wait_period)
+        else:
+            result = self.send_and_confirm(f"iowritemask:0x{mask:x},0x{value & mask:x}", wait_period)
+        if result != 1:
+            print(f"Error setting GPIO mask 0x{mask:08x} to 0x{value & mask:08x}")
+            return False
+        return True
+
+    # sets the direction and pulls of several GPIO pins in one command
+    # outputs: bits set for the pins that become outputs, the rest of mask become inputs
+    # pullups, pulldowns: bits set for the pins that get a pull-up or pull-down, the rest have none
+    # returns True if successful, False otherwise
+    def io_config_mask(self, mask, outputs=0, pullups=0, pulldowns=0, wait_period=-1):
+        if self.framed:
+            header = b"".join((v & 0xffffffff).to_bytes(4, "little") for v in (mask, outputs, pullups, pulldowns))
+            result, rdata = self._bin_command(BIN_OP_IOCFGMASK, header, wait_period=wait_period)
+        else:
+            result = self.send_and_confirm(f"iocfgmask:0x{mask:x},0x{outputs & mask:x},0x{pullups & mask:x},"
+                                           f"0x{pulldowns & mask:x}", wait_period)
+        if result != 1:
+            print(f"Error configuring GPIO mask 0x{mask:08x}")
+            return False
+        return True
+
+    # starts a logic capture on the adapter: samples samples of pin_count GPIOs from first_pin, taken rate
+    # times a second, up to 62.5 MHz, into the adapter's 64 KB buffer (which holds 32 // pin_count samples
+    # per 4 bytes). The I2C pins (14 SDA, 15 SCL) can be included, and are sampled as transfers run.
+    # The capture runs in the background; collect it with capture_read, or use capture for both.
+    # trigger: None to start at once, or "high", "low", "rising" or "falling", on trigger_pin
+    # returns the sample rate achieved (the adapter's clock divider gives the nearest it can), or 0
+    # if the capture could not start
+    def capture_start(self, first_pin, pin_count, rate, samples, trigger=None, trigger_pin=0, wait_period=-1):
+        trig = CAPTURE_TRIGGERS.get(trigger or "none")
+        actual = 0
+        if trig is None:
+            print(f"Unknown capture trigger {trigger}, use one of {', '.join(CAPTURE_TRIGGERS)}")
+            return 0
+        if self.framed:
+            header = (bytes((first_pin, pin_count)) + rate.to_bytes(4, "little") + samples.to_bytes(4, "little") +
+                      bytes((trigger_pin, trig)))
+            result, rdata = self._bin_command(BIN_OP_CAPTURE, header, wait_period=wait_period)
+            if result == 1 and len(rdata) == 4:
+                actual = int.from_bytes(rdata, "little")
+        else:
+            buffer = self.send_command(f"capture:{first_pin},{pin_count},{rate},{samples},{trigger_pin},{trig}",
+                                       until=b".X", wait_period=wait_period)
+            if buffer is not None and buffer.endswith(b".") and buffer[:-1].isdigit():
+                actual = int(buffer[:-1])
+        if actual == 0:
+            print(f"Error starting a capture of {pin_count} GPIOs from {first_pin} at {rate} Hz")
+            return 0
+        self._capture = (first_pin, pin_count, actual)
+        return actual
+
+    # returns the state of the capture ("idle", "armed", "running" or "done"), the number of samples
+    # stored, and their size in bytes, or None if unsuccessful
+    # stop=True ends the capture first, keeping the samples stored so far
+    def capture_status(self, stop=False, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_CAPSTATUS, (1 if stop else 0,), wait_period=wait_period)
+            if result != 1 or len(rdata) != 9 or rdata[0] >= len(CAPTURE_STATES):
+                print("capture_status was unsuccessful")
+                return None
+            return (CAPTURE_STATES[rdata[0]], int.from_bytes(rdata[1:5], "little"),
+                    int.from_bytes(rdata[5:9], "little"))
+        buffer = self.send_command("capstop" if stop else "capstatus", until=b".X", wait_period=wait_period)
+        fields = buffer[:-1].split(b",") if buffer is not None and buffer.endswith(b".") else []
+        if len(fields) != 3 or not all(f.isdigit() for f in fields) or int(fields[0]) >= len(CAPTURE_STATES):
+            print("capture_status was unsuccessful")
+            return None
+        return CAPTURE_STATES[int(fields[0])], int(fields[1]), int(fields[2])
+
+    # uploads the samples stored by the latest capture_start, in bulk, and returns them as a
+    # LogicCapture, or None if unsuccessful. A capture still running is read as far as it has got
+    def capture_read(self, wait_period=2000):
+        if self._capture is None:
+            print("No capture has been started")
+            return None
+        status = self.capture_status()
+        if status is None:
+            return None
+        state, samples, nbytes = status
+        if nbytes == 0:
+            print(f"Nothing captured, the capture is {state}")
+            return None
+        data = bytearray(nbytes)
+        if self.framed:
+            result, count = self._bin_command(BIN_OP_CAPREAD, (0).to_bytes(4, "little") + nbytes.to_bytes(4, "little"),
+                                              wait_period=wait_period, into=memoryview(data))
+            count = count if result == 1 else None
+        else:
+            count = self._read_hex_response(f"capread:0,{nbytes}", wait_period, into=memoryview(data))
+        if count != nbytes:
+            print("capture_read was unsuccessful")
+            return None
+        first_pin, pin_count, rate = self._capture
+        return LogicCapture(data, first_pin, pin_count, rate, samples)
+
+    # captures samples samples of pin_count GPIOs from first_pin at rate Hz (see capture_start), waits
+    # for the capture to finish, and returns it as a LogicCapture, or None if unsuccessful
+    # if it has not finished after timeout seconds (e.g. the trigger never came), it is stopped, and
+    # whatever was stored is returned
+    # example, to capture 20 ms of I2C traffic at 2 MHz, from the start of the next transfer:
+    # cap = capture(I2C_SDA_PIN, 2, 2000000, 40000, trigger="falling", trigger_pin=I2C_SDA_PIN)
+    def capture(self, first_pin, pin_count, rate, samples, trigger=None, trigger_pin=0, timeout=10.0,
+                wait_period=2000):
+        if self.capture_start(first_pin, pin_count, rate, samples, trigger, trigger_pin) == 0:
+            return None
+        end = time.monotonic() + timeout
+        while True:
+            status = self.capture_status()
+            if status is None:
+                return None
+            if status[0] == "done":
+                break
+            if time.monotonic() >= end:
+                print(f"Capture timed out while {status[0]}, stopping it")
+                if self.capture_status(stop=True) is None:
+                    return None
+                break
+            time.sleep(0.01)
+        return self.capture_read(wait_period)
+
+    # reads the adapter's performance counters and timing histograms (see stats.h in the firmware)
+    # returns a dict with:
+    #   "time_us": microseconds since the stats were last cleared
+    #   "counters": each counter by name, e.g. "i2c_naks" or "host_waits"
+    #   "histograms": by name ("parse", "bus", "output", "host_wait", "stall"), each a dict with
+    #   "count", "total_us", "max_us" and "buckets", a list of log2 bucket counts: bucket 0 holds
+    #   durations of 0 usec, bucket n durations of 2^(n-1) to 2^n - 1 usec
+    # reset=True clears the stats once they have been read. Returns None if unsuccessful
+    def get_stats(self, reset=False, wait_period=2000):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_STATS, (0,), wait_period=wait_period)
+            rdata = rdata if result == 1 else None
+        else:
+            rdata = self._read_hex_response("stats", wait_period)
+        if rdata is None:
+            print("get_stats was unsuccessful")
+            return None
+        stats = parse_stats(rdata.decode())
+        if reset and not self.reset_stats():
+            return None
+        return stats
+
+    # clears the adapter's performance counters and timing histograms
+    # returns True if successful, False otherwise
+    def reset_stats(self, wait_period=-1):
+        if self.framed:
+            result, rdata = self._bin_command(BIN_OP_STATS, (1,), wait_period=wait_period)
+        else:
+            result = self.send_and_confirm("stats:reset", wait_period)
+        if result != 1:
+            print("Error clearing the stats")
+            return False
+        return True
+
     # this function is used to locate the easy_adapter, and to set it to M2M mode
     # the board value is between 0 and 7 (multiple easy_adapters can be connected to the PC)
     # the board value is set using certain GPIO pins shorted to ground 
@@ -289,11 +1531,14 @@ class EasyAdapter:
     # 1      0      1       2
     # 1      1      0       1
     # 1      1      1       0
-    def init(self, board=0):
-        res = self.find_device(board)
+    # set binary to True to use the framed binary protocol (see bin_mode) instead of ASCII lines
+    def init(self, board=0, binary=False, port=None):
+        res = self.find_device(board, port)
         if res is None:
             return False
         self.m2m_mode(1)
+        if binary:
+            return self.bin_mode(1)
         return True
     
     # this utility function can be used to print data in hex and ASCII
@@ -1070,3 +2315,493 @@ class EasyAdapter:
         [0x7f, "PCA9685"], \
         ]
 
+
+# the outcome of one board's part of an AdapterGroup operation.
+# value is what the EasyAdapter call returned, error the exception it raised (if any).
+# ok is False if there was an exception, or the call returned None or False
+class BoardResult:
+    def __init__(self, board, value=None, error=None):
+        self.board = board
+        self.value = value
+        self.error = error
+        self.ok = error is None and value is not None and value is not False
+
+    def __repr__(self):
+        if self.error is not None:
+            return f"BoardResult({self.board}, error={self.error!r})"
+        return f"BoardResult({self.board}, {self.value!r})"
+
+# operates several adapters at the same time. Each board has its own EasyAdapter and its own
+# worker thread, which does all the I/O for that board's port, so an operation on every board
+# takes about as long as one round trip on the slowest board:
+# with ea.AdapterGroup() as group:         # all connected boards, or AdapterGroup([0, 1])
+#     res = group.call("mem_read", 0x48, 0x00, 2)
+#     for board, r in res.items():
+#         print(board, r.value if r.ok else "failed")
+# results are returned as a dict of board number to BoardResult
+class AdapterGroup:
+    # boards: list of board numbers, or None for every adapter found
+    # ports: optional dict of board number to port, to skip discovery (for instance for simulated adapters)
+    def __init__(self, boards=None, binary=False, ports=None, wait_period=500):
+        self.adapters = {}
+        self._workers = {}
+        if ports is None:
+            ports = discover_adapters(wait_period)
+        if boards is None:
+            boards = sorted(ports.keys())
+        for board in boards:
+            if board not in ports:
+                print(f"No easy_adapter_{board} device found")
+                continue
+            self.adapters[board] = EasyAdapter()
+            self._workers[board] = ThreadPoolExecutor(max_workers=1)
+        # init each board on its own worker, so the ports are opened and set up in parallel
+        self.init_results = self.run(lambda a, board: a.init(board, binary, port=ports[board]),
+                                     pass_board=True)
+        for board, r in self.init_results.items():
+            if not r.ok:
+                self.adapters[board].close()
+                del self.adapters[board]
+                self._workers.pop(board).shutdown()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def close(self):
+        for board, a in self.adapters.items():
+            self._workers[board].submit(a.close).result()
+            self._workers[board].shutdown()
+        self.adapters = {}
+        self._workers = {}
+
+    @property
+    def boards(self):
+        return sorted(self.adapters.keys())
+
+    # runs fn(adapter) on each board's worker (fn(adapter, board) if pass_board is True), all at once,
+    # and waits for every board to finish. boards: a subset of the group, default all of it
+    def run(self, fn, boards=None, pass_board=False):
+        if boards is None:
+            boards = self.boards
+        futures = {}
+        for board in boards:
+            if board not in self.adapters:
+                continue
+            a = self.adapters[board]
+            if pass_board:
+                futures[board] = self._workers[board].submit(fn, a, board)
+            else:
+                futures[board] = self._workers[board].submit(fn, a)
+        results = {}
+        for board in boards:
+            if board not in futures:
+                results[board] = BoardResult(board, error=KeyError(f"easy_adapter_{board} is not in the group"))
+                continue
+            try:
+                results[board] = BoardResult(board, futures[board].result())
+            except Exception as e:
+                results[board] = BoardResult(board, error=e)
+        return results
+
+    # calls the same EasyAdapter method, with the same arguments, on every board (or on boards)
+    # for example group.call("io_write", 6, 1) or group.call("i2c_read", 0x48, 2, boards=[0, 3])
+    def call(self, method, *args, boards=None, **kwargs):
+        return self.run(lambda a: getattr(a, method)(*args, **kwargs), boards)
+
+    # runs a different operation on each board: ops is a dict of board number to fn(adapter)
+    # for example group.each({0: lambda a: a.io_write(6, 1), 1: lambda a: a.i2c_read(0x50, 4)})
+    def each(self, ops):
+        boards = list(ops.keys())
+        return self.run(lambda a, board: ops[board](a), boards, pass_board=True)
+
+# asyncio version of EasyAdapter, for use inside an event loop without a thread per board.
+# It uses the framed binary protocol, and several requests can be outstanding at once: each is sent
+# as soon as it is awaited, and the adapter's responses (which come back in the order the requests
+# were sent) complete them in turn. The event loop is never blocked waiting for the adapter.
+# example:
+# async with AsyncEasyAdapter() as a:
+#     await a.init(0)
+#     results = await asyncio.gather(a.i2c_read(0x48, 2), a.io_read(5), a.i2c_try_address(0x50))
+# transfers that don't fit in a single frame (writes of more than 252 bytes, or reads of 256 bytes)
+# need an exchange of DATA frames; they wait for the outstanding requests to finish, and run on their own
+class AsyncEasyAdapter:
+    def __init__(self, max_outstanding=8):
+        self.adapter_port = None
+        self.cmd_wait_period = 500
+        self.max_outstanding = max_outstanding
+        self.ser = None
+        self._loop = None
+        self._rx = bytearray()
+        self._pending = collections.deque()  # futures of the requests awaiting a response, oldest first
+        self._frames = None  # while a DATA frame exchange runs, the queue that receives every frame
+        self._slots = None
+        self._send_lock = None
+        self._idle = None  # set while no request is outstanding
+        self._reader = None  # the reader thread, on platforms where the port can't be watched by the loop
+        self._closing = False
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, exc_type, exc_value, traceback):
+        await self.close()
+
+    # finds the adapter (as EasyAdapter.find_device does), sets it to binary M2M mode, and starts reading
+    # the port. Returns True if successful, False otherwise
+    async def init(self, board=0, port=None):
+        self._loop = asyncio.get_running_loop()
+        self._slots = asyncio.Semaphore(self.max_outstanding)
+        self._send_lock = asyncio.Lock()
+        self._idle = asyncio.Event()
+        self._idle.set()
+
+        # the setup is the same as for EasyAdapter, so run its blocking calls on a worker thread
+        def setup():
+            a = EasyAdapter()
+            if not a.init(board, binary=True, port=port):
+                a.close()
+                return None, None
+            ser = a.ser
+            a.ser = None  # the port now belongs to this adapter
+            return a.adapter_port, ser
+
+        self.adapter_port, self.ser = await self._loop.run_in_executor(None, setup)
+        if self.ser is None:
+            return False
+        self._closing = False
+        try:
+            self.ser.timeout = 0  # non-blocking reads
+            self._loop.add_reader(self.ser.fileno(), self._on_readable)
+        except (NotImplementedError, AttributeError, OSError, ValueError):
+            # for instance on Windows: a thread does the blocking reads and hands the data to the loop
+            self.ser.timeout = 0.02
+            self._reader = threading.Thread(target=self._read_thread, daemon=True)
+            self._reader.start()
+        return True
+
+    async def close(self):
+        if self.ser is None:
+            return
+        self._closing = True
+        if self._reader is not None:
+            await self._loop.run_in_executor(None, self._reader.join)
+            self._reader = None
+        else:
+            self._loop.remove_reader(self.ser.fileno())
+        self._fail_pending()
+        self.ser.close()
+        self.ser = None
+
+    def _on_readable(self):
+        try:
+            data = self.ser.read(self.ser.in_waiting or 1)
+        except serial.SerialException:
+            data = b""
+        if data:
+            self._feed(data)
+
+    def _read_thread(self):
+        while not self._closing:
+            try:
+                data = self.ser.read(self.ser.in_waiting or 1)
+            except serial.SerialException:
+                break
+            if data:
+                self._loop.call_soon_threadsafe(self._feed, data)
+
+    # splits the received bytes into frames, and hands each frame to the request it belongs to
+    def _feed(self, data):
+        self._rx += data
+        while True:
+            sof = self._rx.find(FRAME_SOF)
+            if sof < 0:
+                self._rx.clear()
+                return
+            del self._rx[:sof]
+            if len(self._rx) < 5:
+                return
+            n = self._rx[3] | (self._rx[4] << 8)
+            if n > FRAME_MAX_PAYLOAD:
+                del self._rx[:1]  # not a real frame start
+                continue
+            if len(self._rx) < 5 + n + 2:
+                return
+            frame = bytes(self._rx[:5 + n + 2])
+            del self._rx[:5 + n + 2]
+            crc = binascii.crc_hqx(frame[1:5 + n], 0xFFFF)
+            if crc != (frame[5 + n] | (frame[6 + n] << 8)):
+                self._dispatch((FRAME_BAD, frame[2], b""))
+            else:
+                self._dispatch((frame[1], frame[2], frame[5:5 + n]))
+
+    def _dispatch(self, frame):
+        if self._frames is not None:
+            self._frames.put_nowait(frame)
+            return
+        if frame[0] == FRAME_SAMPLE:
+            return
+        if len(self._pending) > 0:
+            fut = self._pending.popleft()
+            if not fut.done():  # the response of a cancelled request is dropped
+                fut.set_result(frame)
+            if len(self._pending) == 0:
+                self._idle.set()
+
+    # ends every outstanding request with no response. Used when one times out, since any later
+    # responses can no longer be matched to their requests
+    def _fail_pending(self):
+        while len(self._pending) > 0:
+            fut = self._pending.popleft()
+            if not fut.done():
+                fut.set_result((None, 0, b""))
+        self._idle.set()
+        self._rx.clear()
+        if self.ser is not None:
+            self.ser.reset_input_buffer()
+
+    def _send_frame(self, ftype, seq, payload=b""):
+        n = len(payload)
+        body = bytes((ftype, seq & 0xff, n & 0xff, n >> 8)) + bytes(payload)
+        crc = binascii.crc_hqx(body, 0xFFFF)
+        self.ser.write(bytes((FRAME_SOF,)) + body + bytes((crc & 0xff, crc >> 8)))
+
+    def _timeout(self, wait_period):
+        return (self.cmd_wait_period if wait_period < 0 else wait_period) / 1000.0
+
+    # sends a binary command whose response is a single RESP frame, and returns (result code, data)
+    # using the result codes of send_and_confirm
+    async def _command(self, op, header, data=b"", wait_period=-1):
+        if self.ser is None:
+            print("No easy_adapter selected. Call init() first")
+            return 0, b""
+        async with self._slots:
+            async with self._send_lock:  # waits for any DATA frame exchange to finish
+                fut = self._loop.create_future()
+                self._pending.append(fut)
+                self._idle.clear()
+                self._send_frame(FRAME_CMD, 0, bytes((op,)) + bytes(header) + bytes(data))
+            try:
+                ftype, seq, payload = await asyncio.wait_for(fut, self._timeout(wait_period))
+            except asyncio.TimeoutError:
+                self._fail_pending()
+                return 0, b""
+        return self._resp_code(ftype, payload), bytes(payload[1:])
+
+    # sends a binary command that needs an exchange of DATA frames, with no other request outstanding
+    # data: the bytes to write; the command frame carries what fits, DATA frames the rest
+    async def _bulk_command(self, op, header, data=b"", wait_period=-1):
+        if self.ser is None:
+            print("No easy_adapter selected. Call init() first")
+            return 0, b""
+        async with self._send_lock:
+            try:  # let the outstanding requests finish
+                await asyncio.wait_for(self._idle.wait(), self._timeout(wait_period))
+            except asyncio.TimeoutError:
+                self._fail_pending()
+            self._frames = asyncio.Queue()
+            try:
+                return await self._exchange(op, header, data, self._timeout(wait_period))
+            finally:
+                self._frames = None
+
+    async def _next_frame(self, timeout):
+        try:
+            return await asyncio.wait_for(self._frames.get(), timeout)
+        except asyncio.TimeoutError:
+            return None, 0, b""
+
+    # the same exchange as EasyAdapter._bin_command, _stream_out and _stream_in
+    async def _exchange(self, op, header, data, timeout):
+        room = FRAME_MAX_PAYLOAD - 1 - len(header)
+        self._send_frame(FRAME_CMD, 0, bytes((op,)) + bytes(header) + bytes(data[:room]))
+        ftype, seq, resp = await self._next_frame(timeout)
+        if ftype == FRAME_ACK and len(data) > room:
+            credit = resp[0] if len(resp) > 0 and resp[0] > 0 else FRAME_WINDOW
+            data = data[room:]
+            chunks = [data[i:i + FRAME_DATA_CHUNK] for i in range(0, len(data), FRAME_DATA_CHUNK)]
+            nxt = 0
+            acked = 0
+            while True:
+                while nxt < len(chunks) and (nxt - acked) < credit:
+                    self._send_frame(FRAME_DATA, nxt, chunks[nxt])
+                    nxt += 1
+                ftype, seq, resp = await self._next_frame(timeout)
+                if ftype == FRAME_ACK:
+                    delta = (seq + 1 - acked) & 0xff
+                    if delta <= nxt - acked:
+                        acked += delta
+                    if len(resp) > 0 and resp[0] > 0:
+                        credit = resp[0]
+                elif ftype == FRAME_NAK:
+                    delta = (seq - acked) & 0xff
+                    if delta < nxt - acked:
+                        acked += delta
+                        nxt = acked
+                elif ftype != FRAME_BAD:
+                    return self._resp_code(ftype, resp), b""
+        buffer = bytearray()
+        expected = 0
+        nak_sent = False
+        while True:
+            if ftype == FRAME_DATA:
+                if seq == (expected & 0xff):
+                    buffer += resp
+                    expected += 1
+                    nak_sent = False
+                    self._send_frame(FRAME_ACK, seq, bytes((FRAME_WINDOW,)))
+                elif not nak_sent and ((seq - expected) & 0xff) < 128:
+                    self._send_frame(FRAME_NAK, expected)
+                    nak_sent = True
+            elif ftype == FRAME_BAD:
+                if not nak_sent:
+                    self._send_frame(FRAME_NAK, expected)
+                    nak_sent = True
+            else:
+                break
+            ftype, seq, resp = await self._next_frame(timeout)
+        result = self._resp_code(ftype, resp)
+        if result == 1:
+            buffer += resp[1:]
+        return result, bytes(buffer)
+
+    def _resp_code(self, ftype, payload):
+        if ftype != FRAME_RESP or len(payload) == 0:
+            return 0
+        return {0x2e: 1, 0x26: 2, 0x7e: 3, 0x54: 4}.get(payload[0], 0)
+
+    def _report(self, result, name):
+        if result == 3:
+            print("Protocol error, does the I2C device exist?")
+        elif result == 4:
+            print("Bus timeout, the adapter has recovered the bus")
+        print(f"{name} was unsuccessful")
+
+    # returns True if the address ACKs
+    async def i2c_try_address(self, addr, wait_period=-1):
+        result, rdata = await self._command(BIN_OP_TRYADDR, (addr,), wait_period=wait_period)
+        return result == 1
+
+    # writes byte1 followed by data, as EasyAdapter.i2c_write. Returns True if successful
+    async def i2c_write(self, addr, byte1, data, hold=0, wait_period=2000):
+        payload = bytes([byte1]) + bytes(data)
+        op = BIN_OP_WRITE_HOLD if hold == 1 else BIN_OP_WRITE
+        header = (addr, len(payload) & 0xff, len(payload) >> 8)
+        if len(payload) > FRAME_MAX_PAYLOAD - 1 - len(header):
+            result, rdata = await self._bulk_command(op, header, payload, wait_period)
+        else:
+            result, rdata = await self._command(op, header, payload, wait_period)
+        if result != 1:
+            self._report(result, "i2c_write")
+            return False
+        return True
+
+    # reads num_bytes (up to 256). Returns the data, or None if unsuccessful
+    async def i2c_read(self, addr, num_bytes, wait_period=-1):
+        header = (addr, num_bytes & 0xff, num_bytes >> 8)
+        if num_bytes >= FRAME_MAX_PAYLOAD:
+            result, rdata = await self._bulk_command(BIN_OP_READ, header, wait_period=wait_period)
+        else:
+            result, rdata = await self._command(BIN_OP_READ, header, wait_period=wait_period)
+        if result != 1:
+            self._report(result, "i2c_read")
+            return None
+        return rdata
+
+    async def io_write(self, gpio_num, val, wait_period=-1):
+        result, rdata = await self._command(BIN_OP_IOWRITE, (gpio_num, val), wait_period=wait_period)
+        if result != 1:
+            print(f"Error setting GPIO {gpio_num} to logic {val}")
+            return False
+        return True
+
+    # returns the logic level, or -1 if the read was unsuccessful
+    async def io_read(self, gpio_num, wait_period=-1):
+        result, rdata = await self._command(BIN_OP_IOREAD, (gpio_num, 0), wait_period=wait_period)
+        if result != 1 or len(rdata) != 1:
+            print(f"Error reading GPIO {gpio_num}")
+            return -1
+        return rdata[0]
+
+    # as EasyAdapter.select_bus: the requests after this one run on bus, while those already
+    # outstanding on another bus carry on
+    async def select_bus(self, bus, wait_period=-1):
+        result, rdata = await self._command(BIN_OP_BUS, (bus,), wait_period=wait_period)
+        if result != 1:
+            print(f"Error selecting I2C bus {bus}")
+            return False
+        return True
+
+    async def bus_config(self, bus, sda=None, scl=None, wait_period=-1):
+        result, rdata = await self._command(BIN_OP_BUSCFG, (bus, 0xff if sda is None else sda,
+                                                            0xff if scl is None else scl),
+                                            wait_period=wait_period)
+        if result != 1:
+            print(f"Error configuring I2C bus {bus}")
+            return False
+        return True
+
+# the Unix socket that easy_daemon.py serves board on, by default
+def daemon_socket_path(board=0):
+    return os.path.join(tempfile.gettempdir(), f"easy_adapter_{board}.sock")
+
+# uses an adapter through easy_daemon.py, which keeps the adapter's port open and shares it between
+# programs. The calls are the same as EasyAdapter's, and so are their results:
+# adapter = EasyAdapterClient(0)   # board 0, or EasyAdapterClient(path="/some/socket")
+# adapter.i2c_write(0x50, 0x10, [0x01, 0x02])
+# A write with hold=1 keeps the bus for this client, until its next I2C call
+class EasyAdapterClient:
+    def __init__(self, board=0, path=None):
+        self.path = daemon_socket_path(board) if path is None else path
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(self.path)
+        self.rfile = self.sock.makefile("rb")
+
+    def close(self):
+        if self.sock is not None:
+            self.rfile.close()
+            self.sock.close()
+            self.sock = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def _call(self, op, *args):
+        self.sock.sendall(json.dumps({"op": op, "args": list(args)}).encode() + b"\n")
+        line = self.rfile.readline()
+        if not line:
+            raise ConnectionError(f"easy_daemon at {self.path} closed the connection")
+        reply = json.loads(line)
+        if "error" in reply:
+            raise RuntimeError(reply["error"])
+        result = reply["result"]
+        if isinstance(result, dict) and "bytes" in result:
+            return bytes.fromhex(result["bytes"])
+        return result
+
+    def i2c_try_address(self, addr):
+        return self._call("i2c_try_address", addr)
+
+    def i2c_write(self, addr, byte1, data, hold=0):
+        return self._call("i2c_write", addr, byte1, list(data), hold)
+
+    def i2c_read(self, addr, num_bytes):
+        return self._call("i2c_read", addr, num_bytes)
+
+    def io_write(self, gpio_num, val):
+        return self._call("io_write", gpio_num, val)
+
+    def io_read(self, gpio_num):
+        return self._call("io_read", gpio_num)
+
+    # the bus selected is this client's own, the daemon switches the adapter to it for each I2C call
+    def select_bus(self, bus):
+        return self._call("select_bus", bus)
+
+    def bus_config(self, bus, sda=None, scl=None):
+        return self._call("bus_config", bus, sda, scl)
@@ -0,0 +1,126 @@
+# unit tests for the logic capture decoding in easyadapter: unpack_capture and LogicCapture,
+# on synthetic buffers, with no adapter needed
+# run with: python -m unittest test_capture
+
+import io
+import random
+import unittest
+import easyadapter as ea
+
+
+# packs sample values as the adapter does (see capture.h in the firmware): 32 // pin_count samples
+# to each little-endian word, sample k of a word at bit 32 - (32 // pin_count) * pin_count + k * pin_count
+def pack(values, pin_count, fill=0):
+    per_word = 32 // pin_count
+    base = 32 - per_word * pin_count
+    data = bytearray()
+    for i in range(0, len(values), per_word):
+        word = fill & ((1 << base) - 1)  # the unused low bits, which unpacking must ignore
+        for k, v in enumerate(values[i:i + per_word]):
+            word |= v << (base + k * pin_count)
+        data += word.to_bytes(4, "little")
+    return bytes(data)
+
+
+class UnpackTest(unittest.TestCase):
+    def test_two_pins(self):
+        # 0x1b = 0b00011011: samples 3, 2, 1, 0 from the lowest bits up, then zeros
+        values = ea.unpack_capture(bytes([0x1b, 0, 0, 0]), 2)
+        self.assertEqual(len(values), 16)
+        self.assertEqual(values[:4], [3, 2, 1, 0])
+        self.assertEqual(values[4:], [0] * 12)
+        self.assertEqual(ea.unpack_capture(bytes([0, 0, 0, 0x1b]), 2)[12:], [3, 2, 1, 0])
+
+    def test_four_pins(self):
+        self.assertEqual(ea.unpack_capture((0x87654321).to_bytes(4, "little"), 4), [1, 2, 3, 4, 5, 6, 7, 8])
+
+    def test_words_in_order(self):
+        data = (0x11111111).to_bytes(4, "little") + (0x22222222).to_bytes(4, "little")
+        self.assertEqual(ea.unpack_capture(data, 8), [0x11] * 4 + [0x22] * 4)
+
+    def test_three_pins_offset(self):
+        # 10 samples of 3 pins fill bits 2 to 31, bits 0 and 1 are not used
+        values = [0, 1, 2, 3, 4, 5, 6, 7, 5, 2]
+        word = sum(v << (2 + 3 * k) for k, v in enumerate(values))
+        self.assertEqual(ea.unpack_capture(word.to_bytes(4, "little"), 3), values)
+        self.assertEqual(ea.unpack_capture((word | 0x3).to_bytes(4, "little"), 3), values)
+
+    def test_one_sample_per_word(self):
+        # 17 pins or more take a word each, in its top bits
+        self.assertEqual(ea.unpack_capture((0x1ffff << 15).to_bytes(4, "little"), 17), [0x1ffff])
+        self.assertEqual(ea.unpack_capture((0x12345 << 15 | 0x7fff).to_bytes(4, "little"), 17), [0x12345])
+        self.assertEqual(ea.unpack_capture(bytes([1, 2, 3, 4]), 32), [0x04030201])
+
+    def test_round_trip(self):
+        rng = random.Random(1)
+        for pin_count in (1, 2, 3, 4, 5, 6, 7, 8, 11, 16, 17, 24, 32):
+            per_word = 32 // pin_count
+            values = [rng.getrandbits(pin_count) for _ in range(per_word * 5)]
+            data = pack(values, pin_count, fill=0xffffffff)
+            self.assertEqual(ea.unpack_capture(data, pin_count), values, f"{pin_count} pins")
+
+    def test_truncation(self):
+        data = pack(list(range(16)), 4)
+        self.assertEqual(ea.unpack_capture(data, 4, samples=5), [0, 1, 2, 3, 4])
+        self.assertEqual(ea.unpack_capture(data, 4, samples=16), list(range(16)))
+        self.assertEqual(ea.unpack_capture(data, 4, samples=100), list(range(16)))
+        # 3 pins: the last word is only partly used
+        values = [1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4]
+        self.assertEqual(ea.unpack_capture(pack(values, 3), 3, samples=12), values)
+
+    def test_partial_word_ignored(self):
+        self.assertEqual(ea.unpack_capture(bytes([0x1b, 0, 0, 0, 0xff, 0xff]), 2)[:4], [3, 2, 1, 0])
+        self.assertEqual(len(ea.unpack_capture(bytes([0x1b, 0, 0, 0, 0xff, 0xff]), 2)), 16)
+        self.assertEqual(ea.unpack_capture(b"", 2), [])
+
+
+class LogicCaptureTest(unittest.TestCase):
+    def test_pin(self):
+        cap = ea.LogicCapture(bytes([0x1b, 0, 0, 0]), first_pin=14, pin_count=2, rate=1000000)
+        self.assertEqual(len(cap), 16)
+        self.assertEqual(list(cap.gpios), [14, 15])
+        self.assertEqual(cap.pin(14), b"\x01\x00\x01\x00" + bytes(12))
+        self.assertEqual(cap.pin(15), b"\x01\x01\x00\x00" + bytes(12))
+        self.assertEqual(cap.pins(), {14: cap.pin(14), 15: cap.pin(15)})
+        self.assertIsNone(cap.pin(16))
+
+    def test_pin_three_pins(self):
+        values = [0, 1, 2, 3, 4, 5, 6, 7]
+        cap = ea.LogicCapture(pack(values, 3), first_pin=20, pin_count=3, rate=1000, samples=8)
+        self.assertEqual(cap.pin(20), bytes([v & 1 for v in values]))
+        self.assertEqual(cap.pin(21), bytes([(v >> 1) & 1 for v in values]))
+        self.assertEqual(cap.pin(22), bytes([(v >> 2) & 1 for v in values]))
+
+    def test_vcd(self):
+        # samples 3, 2, 1, 0, 0, 0 of SDA (bit 0) and SCL (bit 1), at 1 MHz
+        cap = ea.LogicCapture(bytes([0x1b, 0, 0, 0]), first_pin=14, pin_count=2, rate=1000000, samples=6)
+        expected = "\n".join([
+            "$version easyadapter logic capture $end",
+            "$timescale 1ns $end",
+            "$scope module easy_adapter $end",
+            "$var wire 1 ! sda $end",
+            '$var wire 1 " scl $end',
+            "$upscope $end",
+            "$enddefinitions $end",
+            "#0", "$dumpvars", "1!", '1"', "$end",
+            "#1000", "0!",
+            "#2000", "1!", '0"',
+            "#3000", "0!",
+            "#6000",
+        ]) + "\n"
+        self.assertEqual(cap.vcd(), expected)
+        f = io.StringIO()
+        cap.write_vcd(f)
+        self.assertEqual(f.getvalue(), expected)
+
+    def test_vcd_names_and_timescale(self):
+        # 3 MHz is not a whole number of ns per sample, so the times are in ps
+        cap = ea.LogicCapture(bytes([0x01, 0, 0, 0]), first_pin=2, pin_count=1, rate=3000000, samples=3)
+        text = cap.vcd({2: "clk"})
+        self.assertIn("$timescale 1ps $end", text)
+        self.assertIn("$var wire 1 ! clk $end", text)
+        self.assertTrue(text.endswith("#333333\n0!\n#1000000\n"))
+
+
+if __name__ == "__main__":
+    unittest.main()